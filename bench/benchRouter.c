@@ -0,0 +1,132 @@
+/* Copyright [2017] [Comcast, Corp.]
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "benchRouter.h"
+
+#include "rtError.h"
+#include "rtSocket.h"
+
+#include <errno.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+// plain connect() rather than rtConnection_Create, that would try to start a
+// default rtrouted if ours isn't up yet
+int
+bench_can_connect(char const* endpoint)
+{
+  int fd;
+  int ret;
+  socklen_t len;
+  struct sockaddr_storage addr;
+
+  if (rtSocketStorage_FromString(&addr, endpoint) != RT_OK)
+    return 0;
+  rtSocketStorage_GetLength(&addr, &len);
+
+  fd = socket(addr.ss_family, SOCK_STREAM, 0);
+  if (fd == -1)
+    return 0;
+  ret = connect(fd, (struct sockaddr *) &addr, len);
+  close(fd);
+  return ret == 0;
+}
+
+pid_t
+bench_start_router(char const* path, char* const* endpoints, int num_endpoints, char const* extra)
+{
+  int i;
+  int argc;
+  int status;
+  pid_t pid;
+  char* argv[64];
+  char* extra_copy;
+  char* save = NULL;
+  char* tok;
+
+  argc = 0;
+  argv[argc++] = (char *) path;
+  argv[argc++] = (char *) "-f";
+  argv[argc++] = (char *) "-l";
+  argv[argc++] = (char *) "error";
+  for (i = 0; i < num_endpoints; ++i)
+  {
+    argv[argc++] = (char *) "-s";
+    argv[argc++] = endpoints[i];
+  }
+
+  extra_copy = extra ? strdup(extra) : NULL;
+  for (tok = extra_copy ? strtok_r(extra_copy, " ", &save) : NULL; tok && argc < 63;
+    tok = strtok_r(NULL, " ", &save))
+    argv[argc++] = tok;
+  argv[argc] = NULL;
+
+  pid = fork();
+  if (pid == 0)
+  {
+    execv(path, argv);
+    fprintf(stderr, "failed to run %s. %s\n", path, strerror(errno));
+    _exit(127);
+  }
+  free(extra_copy);
+
+  if (pid == -1)
+  {
+    fprintf(stderr, "fork failed. %s\n", strerror(errno));
+    return -1;
+  }
+
+  // up to 5 seconds for every listener to come up
+  for (i = 0; i < 500; ++i)
+  {
+    int j;
+    int up = 1;
+
+    if (waitpid(pid, &status, WNOHANG) == pid)
+    {
+      if (WIFEXITED(status) && WEXITSTATUS(status) == 12)
+        fprintf(stderr, "another rtrouted is already running, stop it or use -x\n");
+      else
+        fprintf(stderr, "%s exited during startup\n", path);
+      return -1;
+    }
+
+    for (j = 0; j < num_endpoints && up; ++j)
+      up = bench_can_connect(endpoints[j]);
+    if (up)
+      return pid;
+    usleep(10000);
+  }
+
+  fprintf(stderr, "timed out waiting for %s\n", path);
+  kill(pid, SIGTERM);
+  waitpid(pid, &status, 0);
+  return -1;
+}
+
+void
+bench_stop_child(pid_t pid)
+{
+  int status;
+
+  if (pid <= 0)
+    return;
+  kill(pid, SIGTERM);
+  waitpid(pid, &status, 0);
+}
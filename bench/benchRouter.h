@@ -0,0 +1,46 @@
+/* Copyright [2017] [Comcast, Corp.]
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef __BENCH_ROUTER_H__
+#define __BENCH_ROUTER_H__
+
+#include <sys/types.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Whether something is accepting connections on endpoint.
+ */
+int bench_can_connect(char const* endpoint);
+
+/**
+ * Runs the rtrouted at path in the foreground listening on every endpoint, extra
+ * holds further space separated arguments or is NULL. Returns once every endpoint
+ * accepts connections.
+ * @return the router's pid or -1 if it didn't come up
+ */
+pid_t bench_start_router(char const* path, char* const* endpoints, int num_endpoints, char const* extra);
+
+/**
+ * Stops a process started by the benchmark and waits for it, does nothing for
+ * pid <= 0.
+ */
+void bench_stop_child(pid_t pid);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
@@ -0,0 +1,615 @@
+/* Copyright [2017] [Comcast, Corp.]
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "benchRouter.h"
+#include "dmClient.h"
+#include "dmModelImage.h"
+#include "dmProvider.h"
+#include "dmProviderDatabase.h"
+#include "dmProviderHost.h"
+
+#include <rtError.h>
+#include <rtHistogram.h>
+#include <rtLog.h>
+
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <getopt.h>
+#include <map>
+#include <signal.h>
+#include <sstream>
+#include <string>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+#include <vector>
+
+// dmProviderHost and dmQuery always talk to the router here
+#define BENCH_ROUTER_ENDPOINT "tcp://127.0.0.1:10001"
+#define BENCH_OBJECT "Device.Bench"
+#define BENCH_LIST_OBJECT "Device.Bench.Item"
+#define BENCH_STOP 0xff
+
+namespace
+{
+  enum benchQueryType
+  {
+    benchQueryType_Get,
+    benchQueryType_Set,
+    benchQueryType_Wildcard,
+    benchQueryType_List,
+    benchQueryType_Batch,
+    benchQueryType_Count
+  };
+
+  char const* const bench_query_names[benchQueryType_Count] = { "get", "set", "wildcard", "list", "batch" };
+
+  struct benchOptions
+  {
+    int numProperties;
+    int listSize;
+    int numClients;
+    int numQueries;
+    int numWorkers;
+    int getDelay;
+  };
+
+  // sent back to the parent after each phase, followed by count latencies
+  struct benchPhaseResult
+  {
+    uint32_t count;
+    uint32_t errors;
+    uint32_t values;
+  };
+
+  uint64_t
+  bench_now()
+  {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ((uint64_t) ts.tv_sec * 1000000000ull) + (uint64_t) ts.tv_nsec;
+  }
+
+  bool
+  bench_write_full(int fd, void const* buff, size_t n)
+  {
+    uint8_t const* p = static_cast<uint8_t const *>(buff);
+    while (n > 0)
+    {
+      ssize_t ret = write(fd, p, n);
+      if (ret == -1 && errno == EINTR)
+        continue;
+      if (ret <= 0)
+        return false;
+      p += ret;
+      n -= ret;
+    }
+    return true;
+  }
+
+  bool
+  bench_read_full(int fd, void* buff, size_t n)
+  {
+    uint8_t* p = static_cast<uint8_t *>(buff);
+    while (n > 0)
+    {
+      ssize_t ret = read(fd, p, n);
+      if (ret == -1 && errno == EINTR)
+        continue;
+      if (ret <= 0)
+        return false;
+      p += ret;
+      n -= ret;
+    }
+    return true;
+  }
+
+  std::string
+  bench_property_name(int i)
+  {
+    std::stringstream s;
+    s << "Prop" << (i + 1);
+    return s.str();
+  }
+
+  bool
+  bench_write_model(std::string const& dir, benchOptions const& opts)
+  {
+    std::string path = dir + "/" BENCH_OBJECT ".json";
+    FILE* f = fopen(path.c_str(), "w");
+    if (!f)
+      return false;
+
+    fprintf(f, "{\n  \"name\": \"%s\",\n  \"provider\": \"dmbench\",\n  \"properties\":\n    [\n", BENCH_OBJECT);
+    fprintf(f, "      {\"name\": \"ItemNumberOfEntries\", \"type\": \"string\", \"optional\": false, \"writable\": false, \"version\": \"2.0\"}");
+    for (int i = 0; i < opts.numProperties; ++i)
+      fprintf(f, ",\n      {\"name\": \"%s\", \"type\": \"string\", \"optional\": false, \"writable\": true, \"version\": \"2.0\"}",
+        bench_property_name(i).c_str());
+    fprintf(f, "\n    ]\n}\n");
+    fclose(f);
+
+    path = dir + "/" BENCH_LIST_OBJECT ".json";
+    f = fopen(path.c_str(), "w");
+    if (!f)
+      return false;
+
+    fprintf(f, "{\n  \"name\": \"%s\",\n  \"provider\": \"dmbench_list\",\n  \"is_list\": true,\n  \"properties\":\n    [\n", BENCH_LIST_OBJECT);
+    for (int i = 0; i < opts.numProperties; ++i)
+      fprintf(f, "%s      {\"name\": \"%s\", \"type\": \"string\", \"optional\": false, \"writable\": true, \"version\": \"2.0\"}",
+        i ? ",\n" : "", bench_property_name(i).c_str());
+    fprintf(f, "\n    ]\n}\n");
+    fclose(f);
+    return true;
+  }
+
+  void
+  bench_remove_model(std::string const& dir)
+  {
+    unlink((dir + "/" BENCH_OBJECT ".json").c_str());
+    unlink((dir + "/" BENCH_LIST_OBJECT ".json").c_str());
+    unlink(dmModelImage::cachePath(dir).c_str());
+    rmdir(dir.c_str());
+  }
+}
+
+class BenchProvider : public dmProvider
+{
+public:
+  BenchProvider(int numProperties, int listSize, int getDelay) : m_getDelay(getDelay)
+  {
+    for (int i = 0; i < numProperties; ++i)
+      m_values[bench_property_name(i)] = "value" + std::to_string(i + 1);
+
+    onGet("ItemNumberOfEntries", [listSize](dmPropertyInfo const& info, dmQueryResult& result) -> void {
+      result.addValue(info, listSize);
+    });
+  }
+
+protected:
+  virtual void doGet(dmPropertyInfo const& info, dmQueryResult& result)
+  {
+    if (m_getDelay > 0)
+      usleep(m_getDelay);
+    auto itr = m_values.find(info.name());
+    if (itr != m_values.end())
+      result.addValue(info, itr->second);
+  }
+
+  virtual void doSet(dmPropertyInfo const& info, dmValue const& value, dmQueryResult& result)
+  {
+    auto itr = m_values.find(info.name());
+    if (itr != m_values.end())
+    {
+      itr->second = value.toString();
+      result.addValue(info, value);
+    }
+  }
+
+private:
+  std::map<std::string, std::string> m_values;
+  int m_getDelay;
+};
+
+class BenchListProvider : public dmProvider
+{
+public:
+  BenchListProvider(int listSize, int getDelay) : m_listSize(listSize), m_getDelay(getDelay)
+  {
+  }
+
+protected:
+  virtual size_t getListSize()
+  {
+    return m_listSize;
+  }
+
+  virtual void doGet(dmPropertyInfo const& info, dmQueryResult& result)
+  {
+    if (m_getDelay > 0)
+      usleep(m_getDelay);
+    if (info.index() < m_listSize)
+    {
+      result.addValue(info, info.name() + "." + std::to_string(info.index() + 1));
+    }
+    else
+    {
+      result.setStatus(RT_ERROR_INVALID_ARG);
+      result.setStatusMsg("Index out of range");
+    }
+  }
+
+private:
+  uint32_t m_listSize;
+  int m_getDelay;
+};
+
+class BenchNotifier : public dmClientNotifier
+{
+public:
+  BenchNotifier() : values(0), errors(0) { }
+
+  virtual void onResult(const dmQueryResult& result)
+  {
+    values += result.values().size();
+  }
+
+  virtual void onError(int /*status*/, std::string const& /*message*/)
+  {
+    errors++;
+  }
+
+  uint32_t values;
+  uint32_t errors;
+};
+
+namespace
+{
+  void
+  bench_run_provider(std::string const& dir, benchOptions const& opts)
+  {
+    // fills the shared model database with the synthetic objects before the host
+    // loads the default directory
+    dmProviderDatabase db(dir);
+
+    dmProviderHost* host = dmProviderHost::create();
+    rtLog_SetLevel(RT_LOG_ERROR);
+    host->setWorkerThreads(opts.numWorkers);
+    host->start();
+
+    // sets change the object's values so its calls are serialized, the list is read only
+    host->registerProvider(BENCH_OBJECT, std::unique_ptr<dmProvider>(
+      new BenchProvider(opts.numProperties, opts.listSize, opts.getDelay)));
+    host->registerProvider(BENCH_LIST_OBJECT, std::unique_ptr<dmProvider>(
+      new BenchListProvider(opts.listSize, opts.getDelay)), true);
+
+    while (true)
+      pause();
+  }
+
+  std::string
+  bench_query_string(benchQueryType type, int client, int i, benchOptions const& opts)
+  {
+    std::stringstream s;
+    switch (type)
+    {
+      case benchQueryType_Get:
+        s << BENCH_OBJECT "." << bench_property_name(i % opts.numProperties);
+        break;
+      case benchQueryType_Set:
+        s << BENCH_OBJECT "." << bench_property_name(i % opts.numProperties) << "=" << client << "_" << i;
+        break;
+      case benchQueryType_Wildcard:
+        s << BENCH_OBJECT ".";
+        break;
+      default:
+        s << BENCH_LIST_OBJECT ".";
+        break;
+    }
+    return s.str();
+  }
+
+  // each client is its own process, dmClient isn't safe to share between threads
+  void
+  bench_run_client(std::string const& dir, benchOptions const& opts, int index, int in_fd, int out_fd)
+  {
+    uint8_t phase = 0;
+    dmClient* client = dmClient::create(dir, RT_LOG_FATAL);
+
+    // providers register asynchronously, wait until one answers
+    bool ready = false;
+    uint64_t deadline = bench_now() + 5000000000ull;
+    while (!ready && bench_now() < deadline)
+    {
+      BenchNotifier notifier;
+      client->runQuery(dmProviderOperation_Get, BENCH_OBJECT ".ItemNumberOfEntries", &notifier);
+      ready = notifier.values > 0;
+      if (!ready)
+        usleep(50000);
+    }
+
+    // every property by name in a single request
+    std::vector<std::string> batch;
+    for (int i = 0; i < opts.numProperties; ++i)
+      batch.push_back(BENCH_OBJECT "." + bench_property_name(i));
+
+    phase = ready ? 1 : 0;
+    bench_write_full(out_fd, &phase, 1);
+
+    while (bench_read_full(in_fd, &phase, 1) && phase != BENCH_STOP)
+    {
+      benchQueryType type = static_cast<benchQueryType>(phase);
+      dmProviderOperation op = (type == benchQueryType_Set) ? dmProviderOperation_Set : dmProviderOperation_Get;
+      std::vector<uint64_t> latencies;
+      benchPhaseResult res;
+      BenchNotifier notifier;
+
+      latencies.reserve(opts.numQueries);
+      for (int i = 0; i < opts.numQueries; ++i)
+      {
+        uint64_t start = bench_now();
+        bool ok = (type == benchQueryType_Batch)
+          ? client->runQuery(op, batch, &notifier)
+          : client->runQuery(op, bench_query_string(type, index, i, opts), &notifier);
+        if (!ok)
+          notifier.errors++;
+        latencies.push_back(bench_now() - start);
+      }
+
+      res.count = latencies.size();
+      res.errors = notifier.errors;
+      res.values = notifier.values;
+      if (!bench_write_full(out_fd, &res, sizeof(res)) ||
+          !bench_write_full(out_fd, latencies.data(), sizeof(uint64_t) * latencies.size()))
+        break;
+    }
+
+    dmClient::destroy(client);
+  }
+
+  struct benchClient
+  {
+    pid_t pid;
+    int in_fd;
+    int out_fd;
+  };
+
+  void
+  bench_print_header()
+  {
+    printf("%-10s %8s %8s %8s %10s %12s %10s %10s %10s %10s\n", "query", "clients", "queries", "errors",
+      "values", "queries/sec", "mean(us)", "p50(us)", "p99(us)", "p999(us)");
+  }
+
+  bool
+  bench_run_phase(benchQueryType type, std::vector<benchClient> const& clients)
+  {
+    uint8_t phase = static_cast<uint8_t>(type);
+    uint64_t queries = 0;
+    uint64_t errors = 0;
+    uint64_t values = 0;
+    rtHistogram latency;
+    std::vector<uint64_t> samples;
+
+    rtHistogram_Create(&latency);
+
+    uint64_t start = bench_now();
+    for (benchClient const& c : clients)
+      bench_write_full(c.out_fd, &phase, 1);
+
+    for (benchClient const& c : clients)
+    {
+      benchPhaseResult res;
+      if (!bench_read_full(c.in_fd, &res, sizeof(res)))
+      {
+        rtHistogram_Destroy(latency);
+        return false;
+      }
+
+      samples.resize(res.count);
+      if (!bench_read_full(c.in_fd, samples.data(), sizeof(uint64_t) * res.count))
+      {
+        rtHistogram_Destroy(latency);
+        return false;
+      }
+
+      for (uint64_t sample : samples)
+        rtHistogram_Record(latency, sample);
+      queries += res.count;
+      errors += res.errors;
+      values += res.values;
+    }
+    double elapsed = (bench_now() - start) / 1e9;
+
+    printf("%-10s %8zu %8llu %8llu %10llu %12.1f %10.1f %10.1f %10.1f %10.1f\n", bench_query_names[type],
+      clients.size(), (unsigned long long) queries, (unsigned long long) errors, (unsigned long long) values,
+      elapsed > 0 ? queries / elapsed : 0.0,
+      rtHistogram_GetMean(latency) / 1e3,
+      rtHistogram_GetValueAtPercentile(latency, 50.0) / 1e3,
+      rtHistogram_GetValueAtPercentile(latency, 99.0) / 1e3,
+      rtHistogram_GetValueAtPercentile(latency, 99.9) / 1e3);
+    fflush(stdout);
+
+    rtHistogram_Destroy(latency);
+    return true;
+  }
+
+  void
+  bench_usage()
+  {
+    printf("dmbench [OPTIONS]\n");
+    printf("\t-r, router     Path to rtrouted, default ./rtrouted\n");
+    printf("\t-x             Use the rtrouted already listening on %s\n", BENCH_ROUTER_ENDPOINT);
+    printf("\t-p, count      Properties on the synthetic object and list items, default 16\n");
+    printf("\t-l, count      Entries in the synthetic list, default 8\n");
+    printf("\t-c, count      Concurrent clients, default 4\n");
+    printf("\t-n, count      Queries per client for each query type, default 200\n");
+    printf("\t-w, count      Provider host worker threads, default 0\n");
+    printf("\t-d, usec       Time each provider getter sleeps, like a slow driver. Default 0\n");
+    printf("\t-q, types      Comma separated query types: get,set,wildcard,list,batch. Default all\n");
+    printf("\t-h             Help\n");
+  }
+}
+
+int main(int argc, char* argv[])
+{
+  int c;
+  bool use_existing = false;
+  bool run_type[benchQueryType_Count] = { true, true, true, true, true };
+  char const* router_path = "./rtrouted";
+  benchOptions opts;
+
+  opts.numProperties = 16;
+  opts.listSize = 8;
+  opts.numClients = 4;
+  opts.numQueries = 200;
+  opts.numWorkers = 0;
+  opts.getDelay = 0;
+
+  while ((c = getopt(argc, argv, "r:xp:l:c:n:w:d:q:h")) != -1)
+  {
+    switch (c)
+    {
+      case 'r':
+        router_path = optarg;
+        break;
+      case 'x':
+        use_existing = true;
+        break;
+      case 'p':
+        opts.numProperties = atoi(optarg);
+        break;
+      case 'l':
+        opts.listSize = atoi(optarg);
+        break;
+      case 'c':
+        opts.numClients = atoi(optarg);
+        break;
+      case 'n':
+        opts.numQueries = atoi(optarg);
+        break;
+      case 'w':
+        opts.numWorkers = atoi(optarg);
+        break;
+      case 'd':
+        opts.getDelay = atoi(optarg);
+        break;
+      case 'q':
+      {
+        std::string types(optarg);
+        for (int i = 0; i < benchQueryType_Count; ++i)
+          run_type[i] = types.find(bench_query_names[i]) != std::string::npos;
+        break;
+      }
+      case 'h':
+      default:
+        bench_usage();
+        return 0;
+    }
+  }
+
+  if (opts.numProperties < 1)
+    opts.numProperties = 1;
+  if (opts.listSize < 0)
+    opts.listSize = 0;
+  if (opts.numClients < 1)
+    opts.numClients = 1;
+
+  signal(SIGPIPE, SIG_IGN);
+  rtLog_SetLevel(RT_LOG_ERROR);
+
+  char dir_template[] = "/tmp/dmbench.XXXXXX";
+  if (!mkdtemp(dir_template))
+  {
+    fprintf(stderr, "failed to create model directory. %s\n", strerror(errno));
+    return 1;
+  }
+  std::string dir(dir_template);
+  if (!bench_write_model(dir, opts))
+  {
+    fprintf(stderr, "failed to write model to %s\n", dir.c_str());
+    bench_remove_model(dir);
+    return 1;
+  }
+
+  pid_t router = 0;
+  if (!use_existing)
+  {
+    char* endpoints[] = { const_cast<char *>(BENCH_ROUTER_ENDPOINT) };
+    router = bench_start_router(router_path, endpoints, 1, nullptr);
+    if (router == -1)
+    {
+      bench_remove_model(dir);
+      return 1;
+    }
+  }
+
+  pid_t provider = fork();
+  if (provider == 0)
+  {
+    bench_run_provider(dir, opts);
+    _exit(0);
+  }
+
+  std::vector<benchClient> clients;
+  for (int i = 0; i < opts.numClients; ++i)
+  {
+    int to_client[2];
+    int from_client[2];
+
+    if (pipe(to_client) == -1 || pipe(from_client) == -1)
+    {
+      fprintf(stderr, "pipe failed. %s\n", strerror(errno));
+      break;
+    }
+
+    pid_t pid = fork();
+    if (pid == 0)
+    {
+      close(to_client[1]);
+      close(from_client[0]);
+      bench_run_client(dir, opts, i, to_client[0], from_client[1]);
+      _exit(0);
+    }
+
+    close(to_client[0]);
+    close(from_client[1]);
+
+    benchClient client;
+    client.pid = pid;
+    client.in_fd = from_client[0];
+    client.out_fd = to_client[1];
+    clients.push_back(client);
+  }
+
+  bool ok = !clients.empty();
+  for (benchClient const& client : clients)
+  {
+    uint8_t ready = 0;
+    if (!bench_read_full(client.in_fd, &ready, 1) || !ready)
+      ok = false;
+  }
+
+  if (!ok)
+  {
+    fprintf(stderr, "clients failed to reach the provider\n");
+  }
+  else
+  {
+    printf("%d properties, %d list entries, %d provider workers\n", opts.numProperties, opts.listSize,
+      opts.numWorkers);
+    bench_print_header();
+    for (int i = 0; i < benchQueryType_Count && ok; ++i)
+    {
+      if (run_type[i])
+        ok = bench_run_phase(static_cast<benchQueryType>(i), clients);
+    }
+  }
+
+  for (benchClient const& client : clients)
+  {
+    int status;
+    uint8_t stop = BENCH_STOP;
+    bench_write_full(client.out_fd, &stop, 1);
+    close(client.out_fd);
+    close(client.in_fd);
+    waitpid(client.pid, &status, 0);
+  }
+
+  bench_stop_child(provider);
+  bench_stop_child(router);
+  bench_remove_model(dir);
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,313 @@
+/* Copyright [2017] [Comcast, Corp.]
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "rtTopic.h"
+
+#include <getopt.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define BENCH_MAX_NAME 128
+
+static volatile size_t bench_sink;
+
+typedef struct
+{
+  char     (*names)[BENCH_MAX_NAME];
+  uint32_t* lengths;
+  uint32_t* hashes;
+  size_t    count;
+} bench_corpus;
+
+static uint64_t
+bench_now()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ((uint64_t) ts.tv_sec * 1000000000ull) + (uint64_t) ts.tv_nsec;
+}
+
+static void
+bench_report(char const* name, size_t ops, uint64_t elapsed, size_t matches)
+{
+  printf("%-24s %12zu ops %12.2f ms %8.2f ns/op %10zu matches\n", name, ops, elapsed / 1e6,
+    ops ? ((double) elapsed / ops) : 0.0, matches);
+}
+
+// rtrouted's matcher before rtTopic, kept as the baseline
+static int
+bench_reference_match(char const* topic, uint32_t topic_length, char const* exp)
+{
+  char const* t = topic;
+  char const* end = topic + topic_length;
+  char const* e = exp;
+
+  while (t < end && *e)
+  {
+    if (*e == '*')
+    {
+      while (t < end && *t != '.')
+        t++;
+      e++;
+    }
+
+    if (*e == '>')
+    {
+      t = end;
+      e++;
+    }
+
+    if (!(t < end || *e))
+      break;
+
+    if (t == end || *t != *e)
+      break;
+
+    t++;
+    e++;
+  }
+
+  return !(t < end || *e);
+}
+
+static void
+bench_corpus_init(bench_corpus* c, size_t count)
+{
+  c->names = calloc(count, BENCH_MAX_NAME);
+  c->lengths = calloc(count, sizeof(uint32_t));
+  c->hashes = calloc(count, sizeof(uint32_t));
+  c->count = 0;
+}
+
+static void
+bench_corpus_add(bench_corpus* c, char const* name)
+{
+  snprintf(c->names[c->count], BENCH_MAX_NAME, "%s", name);
+  c->lengths[c->count] = (uint32_t) strlen(c->names[c->count]);
+  c->hashes[c->count] = rtTopic_Hash(c->names[c->count], c->lengths[c->count]);
+  c->count++;
+}
+
+static void
+bench_corpus_destroy(bench_corpus* c)
+{
+  free(c->names);
+  free(c->lengths);
+  free(c->hashes);
+}
+
+// Roughly what a busy router sees: every connection has an inbox, providers listen
+// on RDK.MODEL.<name>, a few clients watch events with wildcards.
+static void
+bench_make_expressions(bench_corpus* c, size_t num_clients)
+{
+  size_t i;
+  char buff[BENCH_MAX_NAME];
+
+  bench_corpus_add(c, "_RTROUTED.>");
+  for (i = 0; i < num_clients; ++i)
+  {
+    snprintf(buff, sizeof(buff), "_INBOX.app_%zu.%08x", i, (unsigned) (i * 2654435761u));
+    bench_corpus_add(c, buff);
+
+    switch (i % 4)
+    {
+      case 0:
+        snprintf(buff, sizeof(buff), "RDK.MODEL.provider_%zu", i);
+        break;
+      case 1:
+        snprintf(buff, sizeof(buff), "Device.WiFi.EndPoint.*.Status_%zu", i);
+        break;
+      case 2:
+        snprintf(buff, sizeof(buff), "Device.Events.group_%zu.>", i);
+        break;
+      default:
+        snprintf(buff, sizeof(buff), "Device.Events.group_%zu.*.Changed", i);
+        break;
+    }
+    bench_corpus_add(c, buff);
+  }
+}
+
+static void
+bench_make_topics(bench_corpus* c, size_t num_clients, size_t count)
+{
+  size_t i;
+  char buff[BENCH_MAX_NAME];
+
+  for (i = 0; i < count; ++i)
+  {
+    size_t k = (i * 7919) % num_clients;
+    switch (i % 5)
+    {
+      case 0:
+        snprintf(buff, sizeof(buff), "_INBOX.app_%zu.%08x", k, (unsigned) (k * 2654435761u));
+        break;
+      case 1:
+        snprintf(buff, sizeof(buff), "RDK.MODEL.provider_%zu", k);
+        break;
+      case 2:
+        snprintf(buff, sizeof(buff), "Device.WiFi.EndPoint.%zu.Status_%zu", i % 8, k);
+        break;
+      case 3:
+        snprintf(buff, sizeof(buff), "Device.Events.group_%zu.item_%zu.Changed", k, i % 16);
+        break;
+      default:
+        snprintf(buff, sizeof(buff), "_RTROUTED.INBOX.SUBSCRIBE");
+        break;
+    }
+    bench_corpus_add(c, buff);
+  }
+}
+
+// small alphabet so wildcards, empty segments and prefixes collide often
+static void
+bench_random_name(char* buff, int max, char const* alphabet)
+{
+  int i;
+  int n = rand() % max;
+  int k = (int) strlen(alphabet);
+
+  for (i = 0; i < n; ++i)
+    buff[i] = alphabet[rand() % k];
+  buff[n] = '\0';
+}
+
+static int
+bench_verify(size_t rounds)
+{
+  size_t i;
+  int failures;
+  char topic[16];
+  char expression[16];
+  rtTopicExpression compiled;
+
+  failures = 0;
+  srand(1);
+  for (i = 0; i < rounds; ++i)
+  {
+    uint32_t n;
+    int expected;
+
+    bench_random_name(topic, 8, "ab.");
+    bench_random_name(expression, 8, "ab.*>");
+    n = (uint32_t) strlen(topic);
+    expected = bench_reference_match(topic, n, expression);
+    rtTopicExpression_Compile(&compiled, expression);
+
+    if (!!rtTopic_IsMatch(topic, n, expression) != expected ||
+        !!rtTopicExpression_IsMatch(&compiled, topic, n, rtTopic_Hash(topic, n)) != expected)
+    {
+      if (failures++ < 10)
+        printf("mismatch: topic:'%s' expression:'%s' expected:%d\n", topic, expression, expected);
+    }
+  }
+  return failures;
+}
+
+int main(int argc, char* argv[])
+{
+  int c;
+  int r;
+  size_t i;
+  size_t j;
+  size_t matches;
+  size_t num_clients;
+  size_t num_topics;
+  int rounds;
+  uint64_t start;
+  bench_corpus expressions;
+  bench_corpus topics;
+  rtTopicExpression* compiled;
+
+  num_clients = 256;
+  num_topics = 1000;
+  rounds = 10;
+
+  while ((c = getopt(argc, argv, "c:t:r:h")) != -1)
+  {
+    switch (c)
+    {
+      case 'c':
+        num_clients = strtoul(optarg, NULL, 10);
+        break;
+      case 't':
+        num_topics = strtoul(optarg, NULL, 10);
+        break;
+      case 'r':
+        rounds = atoi(optarg);
+        break;
+      case 'h':
+      default:
+        printf("rtTopic_bench [-c clients] [-t topics] [-r rounds]\n");
+        return 0;
+    }
+  }
+
+  if (num_clients == 0)
+    num_clients = 1;
+
+  if (bench_verify(1000000) != 0)
+  {
+    printf("matchers disagree\n");
+    return 1;
+  }
+
+  bench_corpus_init(&expressions, 1 + num_clients * 2);
+  bench_corpus_init(&topics, num_topics);
+  bench_make_expressions(&expressions, num_clients);
+  bench_make_topics(&topics, num_clients, num_topics);
+
+  compiled = (rtTopicExpression *) calloc(expressions.count, sizeof(rtTopicExpression));
+  for (i = 0; i < expressions.count; ++i)
+    rtTopicExpression_Compile(&compiled[i], expressions.names[i]);
+
+  printf("%zu expressions, %zu topics\n", expressions.count, topics.count);
+
+  // every topic against every expression, the way a route set is rebuilt
+  matches = 0;
+  start = bench_now();
+  for (r = 0; r < rounds; ++r)
+    for (i = 0; i < topics.count; ++i)
+      for (j = 0; j < expressions.count; ++j)
+        matches += bench_reference_match(topics.names[i], topics.lengths[i], expressions.names[j]);
+  bench_report("reference", rounds * topics.count * expressions.count, bench_now() - start, matches / rounds);
+  bench_sink = matches;
+
+  matches = 0;
+  start = bench_now();
+  for (r = 0; r < rounds; ++r)
+    for (i = 0; i < topics.count; ++i)
+      for (j = 0; j < expressions.count; ++j)
+        matches += rtTopic_IsMatch(topics.names[i], topics.lengths[i], expressions.names[j]);
+  bench_report("rtTopic_IsMatch", rounds * topics.count * expressions.count, bench_now() - start, matches / rounds);
+  bench_sink = matches;
+
+  matches = 0;
+  start = bench_now();
+  for (r = 0; r < rounds; ++r)
+    for (i = 0; i < topics.count; ++i)
+      for (j = 0; j < expressions.count; ++j)
+        matches += rtTopicExpression_IsMatch(&compiled[j], topics.names[i], topics.lengths[i], topics.hashes[i]);
+  bench_report("rtTopicExpression", rounds * topics.count * expressions.count, bench_now() - start, matches / rounds);
+  bench_sink = matches;
+
+  free(compiled);
+  bench_corpus_destroy(&topics);
+  bench_corpus_destroy(&expressions);
+  return 0;
+}
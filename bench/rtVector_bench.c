@@ -0,0 +1,173 @@
+/* Copyright [2017] [Comcast, Corp.]
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "rtVector.h"
+
+#include <getopt.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+static volatile uintptr_t bench_sink;
+
+static uint64_t
+bench_now()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ((uint64_t) ts.tv_sec * 1000000000ull) + (uint64_t) ts.tv_nsec;
+}
+
+static void
+bench_report(char const* name, size_t ops, uint64_t elapsed)
+{
+  printf("%-24s %10zu ops %12.2f ms %10.2f ns/op\n", name, ops, elapsed / 1e6,
+    ops ? ((double) elapsed / ops) : 0.0);
+}
+
+static void
+bench_fill(rtVector v, uintptr_t* items, size_t n)
+{
+  size_t i;
+  for (i = 0; i < n; ++i)
+    rtVector_PushBack(v, &items[i]);
+}
+
+static void
+bench_push_back(uintptr_t* items, size_t n, int reserve)
+{
+  uint64_t start;
+  rtVector v;
+
+  rtVector_Create(&v);
+  start = bench_now();
+  if (reserve)
+    rtVector_Reserve(v, n);
+  bench_fill(v, items, n);
+  bench_report(reserve ? "push_back (reserved)" : "push_back", n, bench_now() - start);
+  rtVector_Destroy(v, NULL);
+}
+
+// removes every item, oldest first, the way rtrouted drops a client's routes
+static void
+bench_remove_item(uintptr_t* items, size_t n, int swap)
+{
+  size_t i;
+  uint64_t start;
+  rtVector v;
+
+  rtVector_Create(&v);
+  bench_fill(v, items, n);
+  start = bench_now();
+  for (i = 0; i < n; ++i)
+  {
+    if (swap)
+      rtVector_SwapRemoveItem(v, &items[i], NULL);
+    else
+      rtVector_RemoveItem(v, &items[i], NULL);
+  }
+  bench_report(swap ? "swap_remove_item" : "remove_item", n, bench_now() - start);
+  rtVector_Destroy(v, NULL);
+}
+
+static void
+bench_remove_at(uintptr_t* items, size_t n, int swap)
+{
+  size_t i;
+  uint64_t start;
+  rtVector v;
+
+  rtVector_Create(&v);
+  bench_fill(v, items, n);
+  start = bench_now();
+  for (i = 0; i < n; ++i)
+  {
+    if (swap)
+      rtVector_SwapRemoveAt(v, 0, NULL);
+    else
+      rtVector_RemoveAt(v, 0, NULL);
+  }
+  bench_report(swap ? "swap_remove_at(0)" : "remove_at(0)", n, bench_now() - start);
+  rtVector_Destroy(v, NULL);
+}
+
+static void
+bench_iterate(uintptr_t* items, size_t n, int rounds)
+{
+  int r;
+  size_t i;
+  uintptr_t sum;
+  uint64_t start;
+  rtVector v;
+
+  sum = 0;
+  rtVector_Create(&v);
+  bench_fill(v, items, n);
+  start = bench_now();
+  for (r = 0; r < rounds; ++r)
+  {
+    for (i = 0; i < rtVector_Size(v); ++i)
+      sum += *((uintptr_t *) rtVector_At(v, i));
+  }
+  bench_report("iterate", n * rounds, bench_now() - start);
+  rtVector_Destroy(v, NULL);
+  bench_sink = sum;
+}
+
+int main(int argc, char* argv[])
+{
+  int c;
+  size_t i;
+  size_t n;
+  size_t n_remove;
+  uintptr_t* items;
+
+  n = 1000000;
+  n_remove = 20000;
+
+  while ((c = getopt(argc, argv, "n:r:h")) != -1)
+  {
+    switch (c)
+    {
+      case 'n':
+        n = strtoul(optarg, NULL, 10);
+        break;
+      case 'r':
+        n_remove = strtoul(optarg, NULL, 10);
+        break;
+      case 'h':
+      default:
+        printf("rtVector_bench [-n push_count] [-r remove_count]\n");
+        return 0;
+    }
+  }
+
+  items = (uintptr_t *) malloc(sizeof(uintptr_t) * (n > n_remove ? n : n_remove));
+  for (i = 0; i < (n > n_remove ? n : n_remove); ++i)
+    items[i] = i;
+
+  bench_push_back(items, n, 0);
+  bench_push_back(items, n, 1);
+  bench_iterate(items, n, 10);
+
+  // removals are quadratic for the order preserving variants, keep n small
+  bench_remove_item(items, n_remove, 0);
+  bench_remove_item(items, n_remove, 1);
+  bench_remove_at(items, n_remove, 0);
+  bench_remove_at(items, n_remove, 1);
+
+  free(items);
+  return 0;
+}
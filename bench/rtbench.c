@@ -0,0 +1,537 @@
+/* Copyright [2017] [Comcast, Corp.]
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "benchRouter.h"
+#include "rtConnection.h"
+#include "rtHistogram.h"
+#include "rtLog.h"
+
+#include <getopt.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define BENCH_MAX_ENDPOINTS 8
+#define BENCH_MAX_SWEEP 16
+#define BENCH_TOPIC_FORMAT "rtbench.topic.%d"
+#define BENCH_DONE_TOPIC "rtbench.done"
+
+// rtConnection has 64 listener slots, one is the inbox and one is BENCH_DONE_TOPIC
+#define BENCH_MAX_TOPICS 62
+
+// every payload starts with the publisher's send time, CLOCK_MONOTONIC is the same
+// clock in every process so the subscriber can work out the latency
+typedef struct
+{
+  uint64_t send_time;
+  uint32_t sequence;
+} bench_stamp;
+
+typedef struct
+{
+  char const*     endpoint;
+  uint32_t        payload_size;
+  int             num_subscribers;
+  int             num_topics;
+  int             num_publishers;
+  int             num_messages;
+  int             idle_timeout;
+  int             settle_time;
+  uint64_t        start_time;
+  pthread_mutex_t mutex;
+  pthread_cond_t  cond;
+  int             num_ready;
+  int             go;
+} bench_case;
+
+typedef struct
+{
+  bench_case*     bcase;
+  int             index;
+  pthread_t       thread;
+  rtHistogram     latency;
+  uint64_t        received;
+  uint64_t        last_receive;
+  uint64_t        sent;
+  int             failed;
+  int             done;
+  int             finished;
+} bench_client;
+
+static uint64_t
+bench_now()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ((uint64_t) ts.tv_sec * 1000000000ull) + (uint64_t) ts.tv_nsec;
+}
+
+static int
+bench_parse_list(char* s, int* values, int max)
+{
+  int n = 0;
+  char* save = NULL;
+  char* tok = strtok_r(s, ",", &save);
+
+  while (tok && n < max)
+  {
+    values[n++] = (int) strtol(tok, NULL, 10);
+    tok = strtok_r(NULL, ",", &save);
+  }
+  return n;
+}
+
+static void
+bench_ready(bench_case* bcase)
+{
+  pthread_mutex_lock(&bcase->mutex);
+  bcase->num_ready++;
+  pthread_cond_broadcast(&bcase->cond);
+  pthread_mutex_unlock(&bcase->mutex);
+}
+
+static void
+bench_wait_for_go(bench_case* bcase)
+{
+  pthread_mutex_lock(&bcase->mutex);
+  while (!bcase->go)
+    pthread_cond_wait(&bcase->cond, &bcase->mutex);
+  pthread_mutex_unlock(&bcase->mutex);
+}
+
+static void
+bench_on_message(rtMessageHeader const* hdr, uint8_t const* buff, uint32_t n, void* closure)
+{
+  bench_stamp stamp;
+  bench_client* client = (bench_client *) closure;
+  uint64_t now = bench_now();
+
+  (void) hdr;
+  if (n < sizeof(bench_stamp))
+    return;
+
+  memcpy(&stamp, buff, sizeof(bench_stamp));
+  rtHistogram_Record(client->latency, now - stamp.send_time);
+  __atomic_store_n(&client->received, client->received + 1, __ATOMIC_RELAXED);
+  client->last_receive = now;
+}
+
+static void
+bench_on_done(rtMessageHeader const* hdr, uint8_t const* buff, uint32_t n, void* closure)
+{
+  bench_client* client = (bench_client *) closure;
+
+  (void) hdr;
+  (void) buff;
+  (void) n;
+  client->done = 1;
+}
+
+static void*
+bench_subscriber(void* argp)
+{
+  int i;
+  uint64_t expected;
+  rtError err;
+  rtConnection con;
+  bench_client* client = (bench_client *) argp;
+  bench_case* bcase = client->bcase;
+
+  err = rtConnection_Create(&con, "rtbench_sub", bcase->endpoint);
+  if (err != RT_OK)
+  {
+    client->failed = 1;
+    __atomic_store_n(&client->finished, 1, __ATOMIC_RELEASE);
+    bench_ready(bcase);
+    return NULL;
+  }
+
+  err = rtConnection_AddListener(con, BENCH_DONE_TOPIC, bench_on_done, client);
+  for (i = 0; i < bcase->num_topics && err == RT_OK; ++i)
+  {
+    char topic[64];
+    snprintf(topic, sizeof(topic), BENCH_TOPIC_FORMAT, i);
+    err = rtConnection_AddListener(con, topic, bench_on_message, client);
+  }
+  if (err != RT_OK)
+    client->failed = 1;
+  bench_ready(bcase);
+
+  // the router may drop messages for slow subscribers, so rather than wait for every
+  // last one this also stops when told to on BENCH_DONE_TOPIC
+  expected = (uint64_t) bcase->num_messages * bcase->num_publishers;
+  while (err == RT_OK && client->received < expected && !client->done)
+    err = rtConnection_Dispatch(con);
+
+  rtConnection_Destroy(con);
+  __atomic_store_n(&client->finished, 1, __ATOMIC_RELEASE);
+  return NULL;
+}
+
+static void*
+bench_publisher(void* argp)
+{
+  int i;
+  rtError err;
+  uint8_t* payload;
+  char (*topics)[64];
+  bench_stamp stamp;
+  rtConnection con;
+  bench_client* client = (bench_client *) argp;
+  bench_case* bcase = client->bcase;
+
+  payload = (uint8_t *) calloc(1, bcase->payload_size);
+  topics = malloc(sizeof(*topics) * bcase->num_topics);
+  for (i = 0; i < bcase->num_topics; ++i)
+    snprintf(topics[i], sizeof(topics[i]), BENCH_TOPIC_FORMAT, i);
+
+  err = rtConnection_Create(&con, "rtbench_pub", bcase->endpoint);
+  if (err != RT_OK)
+    client->failed = 1;
+  bench_ready(bcase);
+
+  if (err == RT_OK)
+  {
+    bench_wait_for_go(bcase);
+    for (i = 0; i < bcase->num_messages; ++i)
+    {
+      stamp.send_time = bench_now();
+      stamp.sequence = (uint32_t) i;
+      memcpy(payload, &stamp, sizeof(stamp));
+      if (rtConnection_SendBinary(con, topics[i % bcase->num_topics], payload, bcase->payload_size) != RT_OK)
+        break;
+      client->sent++;
+    }
+    rtConnection_Destroy(con);
+  }
+
+  free(topics);
+  free(payload);
+  return NULL;
+}
+
+// once the publishers are finished, waits for subscribers to see everything. If
+// nothing new arrives for idle_timeout ms the rest was dropped, tell them to stop.
+static void
+bench_wait_for_subscribers(bench_case* bcase, bench_client* clients)
+{
+  int i;
+  int finished;
+  uint64_t total;
+  uint64_t last_total;
+  uint64_t last_progress;
+  rtConnection con;
+
+  con = NULL;
+  last_total = 0;
+  last_progress = bench_now();
+
+  for (;;)
+  {
+    finished = 1;
+    total = 0;
+    for (i = 0; i < bcase->num_subscribers; ++i)
+    {
+      finished &= __atomic_load_n(&clients[i].finished, __ATOMIC_ACQUIRE);
+      total += __atomic_load_n(&clients[i].received, __ATOMIC_RELAXED);
+    }
+    if (finished)
+      break;
+
+    if (total != last_total)
+    {
+      last_total = total;
+      last_progress = bench_now();
+    }
+    else if (bench_now() - last_progress > (uint64_t) bcase->idle_timeout * 1000000)
+    {
+      uint8_t done = 0;
+      if (!con && rtConnection_Create(&con, "rtbench_ctl", bcase->endpoint) != RT_OK)
+        con = NULL;
+      if (con)
+        rtConnection_SendBinary(con, BENCH_DONE_TOPIC, &done, sizeof(done));
+      last_progress = bench_now();
+    }
+    usleep(10000);
+  }
+
+  if (con)
+    rtConnection_Destroy(con);
+}
+
+static void
+bench_print_header()
+{
+  printf("%-28s %8s %6s %6s %10s %10s %12s %10s %9s %9s %9s\n", "endpoint", "size", "subs",
+    "topics", "sent", "received", "msgs/sec", "MB/sec", "p50(us)", "p99(us)", "p999(us)");
+}
+
+// returns whether every subscriber got every message
+static int
+bench_run(bench_case* bcase)
+{
+  int i;
+  int num_clients;
+  int failed;
+  uint64_t sent;
+  uint64_t received;
+  uint64_t last_receive;
+  double elapsed;
+  rtHistogram latency;
+  bench_client* clients;
+
+  num_clients = bcase->num_subscribers + bcase->num_publishers;
+  clients = (bench_client *) calloc(num_clients, sizeof(bench_client));
+  pthread_mutex_init(&bcase->mutex, NULL);
+  pthread_cond_init(&bcase->cond, NULL);
+  bcase->num_ready = 0;
+  bcase->go = 0;
+
+  // subscribers have to be registered with the router before anything is sent
+  for (i = 0; i < bcase->num_subscribers; ++i)
+  {
+    clients[i].bcase = bcase;
+    clients[i].index = i;
+    rtHistogram_Create(&clients[i].latency);
+    pthread_create(&clients[i].thread, NULL, bench_subscriber, &clients[i]);
+  }
+
+  pthread_mutex_lock(&bcase->mutex);
+  while (bcase->num_ready < bcase->num_subscribers)
+    pthread_cond_wait(&bcase->cond, &bcase->mutex);
+  pthread_mutex_unlock(&bcase->mutex);
+
+  for (i = bcase->num_subscribers; i < num_clients; ++i)
+  {
+    clients[i].bcase = bcase;
+    clients[i].index = i;
+    pthread_create(&clients[i].thread, NULL, bench_publisher, &clients[i]);
+  }
+
+  pthread_mutex_lock(&bcase->mutex);
+  while (bcase->num_ready < num_clients)
+    pthread_cond_wait(&bcase->cond, &bcase->mutex);
+  pthread_mutex_unlock(&bcase->mutex);
+
+  // listeners are added asynchronously, give the router a moment to install the routes
+  usleep(bcase->settle_time * 1000);
+
+  pthread_mutex_lock(&bcase->mutex);
+  bcase->start_time = bench_now();
+  __atomic_store_n(&bcase->go, 1, __ATOMIC_RELEASE);
+  pthread_cond_broadcast(&bcase->cond);
+  pthread_mutex_unlock(&bcase->mutex);
+
+  for (i = bcase->num_subscribers; i < num_clients; ++i)
+    pthread_join(clients[i].thread, NULL);
+  bench_wait_for_subscribers(bcase, clients);
+  for (i = 0; i < bcase->num_subscribers; ++i)
+    pthread_join(clients[i].thread, NULL);
+
+  failed = 0;
+  sent = 0;
+  received = 0;
+  last_receive = bcase->start_time;
+  rtHistogram_Create(&latency);
+  for (i = 0; i < num_clients; ++i)
+  {
+    failed |= clients[i].failed;
+    sent += clients[i].sent;
+    received += clients[i].received;
+    if (clients[i].last_receive > last_receive)
+      last_receive = clients[i].last_receive;
+    if (clients[i].latency)
+    {
+      rtHistogram_Merge(latency, clients[i].latency);
+      rtHistogram_Destroy(clients[i].latency);
+    }
+  }
+
+  elapsed = (last_receive - bcase->start_time) / 1e9;
+  if (failed)
+    printf("%-28s %8u %6d %6d failed to connect or subscribe\n", bcase->endpoint, bcase->payload_size,
+      bcase->num_subscribers, bcase->num_topics);
+  else
+    printf("%-28s %8u %6d %6d %10llu %10llu %12.0f %10.2f %9.1f %9.1f %9.1f\n", bcase->endpoint,
+      bcase->payload_size, bcase->num_subscribers, bcase->num_topics, (unsigned long long) sent,
+      (unsigned long long) received, elapsed > 0 ? received / elapsed : 0.0,
+      elapsed > 0 ? (received * (double) bcase->payload_size) / (elapsed * 1024 * 1024) : 0.0,
+      rtHistogram_GetValueAtPercentile(latency, 50.0) / 1e3,
+      rtHistogram_GetValueAtPercentile(latency, 99.0) / 1e3,
+      rtHistogram_GetValueAtPercentile(latency, 99.9) / 1e3);
+  fflush(stdout);
+
+  rtHistogram_Destroy(latency);
+  pthread_cond_destroy(&bcase->cond);
+  pthread_mutex_destroy(&bcase->mutex);
+  free(clients);
+  return !failed && received == (uint64_t) bcase->num_messages * bcase->num_publishers * bcase->num_subscribers;
+}
+
+static void
+bench_usage()
+{
+  printf("rtbench [OPTIONS]\n");
+  printf("\t-r, router     Path to rtrouted, default ./rtrouted\n");
+  printf("\t-a, args       Extra rtrouted arguments, e.g. \"-t 4\"\n");
+  printf("\t-x             Use an already running router instead of starting one\n");
+  printf("\t-e, endpoint   Endpoint to benchmark, may be repeated. Default tcp and unix\n");
+  printf("\t-s, sizes      Comma separated payload sizes, default 64,1024,16384\n");
+  printf("\t-f, fanout     Comma separated subscriber counts, default 1,4\n");
+  printf("\t-T, topics     Comma separated topic counts, at most %d, default 1,32\n", BENCH_MAX_TOPICS);
+  printf("\t-p, count      Publishers, default 1\n");
+  printf("\t-n, count      Messages per publisher, default 20000\n");
+  printf("\t-c             Exit with status 1 unless every message reached every subscriber\n");
+  printf("\t-h             Help\n");
+}
+
+int main(int argc, char* argv[])
+{
+  int c;
+  int i;
+  int j;
+  int k;
+  int e;
+  int use_existing;
+  int check;
+  int complete;
+  int num_endpoints;
+  int num_sizes;
+  int num_fanouts;
+  int num_topic_counts;
+  int sizes[BENCH_MAX_SWEEP];
+  int fanouts[BENCH_MAX_SWEEP];
+  int topic_counts[BENCH_MAX_SWEEP];
+  char* endpoints[BENCH_MAX_ENDPOINTS];
+  char const* router_path;
+  char const* router_args;
+  char default_sizes[] = "64,1024,16384";
+  char default_fanouts[] = "1,4";
+  char default_topics[] = "1,32";
+  pid_t router;
+  bench_case bcase;
+
+  memset(&bcase, 0, sizeof(bcase));
+  bcase.num_publishers = 1;
+  bcase.num_messages = 20000;
+  bcase.idle_timeout = 1000;
+  bcase.settle_time = 100;
+
+  use_existing = 0;
+  check = 0;
+  complete = 1;
+  num_endpoints = 0;
+  router_path = "./rtrouted";
+  router_args = NULL;
+  num_sizes = 0;
+  num_fanouts = 0;
+  num_topic_counts = 0;
+
+  while ((c = getopt(argc, argv, "r:a:xe:s:f:T:p:n:ch")) != -1)
+  {
+    switch (c)
+    {
+      case 'r':
+        router_path = optarg;
+        break;
+      case 'a':
+        router_args = optarg;
+        break;
+      case 'x':
+        use_existing = 1;
+        break;
+      case 'e':
+        if (num_endpoints < BENCH_MAX_ENDPOINTS)
+          endpoints[num_endpoints++] = optarg;
+        break;
+      case 's':
+        num_sizes = bench_parse_list(optarg, sizes, BENCH_MAX_SWEEP);
+        break;
+      case 'f':
+        num_fanouts = bench_parse_list(optarg, fanouts, BENCH_MAX_SWEEP);
+        break;
+      case 'T':
+        num_topic_counts = bench_parse_list(optarg, topic_counts, BENCH_MAX_SWEEP);
+        break;
+      case 'p':
+        bcase.num_publishers = (int) strtol(optarg, NULL, 10);
+        break;
+      case 'n':
+        bcase.num_messages = (int) strtol(optarg, NULL, 10);
+        break;
+      case 'c':
+        check = 1;
+        break;
+      case 'h':
+      default:
+        bench_usage();
+        return 0;
+    }
+  }
+
+  if (num_endpoints == 0)
+  {
+    endpoints[num_endpoints++] = (char *) "tcp://127.0.0.1:10101";
+    endpoints[num_endpoints++] = (char *) "unix:///tmp/rtbench.sock";
+  }
+  if (num_sizes == 0)
+    num_sizes = bench_parse_list(default_sizes, sizes, BENCH_MAX_SWEEP);
+  if (num_fanouts == 0)
+    num_fanouts = bench_parse_list(default_fanouts, fanouts, BENCH_MAX_SWEEP);
+  if (num_topic_counts == 0)
+    num_topic_counts = bench_parse_list(default_topics, topic_counts, BENCH_MAX_SWEEP);
+  if (bcase.num_publishers < 1)
+    bcase.num_publishers = 1;
+
+  rtLog_SetLevel(RT_LOG_ERROR);
+  signal(SIGPIPE, SIG_IGN);
+
+  router = 0;
+  if (!use_existing)
+  {
+    router = bench_start_router(router_path, endpoints, num_endpoints, router_args);
+    if (router == -1)
+      return 1;
+  }
+
+  bench_print_header();
+  for (e = 0; e < num_endpoints; ++e)
+  {
+    bcase.endpoint = endpoints[e];
+    for (i = 0; i < num_sizes; ++i)
+    {
+      // room for the send stamp
+      bcase.payload_size = sizes[i] < (int) sizeof(bench_stamp) ? sizeof(bench_stamp) : (uint32_t) sizes[i];
+      for (j = 0; j < num_fanouts; ++j)
+      {
+        bcase.num_subscribers = fanouts[j] < 1 ? 1 : fanouts[j];
+        for (k = 0; k < num_topic_counts; ++k)
+        {
+          bcase.num_topics = topic_counts[k] < 1 ? 1 : topic_counts[k];
+          if (bcase.num_topics > BENCH_MAX_TOPICS)
+            bcase.num_topics = BENCH_MAX_TOPICS;
+          complete &= bench_run(&bcase);
+        }
+      }
+    }
+  }
+
+  bench_stop_child(router);
+  return (check && !complete) ? 1 : 0;
+}
@@ -2,6 +2,8 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <sstream>
+#include <algorithm>
+#include <memory>
 #include <rtError.h>
 #include "dmProviderDatabase.h"
 #include "dmQuery.h"
@@ -38,6 +40,10 @@ public:
   {
     if(isListWithWildcard(parameter))
     {
+      // the provider expands the whole list, one request instead of one per entry
+      if (operation == dmProviderOperation_Get)
+        return runListQuery(operation, parameter, notifier);
+
       std::string list_name = dmUtility::trimWildcard(parameter);
       std::string parent_name = dmUtility::trimProperty(list_name);
       rtLog_Debug("dmcli_get list=%s parent=%s", list_name.c_str(), parent_name.c_str());
@@ -71,12 +77,109 @@ public:
     }
   }
 
+  bool runQuery(dmProviderOperation operation, std::vector<std::string> const& parameters, dmClientNotifier* notifier)
+  {
+    // parameters from the same provider go out as one request. list wildcards still
+    // expand into a query per item. batches run in the order their first parameter
+    // was given.
+    struct Batch
+    {
+      std::shared_ptr<dmProviderInfo> provider;
+      std::vector<std::string> parameters;
+    };
+    std::vector<Batch> batches;
+
+    for (std::string const& parameter : parameters)
+    {
+      std::shared_ptr<dmProviderInfo> provider;
+      if (!isListWithWildcard(parameter))
+        provider = m_db->getProviderByQueryString(parameter);
+
+      auto itr = std::find_if(batches.begin(), batches.end(), [&provider](Batch const& b)
+      {
+        return provider && b.provider == provider;
+      });
+
+      if (itr != batches.end())
+      {
+        itr->parameters.push_back(parameter);
+      }
+      else
+      {
+        Batch b;
+        b.provider = provider;
+        b.parameters.push_back(parameter);
+        batches.push_back(b);
+      }
+    }
+
+    bool success = true;
+    for (Batch const& b : batches)
+    {
+      bool status = b.provider
+        ? runBatchQuery(operation, b.parameters, notifier)
+        : runQuery(operation, b.parameters.front(), notifier);
+      if (!status)
+        success = false;
+    }
+    return success;
+  }
+
 private:
 
+  bool runBatchQuery(dmProviderOperation op, std::vector<std::string> const& parameters, dmClientNotifier* notifier)
+  {
+    std::unique_ptr<dmQuery> query(m_db->createQuery(op, parameters));
+    return execQuery(query.get(), notifier);
+  }
+
+  // splits the expanded list back into one result per entry for the notifier
+  bool runListQuery(dmProviderOperation op, std::string const& parameter, dmClientNotifier* notifier)
+  {
+    std::unique_ptr<dmQuery> query(m_db->createQuery(op, parameter.c_str()));
+    if (!execQuery(query.get(), nullptr))
+    {
+      if (notifier)
+        notifier->onError(RT_FAIL, "dmcli_get list query failed");
+      return false;
+    }
+
+    if (!notifier)
+      return true;
+
+    std::vector<dmQueryResult::Param> const& values = query->results().values();
+    for (size_t i = 0; i < values.size();)
+    {
+      dmQueryResult entry;
+      uint32_t index = values[i].Info.index();
+      for (; i < values.size() && values[i].Info.index() == index; ++i)
+        entry.addValue(values[i].Info, values[i].Value, values[i].StatusCode,
+          values[i].StatusMessage.empty() ? nullptr : values[i].StatusMessage.c_str());
+      entry.setIndex(static_cast<int>(index) + 1);
+      entry.updateFullNames();
+      notifier->onResult(entry);
+    }
+    return true;
+  }
+
   bool runOneQuery(dmProviderOperation op, std::string const& parameter, dmClientNotifier* notifier, int* numEntries = nullptr)
   {
     std::unique_ptr<dmQuery> query(m_db->createQuery(op, parameter.c_str()));
 
+    if (!execQuery(query.get(), notifier))
+      return false;
+
+    if(numEntries)
+    {
+      dmValue value(0);
+      getResultValue(query->results().values(), parameter, value);
+      *numEntries = static_cast<int>(value.toInt64());
+    }
+    return true;
+  }
+
+  bool execQuery(dmQuery* query, dmClientNotifier* notifier)
+  {
     if (!query)
     {
       std::string msg = "failed to create query";
@@ -101,12 +204,6 @@ private:
     {
       if(notifier)
         notifier->onResult(results);
-      if(numEntries)
-      {
-        dmValue value(0);
-        getResultValue(results.values(), parameter, value);
-        *numEntries = atoi(value.toString().c_str());//todo fix type not coming across wire
-      }
       return true;
     }
     else
@@ -19,6 +19,9 @@
 #include "dmProviderOperation.h"
 #include "rtLog.h"
 
+#include <string>
+#include <vector>
+
 class dmClientNotifier
 {
 public:
@@ -32,6 +35,10 @@ public:
   virtual ~dmClient() { }
   virtual bool runQuery(dmProviderOperation operation, std::string const& parameter, dmClientNotifier* notifier) = 0;
 
+  // parameters that belong to the same provider are sent as a single request, with one
+  // onResult or onError for the whole batch
+  virtual bool runQuery(dmProviderOperation operation, std::vector<std::string> const& parameters, dmClientNotifier* notifier) = 0;
+
   static dmClient* create(std::string const& datamodelDir, rtLogLevel logLevel = RT_LOG_WARN);
   static void destroy(dmClient* client);
 private:
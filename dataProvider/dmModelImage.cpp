@@ -0,0 +1,657 @@
+/* Copyright [2017] [Comcast, Corp.]
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "dmModelImage.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <dirent.h>
+#include <fcntl.h>
+#include <map>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <rtLog.h>
+
+// layout:
+//   Header
+//   Object[objectCount]     sorted by name
+//   Property[propertyCount]
+//   Node[nodeCount]         segment trie of object names, node 0 is the root and
+//                           every node's children are contiguous and sorted
+//   uint32_t[providerSlots] open addressed provider name index, object + 1, 0 is empty
+//   char[stringsLength]     NUL terminated strings referenced by offset
+// The image is a local cache, so everything is in host byte order.
+#define DM_MODEL_IMAGE_MAGIC 0x494d4d44 // "DMMI"
+#define DM_MODEL_IMAGE_VERSION 2
+
+struct dmModelImage::Header
+{
+  uint32_t magic;
+  uint32_t version;
+  uint64_t fingerprint;
+  uint32_t objectCount;
+  uint32_t propertyCount;
+  uint32_t nodeCount;
+  uint32_t providerSlots;
+  uint32_t stringsLength;
+  uint32_t reserved;
+};
+
+struct dmModelImage::Object
+{
+  uint32_t name;
+  uint32_t provider;
+  uint32_t firstProperty;
+  uint32_t propertyCount;
+  uint32_t isList;
+};
+
+struct dmModelImage::Property
+{
+  uint32_t name;
+  uint32_t fullName;
+  uint32_t type;
+  uint32_t flags;
+};
+
+struct dmModelImage::Node
+{
+  uint32_t segment;
+  uint32_t segmentLength;
+  uint32_t firstChild;
+  uint32_t childCount;
+  int32_t  object;
+};
+
+namespace
+{
+  enum
+  {
+    kPropertyOptional = 0x01,
+    kPropertyWritable = 0x02
+  };
+
+  uint64_t
+  fnv1a(uint64_t h, void const* p, size_t n)
+  {
+    uint8_t const* b = static_cast<uint8_t const *>(p);
+    for (size_t i = 0; i < n; ++i)
+    {
+      h ^= b[i];
+      h *= 1099511628211ull;
+    }
+    return h;
+  }
+
+  const uint64_t kFnvOffset = 14695981039346656037ull;
+
+  uint32_t
+  providerHash(char const* s)
+  {
+    return static_cast<uint32_t>(fnv1a(kFnvOffset, s, strlen(s)));
+  }
+
+  class stringTable
+  {
+  public:
+    uint32_t add(std::string const& s)
+    {
+      uint32_t offset = static_cast<uint32_t>(m_buff.size());
+      m_buff.insert(m_buff.end(), s.begin(), s.end());
+      m_buff.push_back('\0');
+      return offset;
+    }
+
+    std::vector<char> const& buff() const
+      { return m_buff; }
+
+  private:
+    std::vector<char> m_buff;
+  };
+
+  struct trieBuilder
+  {
+    trieBuilder() : object(-1) { }
+
+    int32_t object;
+    std::map< std::string, std::unique_ptr<trieBuilder> > children;
+  };
+
+  int
+  compareSegment(char const* a, uint32_t alen, char const* b, uint32_t blen)
+  {
+    int n = memcmp(a, b, std::min(alen, blen));
+    if (n != 0)
+      return n;
+    return (alen < blen) ? -1 : (alen > blen ? 1 : 0);
+  }
+
+  // images are only written to a directory that's ours and nobody else can write to
+  bool
+  makeCacheDir(std::string const& dir)
+  {
+    if (dir.empty())
+      return false;
+
+    if (mkdir(dir.c_str(), 0700) != 0 && errno != EEXIST)
+    {
+      rtLog_Debug("failed to create model cache %s. %s", dir.c_str(), strerror(errno));
+      return false;
+    }
+
+    struct stat st;
+    if (lstat(dir.c_str(), &st) != 0 || !S_ISDIR(st.st_mode) || st.st_uid != geteuid() ||
+        (st.st_mode & (S_IWGRP | S_IWOTH)) != 0)
+    {
+      rtLog_Warn("not caching model images in %s, it isn't a private directory", dir.c_str());
+      return false;
+    }
+    return true;
+  }
+}
+
+dmModelImage::dmModelImage()
+  : m_base(nullptr)
+  , m_length(0)
+  , m_mapped(false)
+  , m_objectCount(0)
+  , m_propertyCount(0)
+  , m_nodeCount(0)
+  , m_providerSlots(0)
+  , m_stringsLength(0)
+  , m_objects(nullptr)
+  , m_properties(nullptr)
+  , m_nodes(nullptr)
+  , m_providers(nullptr)
+  , m_strings(nullptr)
+{
+}
+
+dmModelImage::~dmModelImage()
+{
+  if (m_mapped)
+    munmap(m_base, m_length);
+}
+
+uint64_t
+dmModelImage::fingerprint(std::string const& dir)
+{
+  DIR* d = opendir(dir.c_str());
+  if (!d)
+    return 0;
+
+  // entries are hashed on their own and summed, readdir order isn't stable
+  uint64_t sum = 0;
+  struct dirent* ent;
+  while ((ent = readdir(d)) != NULL)
+  {
+    struct stat st;
+    if (strcmp(ent->d_name, ".") == 0 || strcmp(ent->d_name, "..") == 0)
+      continue;
+    if (fstatat(dirfd(d), ent->d_name, &st, 0) != 0)
+      continue;
+
+    int64_t fields[4] = { st.st_size, st.st_mtim.tv_sec, st.st_mtim.tv_nsec, (int64_t) st.st_ino };
+    uint64_t h = fnv1a(kFnvOffset, ent->d_name, strlen(ent->d_name) + 1);
+    sum += fnv1a(h, fields, sizeof(fields));
+  }
+  closedir(d);
+
+  uint32_t version = DM_MODEL_IMAGE_VERSION;
+  uint64_t h = fnv1a(kFnvOffset, &version, sizeof(version));
+  return fnv1a(h, &sum, sizeof(sum));
+}
+
+std::string
+dmModelImage::cachePath(std::string const& dir)
+{
+  std::string cacheDir;
+  char const* env = getenv("DM_MODEL_CACHE_DIR");
+  if (env && env[0])
+  {
+    cacheDir = env;
+  }
+  else
+  {
+    char buff[64];
+    snprintf(buff, sizeof(buff), "/tmp/dmModel-%u", (unsigned) geteuid());
+    cacheDir = buff;
+  }
+
+  char name[64];
+  snprintf(name, sizeof(name), "/dmModel.%016llx.image",
+    (unsigned long long) fnv1a(kFnvOffset, dir.c_str(), dir.size()));
+  return cacheDir + name;
+}
+
+std::shared_ptr<dmModelImage>
+dmModelImage::open(std::string const& path, uint64_t fingerprint)
+{
+  std::shared_ptr<dmModelImage> image;
+
+  int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC | O_NOFOLLOW);
+  if (fd == -1)
+    return image;
+
+  // the fingerprint is easy to work out, only trust images nobody else could have written
+  struct stat st;
+  if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || st.st_uid != geteuid() ||
+      (st.st_mode & (S_IWGRP | S_IWOTH)) != 0 || st.st_size < (off_t) sizeof(Header))
+  {
+    rtLog_Debug("ignoring model image %s", path.c_str());
+    close(fd);
+    return image;
+  }
+
+  void* base = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (base == MAP_FAILED)
+  {
+    rtLog_Warn("failed to map model image %s. %s", path.c_str(), strerror(errno));
+    return image;
+  }
+
+  image.reset(new dmModelImage());
+  image->m_base = base;
+  image->m_length = st.st_size;
+  image->m_mapped = true;
+
+  if (!image->map(base, st.st_size, fingerprint))
+  {
+    rtLog_Debug("model image %s is stale", path.c_str());
+    image.reset();
+  }
+  return image;
+}
+
+bool
+dmModelImage::map(void* base, size_t length, uint64_t fingerprint)
+{
+  Header const* hdr = static_cast<Header const *>(base);
+  if (length < sizeof(Header))
+    return false;
+
+  uint64_t expected = sizeof(Header) +
+    (uint64_t) hdr->objectCount * sizeof(Object) +
+    (uint64_t) hdr->propertyCount * sizeof(Property) +
+    (uint64_t) hdr->nodeCount * sizeof(Node) +
+    (uint64_t) hdr->providerSlots * sizeof(uint32_t) +
+    hdr->stringsLength;
+
+  char const* p = static_cast<char const *>(base);
+  if (hdr->magic != DM_MODEL_IMAGE_MAGIC || hdr->version != DM_MODEL_IMAGE_VERSION ||
+      hdr->fingerprint != fingerprint || expected != (uint64_t) length ||
+      hdr->stringsLength == 0 || p[length - 1] != '\0' || hdr->nodeCount == 0 ||
+      (hdr->providerSlots & (hdr->providerSlots - 1)) != 0)
+    return false;
+
+  m_objectCount = hdr->objectCount;
+  m_propertyCount = hdr->propertyCount;
+  m_nodeCount = hdr->nodeCount;
+  m_providerSlots = hdr->providerSlots;
+  m_stringsLength = hdr->stringsLength;
+  m_objects = reinterpret_cast<Object const *>(p + sizeof(Header));
+  m_properties = reinterpret_cast<Property const *>(m_objects + m_objectCount);
+  m_nodes = reinterpret_cast<Node const *>(m_properties + m_propertyCount);
+  m_providers = reinterpret_cast<uint32_t const *>(m_nodes + m_nodeCount);
+  m_strings = reinterpret_cast<char const *>(m_providers + m_providerSlots);
+
+  // lookups walk these without checking, so a bad index has to fail here
+  for (uint32_t i = 0; i < m_nodeCount; ++i)
+  {
+    Node const& node = m_nodes[i];
+    if (node.segment >= m_stringsLength || node.segmentLength > m_stringsLength - node.segment ||
+        node.firstChild > m_nodeCount || node.childCount > m_nodeCount - node.firstChild ||
+        (node.childCount != 0 && node.firstChild <= i) ||
+        node.object >= static_cast<int32_t>(m_objectCount))
+      return false;
+  }
+
+  for (uint32_t i = 0; i < m_providerSlots; ++i)
+  {
+    if (m_providers[i] > m_objectCount)
+      return false;
+  }
+
+  m_infos.resize(m_objectCount);
+  return true;
+}
+
+std::shared_ptr<dmModelImage>
+dmModelImage::build(uint64_t fingerprint, std::vector< std::shared_ptr<dmProviderInfo> > const& objects)
+{
+  std::vector< std::shared_ptr<dmProviderInfo> > sorted(objects);
+  std::stable_sort(sorted.begin(), sorted.end(), [](std::shared_ptr<dmProviderInfo> const& a,
+    std::shared_ptr<dmProviderInfo> const& b)
+  {
+    return a->objectName() < b->objectName();
+  });
+
+  // the first file wins when two describe the same object, same as the database
+  sorted.erase(std::unique(sorted.begin(), sorted.end(), [](std::shared_ptr<dmProviderInfo> const& a,
+    std::shared_ptr<dmProviderInfo> const& b)
+  {
+    return a->objectName() == b->objectName();
+  }), sorted.end());
+
+  stringTable strings;
+  std::vector<Object> objs;
+  std::vector<Property> props;
+  trieBuilder root;
+
+  for (std::shared_ptr<dmProviderInfo> const& info : sorted)
+  {
+    Object obj;
+    obj.name = strings.add(info->objectName());
+    obj.provider = strings.add(info->providerName());
+    obj.firstProperty = static_cast<uint32_t>(props.size());
+    obj.propertyCount = static_cast<uint32_t>(info->properties().size());
+    obj.isList = info->isList() ? 1 : 0;
+
+    for (dmPropertyInfo const& propInfo : info->properties())
+    {
+      Property prop;
+      prop.name = strings.add(propInfo.name());
+      prop.fullName = strings.add(propInfo.fullName());
+      prop.type = static_cast<uint32_t>(propInfo.type());
+      prop.flags = (propInfo.isOptional() ? kPropertyOptional : 0) |
+        (propInfo.isWritable() ? kPropertyWritable : 0);
+      props.push_back(prop);
+    }
+
+    trieBuilder* node = &root;
+    std::string const& name = info->objectName();
+    std::string::size_type begin = 0;
+    while (true)
+    {
+      std::string::size_type end = name.find('.', begin);
+      std::unique_ptr<trieBuilder>& child = node->children[name.substr(begin, end - begin)];
+      if (!child)
+        child.reset(new trieBuilder());
+      node = child.get();
+      if (end == std::string::npos)
+        break;
+      begin = end + 1;
+    }
+    node->object = static_cast<int32_t>(objs.size());
+    objs.push_back(obj);
+  }
+
+  // breadth first so every node's children end up next to each other, in the
+  // map's order, which is the order findChild() searches
+  std::vector<Node> nodes;
+  std::vector<trieBuilder const *> queue;
+  nodes.push_back(Node());
+  nodes[0].segment = strings.add("");
+  nodes[0].segmentLength = 0;
+  nodes[0].object = -1;
+  queue.push_back(&root);
+  for (size_t i = 0; i < queue.size(); ++i)
+  {
+    nodes[i].firstChild = static_cast<uint32_t>(nodes.size());
+    nodes[i].childCount = static_cast<uint32_t>(queue[i]->children.size());
+    for (auto const& child : queue[i]->children)
+    {
+      Node node;
+      node.segment = strings.add(child.first);
+      node.segmentLength = static_cast<uint32_t>(child.first.size());
+      node.firstChild = 0;
+      node.childCount = 0;
+      node.object = child.second->object;
+      nodes.push_back(node);
+      queue.push_back(child.second.get());
+    }
+  }
+
+  // at most half full. the first object in name order wins, which is what a
+  // scan of the objects would find
+  uint32_t slots = 0;
+  if (!objs.empty())
+  {
+    slots = 2;
+    while (slots < objs.size() * 2)
+      slots *= 2;
+  }
+
+  std::vector<uint32_t> providers(slots, 0);
+  for (uint32_t i = 0; i < objs.size(); ++i)
+  {
+    char const* providerName = sorted[i]->providerName().c_str();
+    uint32_t slot = providerHash(providerName) & (slots - 1);
+    while (providers[slot] != 0 && sorted[providers[slot] - 1]->providerName() != providerName)
+      slot = (slot + 1) & (slots - 1);
+    if (providers[slot] == 0)
+      providers[slot] = i + 1;
+  }
+
+  Header hdr;
+  hdr.magic = DM_MODEL_IMAGE_MAGIC;
+  hdr.version = DM_MODEL_IMAGE_VERSION;
+  hdr.fingerprint = fingerprint;
+  hdr.objectCount = static_cast<uint32_t>(objs.size());
+  hdr.propertyCount = static_cast<uint32_t>(props.size());
+  hdr.nodeCount = static_cast<uint32_t>(nodes.size());
+  hdr.providerSlots = slots;
+  hdr.stringsLength = static_cast<uint32_t>(strings.buff().size());
+  hdr.reserved = 0;
+
+  std::shared_ptr<dmModelImage> image(new dmModelImage());
+  std::vector<char>& buff = image->m_buffer;
+  buff.reserve(sizeof(hdr) + objs.size() * sizeof(Object) + props.size() * sizeof(Property) +
+    nodes.size() * sizeof(Node) + providers.size() * sizeof(uint32_t) + strings.buff().size());
+
+  char const* p = reinterpret_cast<char const *>(&hdr);
+  buff.insert(buff.end(), p, p + sizeof(hdr));
+  p = reinterpret_cast<char const *>(objs.data());
+  buff.insert(buff.end(), p, p + objs.size() * sizeof(Object));
+  p = reinterpret_cast<char const *>(props.data());
+  buff.insert(buff.end(), p, p + props.size() * sizeof(Property));
+  p = reinterpret_cast<char const *>(nodes.data());
+  buff.insert(buff.end(), p, p + nodes.size() * sizeof(Node));
+  p = reinterpret_cast<char const *>(providers.data());
+  buff.insert(buff.end(), p, p + providers.size() * sizeof(uint32_t));
+  buff.insert(buff.end(), strings.buff().begin(), strings.buff().end());
+
+  image->m_base = buff.data();
+  image->m_length = buff.size();
+  if (!image->map(image->m_base, image->m_length, fingerprint))
+  {
+    rtLog_Error("failed to build model image");
+    image.reset();
+  }
+  return image;
+}
+
+bool
+dmModelImage::write(std::string const& path) const
+{
+  if (!makeCacheDir(path.substr(0, path.rfind('/'))))
+    return false;
+
+  // written to a new file of our own and renamed, so a reader never maps a partial
+  // image and nothing already at the temporary path gets followed or truncated
+  std::string tmpPath = path + ".XXXXXX";
+  int fd = mkostemp(&tmpPath[0], O_CLOEXEC);
+  if (fd == -1)
+  {
+    rtLog_Debug("failed to create model image %s. %s", tmpPath.c_str(), strerror(errno));
+    return false;
+  }
+
+  bool ok = true;
+  char const* p = static_cast<char const *>(m_base);
+  size_t n = m_length;
+  while (ok && n > 0)
+  {
+    ssize_t written = ::write(fd, p, n);
+    if (written < 0 && errno == EINTR)
+      continue;
+    if (written <= 0)
+      ok = false;
+    else
+    {
+      p += written;
+      n -= written;
+    }
+  }
+
+  if (close(fd) != 0)
+    ok = false;
+
+  if (ok && rename(tmpPath.c_str(), path.c_str()) != 0)
+    ok = false;
+
+  if (!ok)
+  {
+    rtLog_Warn("failed to write model image %s. %s", path.c_str(), strerror(errno));
+    unlink(tmpPath.c_str());
+  }
+
+  return ok;
+}
+
+char const*
+dmModelImage::string(uint32_t offset) const
+{
+  return (offset < m_stringsLength) ? m_strings + offset : "";
+}
+
+uint32_t
+dmModelImage::findChild(uint32_t node, char const* segment, uint32_t length) const
+{
+  uint32_t lo = m_nodes[node].firstChild;
+  uint32_t hi = lo + m_nodes[node].childCount;
+  while (lo < hi)
+  {
+    uint32_t mid = lo + (hi - lo) / 2;
+    Node const& child = m_nodes[mid];
+    int n = compareSegment(m_strings + child.segment, child.segmentLength, segment, length);
+    if (n == 0)
+      return mid;
+    if (n < 0)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  // the root is nobody's child
+  return 0;
+}
+
+int32_t
+dmModelImage::findLongestObject(char const* path, bool (*accept)(char const* rest),
+  uint32_t* length) const
+{
+  int32_t index = -1;
+  uint32_t node = 0;
+  char const* p = path;
+
+  while (true)
+  {
+    char const* dot = strchr(p, '.');
+    uint32_t n = static_cast<uint32_t>(dot ? dot - p : strlen(p));
+
+    node = findChild(node, p, n);
+    if (node == 0)
+      break;
+
+    p += n;
+    if (m_nodes[node].object != -1 && accept(p))
+    {
+      index = m_nodes[node].object;
+      if (length)
+        *length = static_cast<uint32_t>(p - path);
+    }
+
+    if (*p != '.')
+      break;
+    p++;
+  }
+
+  return index;
+}
+
+int32_t
+dmModelImage::findObject(char const* objectName) const
+{
+  return findLongestObject(objectName, [](char const* rest) { return *rest == '\0'; }, nullptr);
+}
+
+int32_t
+dmModelImage::findProvider(char const* providerName) const
+{
+  if (m_providerSlots == 0)
+    return -1;
+
+  // build() leaves at least half the slots empty, a corrupt image might not
+  uint32_t slot = providerHash(providerName) & (m_providerSlots - 1);
+  for (uint32_t probes = 0; probes < m_providerSlots && m_providers[slot] != 0; ++probes)
+  {
+    uint32_t index = m_providers[slot] - 1;
+    if (strcmp(string(m_objects[index].provider), providerName) == 0)
+      return static_cast<int32_t>(index);
+    slot = (slot + 1) & (m_providerSlots - 1);
+  }
+  return -1;
+}
+
+std::shared_ptr<dmProviderInfo>
+dmModelImage::providerInfo(int32_t index) const
+{
+  std::lock_guard<std::mutex> lock(m_mutex);
+  if (index < 0 || static_cast<uint32_t>(index) >= m_objectCount)
+    return std::shared_ptr<dmProviderInfo>();
+
+  std::shared_ptr<dmProviderInfo>& providerInfo = m_infos[index];
+  if (!providerInfo)
+    providerInfo = makeProviderInfo(index);
+  return providerInfo;
+}
+
+std::shared_ptr<dmProviderInfo>
+dmModelImage::makeProviderInfo(int32_t index) const
+{
+  std::shared_ptr<dmProviderInfo> providerInfo;
+  if (index < 0 || static_cast<uint32_t>(index) >= m_objectCount)
+    return providerInfo;
+
+  Object const& obj = m_objects[index];
+  if (obj.firstProperty > m_propertyCount || obj.propertyCount > m_propertyCount - obj.firstProperty)
+    return providerInfo;
+
+  providerInfo.reset(new dmProviderInfo());
+  providerInfo->setObjectName(string(obj.name));
+  providerInfo->setProviderName(string(obj.provider));
+  providerInfo->setIsList(obj.isList != 0);
+  providerInfo->m_props.reserve(obj.propertyCount);
+
+  for (uint32_t i = 0; i < obj.propertyCount; ++i)
+  {
+    Property const& prop = m_properties[obj.firstProperty + i];
+
+    dmPropertyInfo propInfo;
+    propInfo.setName(string(prop.name));
+    propInfo.setFullName(string(prop.fullName));
+    propInfo.setType(prop.type < dmValueType_Unknown ? static_cast<dmValueType>(prop.type) : dmValueType_Unknown);
+    propInfo.setIsOptional((prop.flags & kPropertyOptional) != 0);
+    propInfo.setIsWritable((prop.flags & kPropertyWritable) != 0);
+    providerInfo->addProperty(std::move(propInfo));
+  }
+
+  return providerInfo;
+}
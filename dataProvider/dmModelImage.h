@@ -0,0 +1,124 @@
+/* Copyright [2017] [Comcast, Corp.]
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef __DM_MODEL_IMAGE_H__
+#define __DM_MODEL_IMAGE_H__
+
+#include "dmProviderInfo.h"
+
+#include <memory>
+#include <mutex>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+/**
+ * A data model directory compiled into one flat file that's mapped read only, so
+ * loading a model doesn't parse any json. The image is written the first time a
+ * directory is parsed and is used until a model file is added, removed or changed.
+ * Objects are looked up in place and only turned into dmProviderInfo when asked for.
+ *
+ * Object names are indexed with a trie of their '.' separated segments and provider
+ * names with a hash table, so lookups cost the length of the name rather than the
+ * size of the model.
+ *
+ * Images live in $DM_MODEL_CACHE_DIR, /tmp/dmModel-<euid> by default, and are named
+ * after a hash of the model directory's path. The directory and the images have to
+ * belong to the effective user and can't be writable by anyone else.
+ */
+class dmModelImage
+{
+public:
+  ~dmModelImage();
+
+  dmModelImage(dmModelImage const&) = delete;
+  dmModelImage& operator=(dmModelImage const&) = delete;
+
+  /**
+   * Hash of the names, sizes and modification times of the files in dir
+   */
+  static uint64_t fingerprint(std::string const& dir);
+
+  static std::string cachePath(std::string const& dir);
+
+  /**
+   * @return null if the image is missing, corrupt or was built from a different
+   *   fingerprint
+   */
+  static std::shared_ptr<dmModelImage> open(std::string const& path, uint64_t fingerprint);
+
+  /**
+   * Compiles parsed objects into an image in memory. The first of two objects with
+   * the same name wins.
+   */
+  static std::shared_ptr<dmModelImage> build(uint64_t fingerprint,
+    std::vector< std::shared_ptr<dmProviderInfo> > const& objects);
+
+  bool write(std::string const& path) const;
+
+  /**
+   * @return the object's position in the image or -1
+   */
+  int32_t findObject(char const* objectName) const;
+  int32_t findProvider(char const* providerName) const;
+
+  /**
+   * Walks path a segment at a time and returns the deepest object along it whose
+   * remainder of the path accept() agrees with, or -1
+   * @param path object name followed by anything, e.g. a query string
+   * @param accept gets what follows the object's name in path
+   * @param length set to the length of the object's name
+   */
+  int32_t findLongestObject(char const* path, bool (*accept)(char const* rest),
+    uint32_t* length) const;
+
+  /**
+   * Made once and shared by every later call for the same object
+   */
+  std::shared_ptr<dmProviderInfo> providerInfo(int32_t index) const;
+
+private:
+  struct Header;
+  struct Object;
+  struct Property;
+  struct Node;
+
+  dmModelImage();
+
+  bool map(void* base, size_t length, uint64_t fingerprint);
+  char const* string(uint32_t offset) const;
+  uint32_t findChild(uint32_t node, char const* segment, uint32_t length) const;
+  std::shared_ptr<dmProviderInfo> makeProviderInfo(int32_t index) const;
+
+private:
+  void*             m_base;
+  size_t            m_length;
+  bool              m_mapped;
+  std::vector<char> m_buffer;
+  uint32_t          m_objectCount;
+  uint32_t          m_propertyCount;
+  uint32_t          m_nodeCount;
+  uint32_t          m_providerSlots;
+  uint32_t          m_stringsLength;
+  Object const*     m_objects;
+  Property const*   m_properties;
+  Node const*       m_nodes;
+  uint32_t const*   m_providers;
+  char const*       m_strings;
+
+  mutable std::mutex m_mutex;
+  mutable std::vector< std::shared_ptr<dmProviderInfo> > m_infos;
+};
+
+#endif
@@ -14,41 +14,72 @@
  */
 #include "dmPropertyInfo.h"
 
+dmPropertyInfo::descriptor::descriptor()
+  : name()
+  , fullName()
+  , type(dmValueType_Unknown)
+  , optional(false)
+  , writable(false)
+  , id(-1)
+{
+}
+
 dmPropertyInfo::dmPropertyInfo()
-  : m_name()
-  , m_type(dmValueType_Unknown)
-  , m_optional(false)
-  , m_writable(false)
+  : m_desc(emptyDescriptor())
   , m_index(-1)
 {
 }
 
+// every property that hasn't been set up yet shares this one
+std::shared_ptr<dmPropertyInfo::descriptor> const&
+dmPropertyInfo::emptyDescriptor()
+{
+  static std::shared_ptr<descriptor> const empty = std::make_shared<descriptor>();
+  return empty;
+}
+
+dmPropertyInfo::descriptor&
+dmPropertyInfo::mutableDescriptor()
+{
+  // as the only owner, no other copy can be looking at it
+  if (!m_desc)
+    m_desc = std::make_shared<descriptor>();
+  else if (m_desc.use_count() != 1)
+    m_desc = std::make_shared<descriptor>(*m_desc);
+  return *m_desc;
+}
+
 void dmPropertyInfo::setName(std::string const& name)
 {
-  m_name = name;
+  mutableDescriptor().name = name;
 }
 
 void dmPropertyInfo::setType(dmValueType t)
 {
-  m_type = t;
+  mutableDescriptor().type = t;
 }
 
 void dmPropertyInfo::setIsOptional(bool b)
 {
-  m_optional = b;
+  mutableDescriptor().optional = b;
 }
 
 void dmPropertyInfo::setIsWritable(bool b)
 {
-  m_writable = b;
+  mutableDescriptor().writable = b;
 }
 
 void dmPropertyInfo::setFullName(std::string const& name)
 {
-  m_full_name = name;
+  mutableDescriptor().fullName = name;
 }
 
 void dmPropertyInfo::setIndex(uint32_t i)
 {
   m_index = i;
 }
+
+void dmPropertyInfo::setId(uint32_t id)
+{
+  mutableDescriptor().id = id;
+}
@@ -15,6 +15,7 @@
 #ifndef __DM_PROPERTY_INFO_H__
 #define __DM_PROPERTY_INFO_H__
 
+#include <memory>
 #include <string>
 
 #include "dmValueType.h"
@@ -22,28 +23,40 @@
 
 class dmProviderDatabase;
 
+/**
+ * What the model says about a property lives in a descriptor that's shared by every
+ * copy, so copying a dmPropertyInfo doesn't copy strings. The list index is the only
+ * state a copy has of its own. Setters copy the descriptor first if it's shared.
+ */
 class dmPropertyInfo
 {
   friend class dmProviderDatabase;
 public:
   inline std::string const& name() const
-    { return m_name; }
+    { return m_desc->name; }
 
   inline dmValueType type() const
-    { return m_type; }
+    { return m_desc->type; }
 
   inline bool isOptional() const
-    { return m_optional; }
+    { return m_desc->optional; }
 
   inline bool isWritable() const
-    { return m_writable; }
+    { return m_desc->writable; }
 
   inline std::string const& fullName() const
-    { return m_full_name; }
+    { return m_desc->fullName; }
 
   inline uint32_t index() const
     { return m_index; }
 
+  /**
+   * Position of the property in its object, assigned when the model is loaded.
+   * -1 for properties that aren't in the model.
+   */
+  inline uint32_t id() const
+    { return m_desc->id; }
+
 public:
   dmPropertyInfo();
   void setName(std::string const& name);
@@ -52,14 +65,27 @@ public:
   void setIsWritable(bool b);
   void setFullName(std::string const& name);
   void setIndex(uint32_t i);
+  void setId(uint32_t id);
+
+private:
+  struct descriptor
+  {
+    descriptor();
+
+    std::string name;
+    std::string fullName;
+    dmValueType type;
+    bool        optional;
+    bool        writable;
+    uint32_t    id;
+  };
+
+  static std::shared_ptr<descriptor> const& emptyDescriptor();
+  descriptor& mutableDescriptor();
 
 private:
-  std::string m_name;
-  dmValueType m_type;
-  bool        m_optional;
-  bool        m_writable;
-  std::string m_full_name;
-  uint32_t    m_index;
+  std::shared_ptr<descriptor> m_desc;
+  uint32_t                    m_index;
 };
 
 
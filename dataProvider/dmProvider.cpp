@@ -14,6 +14,7 @@
  */
 #include <cstring>
 #include <iostream>
+#include <utility>
 
 #include "dmProvider.h"
 #include <rtError.h>
@@ -35,10 +36,10 @@ dmProvider::doGet(std::vector<dmPropertyInfo> const& params, std::vector<dmQuery
 
   for (auto const& propInfo : params)
   {
-    auto itr = m_provider_functions.find(propInfo.name());
-    if ((itr != m_provider_functions.end()) && (itr->second.getter != nullptr))
+    provider_functions const* funcs = findFunctions(propInfo);
+    if (funcs && funcs->getter)
     {
-      itr->second.getter(propInfo, temp);
+      funcs->getter(propInfo, temp);
     }
     else
     {
@@ -54,7 +55,7 @@ dmProvider::doGet(std::vector<dmPropertyInfo> const& params, std::vector<dmQuery
     {
       if(propInfo.index() != -1)
         temp.setIndex(propInfo.index()+1);
-      result.push_back(temp);
+      result.push_back(std::move(temp));
     }
 
     temp.clear();
@@ -75,10 +76,10 @@ dmProvider::doSet(std::vector<dmNamedValue> const& params, std::vector<dmQueryRe
 
   for (auto const& value : params)
   {
-    auto itr = m_provider_functions.find(value.name());
-    if ((itr != m_provider_functions.end()) && (itr->second.setter != nullptr))
+    provider_functions const* funcs = findFunctions(value.info());
+    if (funcs && funcs->setter)
     {
-      itr->second.setter(value.info(), value.value(), temp);
+      funcs->setter(value.info(), value.value(), temp);
     }
     else
     {
@@ -94,7 +95,7 @@ dmProvider::doSet(std::vector<dmNamedValue> const& params, std::vector<dmQueryRe
     {
       if(value.info().index() != -1)
         temp.setIndex(value.info().index()+1);
-      result.push_back(temp);
+      result.push_back(std::move(temp));
     }
 
     temp.clear();
@@ -123,6 +124,7 @@ dmProvider::onGet(std::string const& propertyName, getter_function func)
     funcs.setter = nullptr;
     funcs.getter = func;
     m_provider_functions.insert(std::make_pair(propertyName, funcs));
+    updateFunctionTable();
   }
 }
 
@@ -141,9 +143,45 @@ dmProvider::onSet(std::string const& propertyName, setter_function func)
     funcs.setter = func;
     funcs.getter = nullptr;
     m_provider_functions.insert(std::make_pair(propertyName, funcs));
+    updateFunctionTable();
   }
 }
 
+void
+dmProvider::setProviderInfo(std::shared_ptr<dmProviderInfo> const& providerInfo)
+{
+  m_providerInfo = providerInfo;
+  updateFunctionTable();
+}
+
+void
+dmProvider::updateFunctionTable()
+{
+  m_function_table.clear();
+  if (!m_providerInfo)
+    return;
+
+  std::vector<dmPropertyInfo> const& props = m_providerInfo->properties();
+  m_function_table.resize(props.size(), nullptr);
+  for (dmPropertyInfo const& propInfo : props)
+  {
+    auto itr = m_provider_functions.find(propInfo.name());
+    if (itr != m_provider_functions.end() && propInfo.id() < m_function_table.size())
+      m_function_table[propInfo.id()] = &itr->second;
+  }
+}
+
+// properties from the model carry their id, anything else falls back to its name
+dmProvider::provider_functions const*
+dmProvider::findFunctions(dmPropertyInfo const& info) const
+{
+  if (info.id() < m_function_table.size())
+    return m_function_table[info.id()];
+
+  auto itr = m_provider_functions.find(info.name());
+  return (itr != m_provider_functions.end()) ? &itr->second : nullptr;
+}
+
 size_t dmProvider::getListSize()
 {
   return 0;
@@ -16,14 +16,19 @@
 #define __DM_PROVIDER_H__
 
 #include "dmPropertyInfo.h"
+#include "dmProviderInfo.h"
 #include "dmQueryResult.h"
 
 #include <functional>
 #include <map>
+#include <memory>
 #include <vector>
 
+class dmProviderHost;
+
 class dmProvider
 {
+  friend class dmProviderHost;
 public:
   dmProvider();
   virtual ~dmProvider();
@@ -55,7 +60,16 @@ private:
     setter_function setter;
   };
 
+  // called by the host once it knows which object the provider is for
+  void setProviderInfo(std::shared_ptr<dmProviderInfo> const& providerInfo);
+  void updateFunctionTable();
+  provider_functions const* findFunctions(dmPropertyInfo const& info) const;
+
   std::map< std::string, provider_functions > m_provider_functions;
+
+  // m_provider_functions by property id, so dispatch doesn't compare names
+  std::vector< provider_functions const* > m_function_table;
+  std::shared_ptr<dmProviderInfo> m_providerInfo;
 };
 
 #endif
@@ -26,6 +26,8 @@
 #include <sstream>
 #include <iomanip>
 #include <memory>
+#include <mutex>
+#include <algorithm>
 
 
 #include "rtConnection.h"
@@ -37,12 +39,19 @@
 
 #include "dmUtility.h"
 #include "dmProviderInfo.h"
+#include "dmModelImage.h"
 
 namespace
 {
-  using dmDatabase = std::map< std::string, std::shared_ptr<dmProviderInfo> >;
+  // every loaded model directory, by image path. provider hosts look objects up from
+  // their worker threads
+  std::vector< std::pair< std::string, std::shared_ptr<dmModelImage> > > model_images;
+  std::mutex model_mutex;
 
-  dmDatabase model_db;
+  // Bounds the values the provider expands into one response for a wildcard list
+  // query. rtMessage appends to and indexes json arrays by walking them, so a single
+  // response with thousands of values costs more than a few round trips.
+  const int32_t kListValuesPerRequest = 512;
 
   bool matches_object(char const* query, char const* obj)
   {
@@ -51,46 +60,75 @@ namespace
     return strncmp(query, obj, n) == 0;
   }
 
+  // What can follow an object's name in a query string: a '.' wildcard or a property,
+  // either of them optionally after a list index. e.g. ".", ".Name", ".2." or ".2.Name"
+  bool is_query_remainder(char const* rest)
+  {
+    if (*rest++ != '.')
+      return false;
+
+    char const* dot = strchr(rest, '.');
+    if (dot && atoi(rest) != 0)
+      rest = dot + 1;
+
+    return strchr(rest, '.') == nullptr;
+  }
+
+  void add_image(std::string const& path, std::shared_ptr<dmModelImage> const& image)
+  {
+    std::lock_guard<std::mutex> lock(model_mutex);
+    for (auto const& loaded : model_images)
+    {
+      if (loaded.first == path)
+        return;
+    }
+    model_images.push_back(std::make_pair(path, image));
+  }
+
 }
 
 class dmQueryImpl : public dmQuery
 {
 public:
-  dmQueryImpl()
+  // the connection belongs to the database that created the query
+  dmQueryImpl(rtConnection con) : m_con(con)
   {
-    rtConnection_Create(&m_con, "DMCLI", "tcp://127.0.0.1:10001");
-
-    #ifdef DEFAULT_DATAMODELDIR
-    std::string datamodel_dir = DEFAULT_DATAMODELDIR;
-    #else
-    std::string datamode_dir;
-    #endif
-
-    db = new dmProviderDatabase(datamodel_dir);
   }
 
   ~dmQueryImpl()
   {
-    rtConnection_Destroy(m_con);
-    if (db)
-    {
-      delete db;
-      db = nullptr;
-    }
   }
 
-  void makeRequest(std::string& topic, std::string& queryString)
+  // returns the list entry to continue from, 0 once the response is complete
+  int32_t makeRequest(std::string& topic, int32_t start)
   {
+    int32_t next = 0;
     rtMessage req;
     rtMessage_Create(&req);
     rtMessage_SetString(req, "method", m_operation.c_str());
     rtMessage_SetString(req, "provider", m_providerInfo->providerName().c_str());
-    rtMessage item;
-    rtMessage_Create(&item);
-    rtMessage_SetString(item, "name", queryString.c_str());
-    if (strcmp(m_operation.c_str(), "set") == 0)
-      rtMessage_SetString(item, "value", m_value.c_str());
-    rtMessage_SetMessage(req, "params", item);
+    if (m_providerInfo->isList())
+    {
+      rtMessage_SetInt32(req, "start", start);
+      int32_t numProperties = static_cast<int32_t>(m_providerInfo->properties().size());
+      rtMessage_SetInt32(req, "limit", std::max(1, kListValuesPerRequest / std::max(1, numProperties)));
+    }
+    for (auto const& param : m_params)
+    {
+      rtMessage item;
+      rtMessage_Create(&item);
+      rtMessage_SetString(item, "name", param.first.c_str());
+      if (strcmp(m_operation.c_str(), "set") == 0)
+      {
+        // parsed here once, the provider gets the property's own type
+        dmPropertyInfo propInfo = m_providerInfo->getPropertyInfo(param.first.c_str());
+        dmValue value = dmValue::fromString(propInfo.type(), param.second);
+        rtMessage_SetInt32(item, "type", value.type());
+        value.encode(item, "value");
+      }
+      rtMessage_AddMessage(req, "params", item);
+      rtMessage_Release(item);
+    }
     rtMessage res;
 
     rtError err = rtConnection_SendRequest(m_con, req, topic.c_str(), &res, 2000);
@@ -117,14 +155,20 @@ public:
         rtMessage_GetMessageItem(res, "result", i, &item);
         int status = 0;
         int index = -1;
+        int32_t type = dmValueType_String;
+        bool hasValue = false;
         char const* param = nullptr;
         char const* value = nullptr;
         char const* status_msg = nullptr;
 
         if (rtMessage_GetString(item, "name", &param) != RT_OK)
           rtLog_Debug("failed to get 'name' from paramter");
-        if (rtMessage_GetString(item, "value", &value) != RT_OK)
+        if (rtMessage_GetString(item, "value", &value) == RT_OK)
+          hasValue = true;
+        else
           rtLog_Debug("failed to get 'value' from parameter");
+        if (rtMessage_GetInt32(item, "type", &type) != RT_OK || type < 0 || type > dmValueType_Unknown)
+          type = dmValueType_String;
         if (rtMessage_GetInt32(item, "index", &index) != RT_OK)
           rtLog_Error("failed to get 'index' from response");
         if (rtMessage_GetInt32(item, "status", &status) != RT_OK)
@@ -132,10 +176,13 @@ public:
         if (rtMessage_GetString(item, "status_msg", &status_msg) != RT_OK)
           rtLog_Debug("no status message in response");
 
-        if (param != nullptr && value != nullptr)
+        if (param != nullptr && hasValue)
         {
+          // a batch can hold items from different list entries, keep the index per value
           dmPropertyInfo propInfo = m_providerInfo->getPropertyInfo(param);
-          m_results.addValue(propInfo, dmValue(value));
+          if (index > 0)
+            propInfo.setIndex(index - 1);
+          m_results.addValue(propInfo, dmValue::decode(item, "value", static_cast<dmValueType>(type)));
         }
 
         if(index > 0)
@@ -145,13 +192,26 @@ public:
           m_results.setStatus(status);
         if(status_msg != nullptr)
           m_results.setStatusMsg(status_msg);
+
+        // item borrows the json from res
+        free(item);
       }
 
+      if (rtMessage_GetInt32(res, "next", &next) != RT_OK || next <= start)
+        next = 0;
+
       m_results.updateFullNames();
 
       rtMessage_Release(res);
-      rtMessage_Release(req);
     }
+    else
+    {
+      rtLog_Warn("dm query to %s failed. %s", topic.c_str(), rtStrError(err));
+      m_results.setStatus(err);
+      m_results.setStatusMsg(rtStrError(err));
+    }
+    rtMessage_Release(req);
+    return next;
   }
 
   virtual bool exec()
@@ -162,12 +222,31 @@ public:
       return false;
     }
 
+    if (!m_con)
+    {
+      rtLog_Warn("Trying to execute a query without a router connection");
+      return false;
+    }
+
+    if (m_params.empty())
+    {
+      rtLog_Warn("Trying to execute a query without any parameters");
+      return false;
+    }
+
     std::string topic("RDK.MODEL.");
     topic += m_providerInfo->providerName();
 
-    rtLog_Debug("sending dm query : %s on topic :%s", m_query.c_str(), topic.c_str());
+    rtLog_Debug("sending dm query : %s (%d params) on topic :%s", m_params.front().first.c_str(),
+      (int) m_params.size(), topic.c_str());
 
-    makeRequest(topic, m_query);
+    // a wildcard list query comes back in pages of about kListValuesPerRequest values
+    int32_t start = 0;
+    do
+    {
+      start = makeRequest(topic, start);
+    }
+    while (start > 0);
 
     reset();
     return true;
@@ -176,30 +255,41 @@ public:
   virtual void reset()
   {
     m_operation.clear();
-    m_query.clear();
-    m_value.clear();
+    m_params.clear();
     m_providerInfo.reset();
   }
 
   virtual bool setQueryString(dmProviderOperation op, char const* s)
   {
+    m_params.clear();
+    return addQueryString(op, s);
+  }
+
+  virtual bool addQueryString(dmProviderOperation op, char const* s)
+  {
+    char const* operation = (op == dmProviderOperation_Set) ? "set" : "get";
+    if (!m_params.empty() && m_operation != operation)
+    {
+      rtLog_Error("can't mix get and set in a single query");
+      return false;
+    }
+
     switch (op)
     {
       case dmProviderOperation_Get:
       {
-        m_operation = "get";
-        m_query = s;
+        m_operation = operation;
+        m_params.push_back(std::make_pair(std::string(s), std::string()));
       }
       break;
       case dmProviderOperation_Set:
       {
-        m_operation = "set";
+        m_operation = operation;
         std::string data(s);
         if (data.find("=") != std::string::npos)
         {
           std::size_t position = data.find("=");
-          m_query = data.substr(0, position);
-          m_value = data.substr(position+1);
+          m_params.push_back(std::make_pair(data.substr(0, position), data.substr(position+1)));
         }
         else
         {
@@ -225,10 +315,8 @@ public:
 private:
   rtConnection m_con;
   dmQueryResult m_results;
-  std::string m_query;
-  std::string m_value;
+  std::vector< std::pair<std::string, std::string> > m_params; // name, value
   std::string m_operation;
-  dmProviderDatabase *db;
   std::shared_ptr<dmProviderInfo> m_providerInfo;
 
   // TODO: int m_count;
@@ -237,25 +325,77 @@ private:
 
 dmProviderDatabase::dmProviderDatabase(std::string const& dir)
   : m_modelDirectory(dir)
+  , m_con(nullptr)
 {
   loadFromDir(dir);
 }
 
+dmProviderDatabase::~dmProviderDatabase()
+{
+  if (m_con)
+  {
+    rtConnection_Destroy(m_con);
+    m_con = nullptr;
+  }
+}
+
+// Creating a connection runs rtrouted to make sure it's up, connects and subscribes
+// an inbox. Do that once and share it between every query from this database.
+rtConnection
+dmProviderDatabase::connection() const
+{
+  if (!m_con)
+  {
+    rtError err = rtConnection_Create(&m_con, "DMCLI", "tcp://127.0.0.1:10001");
+    if (err != RT_OK)
+    {
+      rtLog_Warn("failed to connect to router. %s", rtStrError(err));
+      m_con = nullptr;
+    }
+  }
+  return m_con;
+}
+
 void
 dmProviderDatabase::loadFromDir(std::string const& dirname)
 {
   DIR* dir;
   struct dirent *ent;
 
+  uint64_t fingerprint = dmModelImage::fingerprint(dirname);
+  std::string imagePath = dmModelImage::cachePath(dirname);
+
+  std::shared_ptr<dmModelImage> image = dmModelImage::open(imagePath, fingerprint);
+  if (image)
+  {
+    rtLog_Debug("loading database from image:%s", imagePath.c_str());
+    add_image(imagePath, image);
+    return;
+  }
+
   rtLog_Debug("loading database from directory:%s", dirname.c_str());
   if ((dir = opendir(dirname.c_str())) != NULL)
   {
+    std::vector< std::shared_ptr<dmProviderInfo> > objects;
     while ((ent = readdir(dir)) != NULL)
     {
       if (strcmp(ent->d_name,".") != 0 && strcmp(ent->d_name,"..") != 0)
-        loadFile(dirname.c_str(), ent->d_name);
+      {
+        std::shared_ptr<dmProviderInfo> providerInfo = loadFile(dirname.c_str(), ent->d_name);
+        if (providerInfo)
+          objects.push_back(providerInfo);
+      }
     }
     closedir(dir);
+
+    // parsed models are looked up through an image as well, it's where the indexes are
+    image = dmModelImage::build(fingerprint, objects);
+    if (image)
+    {
+      if (fingerprint != 0)
+        image->write(imagePath);
+      add_image(imagePath, image);
+    }
   } 
   else
   {
@@ -264,7 +404,7 @@ dmProviderDatabase::loadFromDir(std::string const& dirname)
   }
 }
 
-void
+std::shared_ptr<dmProviderInfo>
 dmProviderDatabase::loadFile(std::string const& dir, char const* fname)
 {
   std::string path = dir;
@@ -278,7 +418,7 @@ dmProviderDatabase::loadFile(std::string const& dir, char const* fname)
   if (!file.is_open())
   {
     rtLog_Warn("failed to open fie. %s. %s", fname, strerror(errno));
-    return;
+    return std::shared_ptr<dmProviderInfo>();
   }
 
   file.seekg(0, file.end);
@@ -293,13 +433,13 @@ dmProviderDatabase::loadFile(std::string const& dir, char const* fname)
   std::shared_ptr<dmProviderInfo> providerInfo = makeProviderInfo(&buff[0]);
   if (providerInfo)
   {
-    rtLog_Info("model_db insert:%s", providerInfo->objectName().c_str());
-    model_db.insert(std::make_pair(providerInfo->objectName(), providerInfo));
+    rtLog_Info("model insert:%s", providerInfo->objectName().c_str());
   }
   else
   {
     rtLog_Error("Failed to parse json from:%s. %s", path.c_str(), cJSON_GetErrorPtr());
   }
+  return providerInfo;
 }
 
 #if 0
@@ -341,22 +481,27 @@ dmProviderDatabase::getProviderByObjectName(std::string const& s) const
   else
     objectName = s;
 
-  auto itr = model_db.find(objectName);
-  if (itr == model_db.end())
-    rtLog_Debug("failed to find %s in model database", objectName.c_str());
+  std::lock_guard<std::mutex> lock(model_mutex);
+  for (auto const& image : model_images)
+  {
+    int32_t index = image.second->findObject(objectName.c_str());
+    if (index != -1)
+      return image.second->providerInfo(index);
+  }
 
-  return (itr != model_db.end())
-    ? itr->second
-    : std::shared_ptr<dmProviderInfo>();
+  rtLog_Debug("failed to find %s in model database", objectName.c_str());
+  return std::shared_ptr<dmProviderInfo>();
 }
 
 std::shared_ptr<dmProviderInfo>
 dmProviderDatabase::getProviderByName(std::string const& s) const
 {
-  for (auto itr : model_db)
+  std::lock_guard<std::mutex> lock(model_mutex);
+  for (auto const& image : model_images)
   {
-    if (itr.second->providerName() == s)
-      return itr.second;
+    int32_t index = image.second->findProvider(s.c_str());
+    if (index != -1)
+      return image.second->providerInfo(index);
   }
   return std::shared_ptr<dmProviderInfo>();
 }
@@ -404,7 +549,39 @@ dmProviderDatabase::getParameters(char const* provider) const
 dmQuery*
 dmProviderDatabase::createQuery() const
 {
-  return new dmQueryImpl();
+  return new dmQueryImpl(connection());
+}
+
+std::shared_ptr<dmProviderInfo>
+dmProviderDatabase::getProviderByQueryString(std::string const& s) const
+{
+  // the deepest object the query string names, across every loaded model. objects
+  // from models loaded earlier win a tie. images are never unloaded
+  dmModelImage const* found = nullptr;
+  int32_t foundIndex = -1;
+  uint32_t foundLength = 0;
+  {
+    std::lock_guard<std::mutex> lock(model_mutex);
+    for (auto const& image : model_images)
+    {
+      uint32_t length = 0;
+      int32_t index = image.second->findLongestObject(s.c_str(), is_query_remainder, &length);
+      if (index != -1 && (foundIndex == -1 || length > foundLength))
+      {
+        found = image.second.get();
+        foundIndex = index;
+        foundLength = length;
+      }
+    }
+  }
+
+  std::shared_ptr<dmProviderInfo> providerInfo;
+  if (found)
+    providerInfo = found->providerInfo(foundIndex);
+  else
+    rtLog_Warn("failed to find provider for query string:%s", s.c_str());
+
+  return providerInfo;
 }
 
 dmQuery* 
@@ -413,26 +590,44 @@ dmProviderDatabase::createQuery(dmProviderOperation op, char const* queryString)
   if (!queryString)
     return nullptr;
 
-  std::string objectName(queryString);
-
-  if (dmUtility::isWildcard(objectName.c_str()))
-    objectName = dmUtility::trimWildcard(objectName);
-  else
-    objectName = dmUtility::trimProperty(objectName);
+  std::shared_ptr<dmProviderInfo> providerInfo = getProviderByQueryString(queryString);
+  if (!providerInfo)
+    return nullptr;
 
-  if (dmUtility::isListIndex(objectName.c_str()))
-    objectName = dmUtility::trimProperty(objectName);//trim again to remove index
+  dmQueryImpl* query = new dmQueryImpl(connection());
+  bool status = query->setQueryString(op, queryString);
+  if (status)
+    query->setProviderInfo(providerInfo);
+  return query;
+}
 
-  std::shared_ptr<dmProviderInfo> providerInfo = getProviderByObjectName(objectName);
+dmQuery*
+dmProviderDatabase::createQuery(dmProviderOperation op, std::vector<std::string> const& queryStrings) const
+{
+  if (queryStrings.empty())
+    return nullptr;
 
+  std::shared_ptr<dmProviderInfo> providerInfo = getProviderByQueryString(queryStrings.front());
   if (!providerInfo)
-  {
-    rtLog_Warn("failed to find provider for query string:%s", objectName.c_str());
     return nullptr;
+
+  dmQueryImpl* query = new dmQueryImpl(connection());
+  bool status = true;
+  for (std::string const& s : queryStrings)
+  {
+    if (getProviderByQueryString(s) != providerInfo)
+    {
+      rtLog_Warn("query string:%s isn't from provider:%s", s.c_str(), providerInfo->providerName().c_str());
+      status = false;
+      break;
+    }
+    if (!query->addQueryString(op, s.c_str()))
+    {
+      status = false;
+      break;
+    }
   }
 
-  dmQueryImpl* query = new dmQueryImpl();
-  bool status = query->setQueryString(op, queryString);
   if (status)
     query->setProviderInfo(providerInfo);
   return query;
@@ -462,8 +657,6 @@ dmProviderDatabase::makeProviderInfo(char const* s)
   {
     for (int i = 0, n = cJSON_GetArraySize(p); i < n; ++i)
     {
-      // TODO: make this vector of pointers or shared pointers
-      // std::shared_ptr<dmPropertyInfo> prop(new dmPropertyInfo());
       dmPropertyInfo prop;
 
       cJSON* props = cJSON_GetArrayItem(p, i);
@@ -492,7 +685,7 @@ dmProviderDatabase::makeProviderInfo(char const* s)
         prop.setIsWritable(p->type == cJSON_True);
 
       // rtLog_Info("add prop:%s", prop.name().c_str());
-      providerInfo->addProperty(prop);
+      providerInfo->addProperty(std::move(prop));
     }
   }
 
@@ -20,6 +20,8 @@
 #include "dmProviderOperation.h"
 #include "dmPropertyInfo.h"
 
+#include <rtConnection.h>
+
 #include <map>
 #include <string>
 #include <vector>
@@ -28,19 +30,35 @@ class dmProviderDatabase
 {
 public:
   dmProviderDatabase(std::string const& dir);
+  ~dmProviderDatabase();
+
+  dmProviderDatabase(dmProviderDatabase const&) = delete;
+  dmProviderDatabase& operator=(dmProviderDatabase const&) = delete;
 
+  /**
+   * Queries share this database's router connection, so like the connection they
+   * must not be used from more than one thread at a time.
+   */
   dmQuery* createQuery() const;
   dmQuery* createQuery(dmProviderOperation op, char const* s) const;
+
+  /**
+   * One request for all of the query strings. They must all belong to the same provider.
+   */
+  dmQuery* createQuery(dmProviderOperation op, std::vector<std::string> const& s) const;
   std::shared_ptr<dmProviderInfo> getProviderByName(std::string const& s) const;
   std::shared_ptr<dmProviderInfo> getProviderByObjectName(std::string const& s) const;
+  std::shared_ptr<dmProviderInfo> getProviderByQueryString(std::string const& s) const;
 
 private:
   void loadFromDir(std::string const& dir);
-  void loadFile(std::string const& dir, char const* fname);
+  std::shared_ptr<dmProviderInfo> loadFile(std::string const& dir, char const* fname);
   std::shared_ptr<dmProviderInfo> makeProviderInfo(char const* json);
+  rtConnection connection() const;
 
 private:
   std::string m_modelDirectory;
+  mutable rtConnection m_con;
 };
 
 #endif
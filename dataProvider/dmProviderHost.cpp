@@ -17,9 +17,12 @@
 #include "dmProviderOperation.h"
 
 #include <sstream>
+#include <cstdlib>
 #include <cstring>
 #include <iostream>
 #include <algorithm>
+#include <condition_variable>
+#include <deque>
 
 #include <rtConnection.h>
 #include <rtError.h>
@@ -30,24 +33,22 @@
 namespace
 {
 
-  dmNamedValue
-  makeNamedValue(dmPropertyInfo const& propInfo, char const* valueAsString)
-  {
-    // TODO conver to propert type from string
-    return dmNamedValue(propInfo, dmValue(valueAsString));
-  }
+  using dmParams = std::vector< std::pair<std::string, dmValue> >;
 }
 
 class dmProviderHostImpl : public dmProviderHost
 {
 public:
   dmProviderHostImpl()
+    : m_numWorkers(0)
+    , m_stopping(false)
   {
 
   }
 
   virtual ~dmProviderHostImpl()
   {
+    stopWorkers();
     if (m_con)
     {
       rtLog_Info("closing rtMessage connection");
@@ -75,16 +76,26 @@ private:
     return true;
   }
 
+  void setWorkerThreads(int numThreads)
+  {
+    m_numWorkers = (numThreads > 0) ? numThreads : 0;
+  }
+
   void start()
   {
     rtConnection_Create(&m_con, "USE_UNIQUE_NAME_HERE", "tcp://127.0.0.1:10001");
     std::unique_lock<std::mutex> lock(m_mutex);
+    m_stopping = false;
+    for (int i = 0; i < m_numWorkers; ++i)
+      m_workers.push_back(std::thread(&dmProviderHostImpl::runWorker, this));
     m_thread.reset(new std::thread(&dmProviderHostImpl::run, this));
   }
 
   void stop()
   {
+    stopWorkers();
     rtConnection_Destroy(m_con);
+    m_con = nullptr;
     std::unique_lock<std::mutex> lock(m_mutex);
     if (m_thread)
     {
@@ -104,6 +115,37 @@ private:
     }
   }
 
+  // finishes whatever is queued, then joins
+  void stopWorkers()
+  {
+    {
+      std::unique_lock<std::mutex> lock(m_queueMutex);
+      m_stopping = true;
+    }
+    m_queueCond.notify_all();
+
+    for (std::thread& t : m_workers)
+      t.join();
+    m_workers.clear();
+  }
+
+  void runWorker()
+  {
+    while (true)
+    {
+      Request r;
+      {
+        std::unique_lock<std::mutex> lock(m_queueMutex);
+        m_queueCond.wait(lock, [this] { return m_stopping || !m_queue.empty(); });
+        if (m_queue.empty())
+          return;
+        r = m_queue.front();
+        m_queue.pop_front();
+      }
+      handleRequest(r.hdr, r.req);
+    }
+  }
+
   static void requestHandler(rtMessageHeader const* hdr, uint8_t const* buff, uint32_t n,
     void* closure)
   {
@@ -130,29 +172,55 @@ private:
       // TODO: return error
     }
 
+    // the header only lives as long as this callback, workers get a copy
+    if (host->m_workers.empty())
+    {
+      host->handleRequest(*hdr, req);
+    }
+    else
+    {
+      Request r;
+      r.hdr = *hdr;
+      r.req = req;
+      {
+        std::unique_lock<std::mutex> lock(host->m_queueMutex);
+        host->m_queue.push_back(r);
+      }
+      host->m_queueCond.notify_one();
+    }
+  }
+
+  void handleRequest(rtMessageHeader const& hdr, rtMessage req)
+  {
     std::vector<dmQueryResult> results;
-    dmProviderOperation op = host->decodeOperation(req);
+    dmProviderOperation op = decodeOperation(req);
+    int32_t next = 0;
 
     if (op == dmProviderOperation_Get)
     {
       std::string providerName;
       std::vector<dmPropertyInfo> params;
-      host->decodeGetRequest(req, providerName, params);
-      host->doGet(providerName, params, results);
+      decodeGetRequest(req, providerName, params, next);
+      doGet(providerName, params, results);
     }
     else if (op == dmProviderOperation_Set)
     {
       std::string providerName;
       std::vector<dmNamedValue> params;
-      host->decodeSetRequest(req, providerName, params);
-      host->doSet(providerName, params, results);
+      decodeSetRequest(req, providerName, params);
+      doSet(providerName, params, results);
     }
 
     rtMessage res;
     rtMessage_Create(&res);
-    host->encodeResult(res, results);
-    rtConnection_SendResponse(m_con, hdr, res, 1000);
+    encodeResult(res, results);
+    if (next > 0)
+      rtMessage_SetInt32(res, "next", next);
+
+    // the connection serializes sends from the workers with its own
+    rtConnection_SendResponse(m_con, &hdr, res, 1000);
     rtMessage_Release(res);
+    rtMessage_Release(req);
   }
 
   dmProviderOperation decodeOperation(rtMessage req)
@@ -165,58 +233,142 @@ private:
       return dmProviderOperation_Get;
   }
 
-  void decodeGetRequest(rtMessage req, std::string& name, std::vector<dmPropertyInfo>& params)
+  // values are sent in their own type, older clients only send strings
+  bool decodeParam(rtMessage item, dmParams& params)
+  {
+    char const* propertyName = nullptr;
+    int32_t type = dmValueType_String;
+
+    if (rtMessage_GetString(item, "name", &propertyName) != RT_OK || !propertyName)
+      return false;
+    rtMessage_GetInt32(item, "type", &type);
+
+    if (type < 0 || type > dmValueType_Unknown)
+      type = dmValueType_String;
+
+    params.push_back(std::make_pair(std::string(propertyName),
+      dmValue::decode(item, "value", static_cast<dmValueType>(type))));
+    return true;
+  }
+
+  // params is an array of {name, type, value} items. Older clients send a single item
+  // as an object instead.
+  void decodeParams(rtMessage req, dmParams& params)
+  {
+    rtMessage item;
+    int32_t len = 0;
+    rtMessage_GetArrayLength(req, "params", &len);
+
+    for (int32_t i = 0; i < len; ++i)
+    {
+      if (rtMessage_GetMessageItem(req, "params", i, &item) != RT_OK)
+        break;
+
+      bool isItem = decodeParam(item, params);
+
+      // item borrows the json from req
+      free(item);
+      if (!isItem)
+        break;
+    }
+
+    if (params.empty())
+    {
+      if (rtMessage_GetMessage(req, "params", &item) == RT_OK)
+      {
+        decodeParam(item, params);
+        rtMessage_Release(item);
+      }
+      else
+      {
+        free(item);
+      }
+    }
+  }
+
+  // A wildcard on a list expands to every entry. Clients can page through long lists
+  // with "start" and "limit" (entries, 0 based), next is set to the entry the following
+  // page starts at if there are more.
+  void decodeGetRequest(rtMessage req, std::string& name, std::vector<dmPropertyInfo>& params,
+    int32_t& next)
   {
     char const* providerName = nullptr;
-    dmPropertyInfo propertyInfo;
+    int32_t start = 0;
+    int32_t limit = 0;
 
     rtMessage_GetString(req, "provider", &providerName);
     if (providerName)
       name = providerName;
 
-    rtMessage item;
-    rtMessage_GetMessage(req, "params", &item);
+    std::shared_ptr<dmProviderInfo> objectInfo = db->getProviderByName(name);
+    if (!objectInfo)
+    {
+      rtLog_Debug("decodeGetRequest object not found %s", name.c_str());
+      return;
+    }
 
-    char const* propertyName = nullptr;
-    rtMessage_GetString(item, "name", &propertyName);
+    rtLog_Debug("decodeGetRequest object found %s", name.c_str());
+
+    dmParams items;
+    decodeParams(req, items);
 
-    rtLog_Debug("decodeGetRequest property name=%s", (propertyName != nullptr ? propertyName : ""));
+    rtMessage_GetInt32(req, "start", &start);
+    rtMessage_GetInt32(req, "limit", &limit);
 
-    std::shared_ptr<dmProviderInfo> objectInfo = db->getProviderByName(providerName);
-    if (objectInfo)
+    for (auto const& item : items)
     {
-      rtLog_Debug("decodeGetRequest object found %s", providerName);
+      char const* propertyName = item.first.c_str();
+
+      rtLog_Debug("decodeGetRequest property name=%s", propertyName);
+
       if(objectInfo->isList())
       {
         uint32_t index;
         std::string indexlessPropertyName;
         if (dmUtility::parseListProperty(propertyName, index, indexlessPropertyName))
         {
+          // property infos share their descriptors, a copy is a pointer and an index
+          size_t first = params.size();
           if (dmUtility::isWildcard(indexlessPropertyName.c_str()))
-            params = objectInfo->properties();
+            params.insert(params.end(), objectInfo->properties().begin(), objectInfo->properties().end());
           else
             params.push_back(objectInfo->getPropertyInfo(indexlessPropertyName.c_str()));
-          
-          for(int i = 0; i < (int)params.size(); ++i)
+
+          for (size_t i = first; i < params.size(); ++i)
             params[i].setIndex(index-1);//index from 1 based to 0 based
         }
         else if (dmUtility::isWildcard(propertyName))
         {
-          auto itr = getProviders().find(providerName);
-          if (itr != getProviders().end())
+          dmProvider* provider = findProvider(name);
+          if (provider)
           {
-            size_t listSize = itr->second->getListSize();
-            std::vector<dmPropertyInfo> props = objectInfo->properties();
-            for (size_t i=0; i < listSize; ++i)
+            size_t listSize = 0;
+            {
+              std::unique_lock<std::mutex> lock = lockProvider(name);
+              listSize = provider->getListSize();
+            }
+            size_t first = (start > 0) ? static_cast<size_t>(start) : 0;
+            size_t last = listSize;
+            if (limit > 0 && first + limit < listSize)
+            {
+              last = first + limit;
+              next = static_cast<int32_t>(last);
+            }
+
+            std::vector<dmPropertyInfo> const& props = objectInfo->properties();
+            params.reserve(params.size() + props.size() * (last > first ? last - first : 0));
+            for (size_t i = first; i < last; ++i)
             {
-              for(size_t j = 0; j < props.size(); ++j)
-                props[j].setIndex(i);
-              params.insert(params.end(), props.begin(), props.end());
+              for (dmPropertyInfo const& propInfo : props)
+              {
+                params.push_back(propInfo);
+                params.back().setIndex(i);
+              }
             }
           }
           else
           {
-            rtLog_Debug("dmProviderHost::decodeGetRequest provider %s not found", providerName);
+            rtLog_Debug("dmProviderHost::decodeGetRequest provider %s not found", name.c_str());
           }
         }
         else
@@ -227,17 +379,14 @@ private:
       else
       {
         if (dmUtility::isWildcard(propertyName))
-          params = objectInfo->properties();
+        {
+          std::vector<dmPropertyInfo> const& props = objectInfo->properties();
+          params.insert(params.end(), props.begin(), props.end());
+        }
         else
           params.push_back(objectInfo->getPropertyInfo(propertyName));
       }
     }
-    else
-    {
-      rtLog_Debug("decodeGetRequest object not found %s", providerName);
-    }
-
-    rtMessage_Release(item);
   }
 
   void decodeSetRequest(rtMessage req, std::string& name, std::vector<dmNamedValue>& params)
@@ -248,61 +397,58 @@ private:
     if (providerName)
       name = providerName;
 
-    // TODO: need to handle multiple sets in single call
-
-    rtMessage item;
-    rtMessage_GetMessage(req, "params", &item);
-
-    char const* propertyName = nullptr;
-    rtMessage_GetString(item, "name", &propertyName);
+    std::shared_ptr<dmProviderInfo> objectInfo = db->getProviderByName(name);
+    if (!objectInfo)
+    {
+      rtLog_Debug("decodeSetRequest object not found %s", name.c_str());
+      return;
+    }
 
-    char const* value = nullptr;
-    rtMessage_GetString(item, "value", &value);
+    dmParams items;
+    decodeParams(req, items);
 
-    rtLog_Debug("decoderSetRequest property name=%s value=%s\n", (propertyName != nullptr ? propertyName : ""), (value != nullptr ? value : ""));
-    std::shared_ptr<dmProviderInfo> objectInfo = db->getProviderByName(providerName);
+    std::vector<dmPropertyInfo> const& props = objectInfo->properties();
 
-    if (objectInfo)
+    for (auto const& item : items)
     {
-      rtLog_Debug("decodeSetRequest object found %s", propertyName);
+      char const* propertyName = item.first.c_str();
+      dmValue const& value = item.second;
+
+      rtLog_Debug("decoderSetRequest property name=%s value=%s\n", propertyName, value.toString().c_str());
 
       std::string propertyLastName;
-      uint32_t index;
+      uint32_t index = 0;
 
       if(objectInfo->isList())
       {
         std::string indexlessPropertyName;
         dmUtility::parseListProperty(propertyName, index, indexlessPropertyName);
-        
+
         propertyLastName = dmUtility::trimPropertyName(indexlessPropertyName);
       }
       else
         propertyLastName = dmUtility::trimPropertyName(propertyName);
 
-      std::vector<dmPropertyInfo> props = objectInfo->properties();
-
       auto itr = std::find_if(
         props.begin(),
         props.end(),
-        [propertyLastName](dmPropertyInfo const& info) { 
+        [&propertyLastName](dmPropertyInfo const& info) { 
           rtLog_Debug("decodeSetRequest find_if %s compare to %s = %d\n", info.name().c_str(), propertyLastName.c_str(), (int)(info.name() == propertyLastName));
           return info.name() == propertyLastName; 
         });
 
       if (itr != props.end())
       {
+        dmPropertyInfo info = *itr;
         if(objectInfo->isList())
-          itr->setIndex(index-1);
-        params.push_back(makeNamedValue(*itr, value));
-
+          info.setIndex(index-1);
+        params.push_back(dmNamedValue(info, value));
+      }
+      else
+      {
+        rtLog_Debug("decodeSetRequest property not found %s", propertyName);
       }
     }
-    else
-    {
-      rtLog_Debug("decodeSetRequest object not found %s", providerName);
-    }
-
-    rtMessage_Release(item);
   }
 
   void encodeResult(rtMessage& res, std::vector<dmQueryResult> const& resultSet)
@@ -329,7 +475,8 @@ private:
           statusMessage = param.StatusMessage;
 
         rtMessage_SetString(msg, "name", param.Info.fullName().c_str());
-        rtMessage_SetString(msg, "value", param.Value.toString().c_str());
+        rtMessage_SetInt32(msg, "type", param.Value.type());
+        param.Value.encode(msg, "value");
       }
 
       rtMessage_SetInt32(msg, "index", result.index());
@@ -341,8 +488,20 @@ private:
   }
 
 private:
+  struct Request
+  {
+    rtMessageHeader hdr;
+    rtMessage req;
+  };
+
   std::unique_ptr<std::thread> m_thread;
   std::mutex m_mutex;
+  int m_numWorkers;
+  std::vector<std::thread> m_workers;
+  std::deque<Request> m_queue;
+  std::mutex m_queueMutex;
+  std::condition_variable m_queueCond;
+  bool m_stopping;
   static rtConnection m_con;
 };
 
@@ -356,7 +515,8 @@ dmProviderHost::create()
 }
 
 bool
-dmProviderHost::registerProvider(char const* object, std::unique_ptr<dmProvider> provider)
+dmProviderHost::registerProvider(char const* object, std::unique_ptr<dmProvider> provider,
+  bool threadSafe)
 {
   bool b = false;
   std::shared_ptr<dmProviderInfo> objectInfo = db->getProviderByObjectName(object); 
@@ -364,7 +524,14 @@ dmProviderHost::registerProvider(char const* object, std::unique_ptr<dmProvider>
   {
     b = providerRegistered(objectInfo->providerName());
     if (b)
+    {
+      provider->setProviderInfo(objectInfo);
+      std::unique_lock<std::mutex> lock(m_providersMutex);
+      if (!threadSafe)
+        m_providerLocks.insert(std::make_pair(objectInfo->providerName(),
+          std::unique_ptr<std::mutex>(new std::mutex())));
       m_providers.insert(std::make_pair(objectInfo->providerName(), std::move(provider)));
+    }
   }
   else
   {
@@ -377,11 +544,12 @@ void
 dmProviderHost::doGet(std::string const& providerName, std::vector<dmPropertyInfo> const& params,
     std::vector<dmQueryResult>& result)
 {
-  auto itr = m_providers.find(providerName);
-  if (itr != m_providers.end())
+  dmProvider* provider = findProvider(providerName);
+  if (provider)
   {
     rtLog_Debug("dmProviderHost::doGet %s found", providerName.c_str());
-    itr->second->doGet(params, result);
+    std::unique_lock<std::mutex> lock = lockProvider(providerName);
+    provider->doGet(params, result);
   }
   else
   {
@@ -393,14 +561,40 @@ void
 dmProviderHost::doSet(std::string const& providerName, std::vector<dmNamedValue> const& params,
     std::vector<dmQueryResult>& result)
 {
-  auto itr = m_providers.find(providerName);
-  if (itr != m_providers.end())
+  dmProvider* provider = findProvider(providerName);
+  if (provider)
   {
     rtLog_Debug("dmProviderHost::doSet %s found", providerName.c_str());
-    itr->second->doSet(params, result);
+    std::unique_lock<std::mutex> lock = lockProvider(providerName);
+    provider->doSet(params, result);
   }
   else
   {
     rtLog_Debug("dmProviderHost::doSet %s not found", providerName.c_str());
   }
 }
+
+dmProvider*
+dmProviderHost::findProvider(std::string const& providerName)
+{
+  std::unique_lock<std::mutex> lock(m_providersMutex);
+  auto itr = m_providers.find(providerName);
+  if (itr == m_providers.end())
+    return nullptr;
+  return itr->second.get();
+}
+
+std::unique_lock<std::mutex>
+dmProviderHost::lockProvider(std::string const& providerName)
+{
+  std::mutex* providerLock = nullptr;
+  {
+    std::unique_lock<std::mutex> lock(m_providersMutex);
+    auto itr = m_providerLocks.find(providerName);
+    if (itr != m_providerLocks.end())
+      providerLock = itr->second.get();
+  }
+  if (!providerLock)
+    return std::unique_lock<std::mutex>();
+  return std::unique_lock<std::mutex>(*providerLock);
+}
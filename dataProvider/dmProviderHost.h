@@ -58,11 +58,25 @@ public:
   virtual void stop() = 0;
   virtual void run() = 0;
 
+  /**
+   * Runs requests on a pool of numThreads workers instead of the dispatch thread, so
+   * a slow getter only holds up its own request. Responses go out as requests finish.
+   * The default of 0 handles requests one at a time on the dispatch thread. Call
+   * before start().
+   */
+  virtual void setWorkerThreads(int numThreads) = 0;
+
 public:
   static dmProviderHost* create();
 
 public:
-  bool registerProvider(char const* object, std::unique_ptr<dmProvider> provider);
+  /**
+   * Calls into a provider are serialized unless it's registered as threadSafe, which
+   * lets the worker threads run its getters and setters concurrently. Providers can
+   * be registered before or after start().
+   */
+  bool registerProvider(char const* object, std::unique_ptr<dmProvider> provider,
+    bool threadSafe = false);
 
 protected:
   virtual bool providerRegistered(std::string const& name) = 0;
@@ -73,12 +87,19 @@ protected:
   void doSet(std::string const& providerName, std::vector<dmNamedValue> const& params,
     std::vector<dmQueryResult>& result);
 
+  // held around every call into a provider that isn't thread safe
+  std::unique_lock<std::mutex> lockProvider(std::string const& providerName);
+
+  // providers are never removed, so what this returns stays valid
+  dmProvider* findProvider(std::string const& providerName);
+
   dmProviderDatabase* db;
 
-  const std::map< std::string, std::unique_ptr<dmProvider> >& getProviders() const
-    { return m_providers; }
 private:
+  // registerProvider may run while requests are being handled
+  std::mutex m_providersMutex;
   std::map< std::string, std::unique_ptr<dmProvider> > m_providers;
+  std::map< std::string, std::unique_ptr<std::mutex> > m_providerLocks;
   std::string m_providername;
 };
 
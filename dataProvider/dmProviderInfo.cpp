@@ -15,6 +15,8 @@
 #include "dmProviderInfo.h"
 #include "rtLog.h"
 
+#include <utility>
+
 dmProviderInfo::dmProviderInfo()
   : m_objectName()
   , m_providerName()
@@ -33,9 +35,10 @@ void dmProviderInfo::setObjectName(std::string const& name)
   m_objectName = name;
 }
 
-void dmProviderInfo::addProperty(dmPropertyInfo const& propInfo)
+void dmProviderInfo::addProperty(dmPropertyInfo propInfo)
 {
-  m_props.push_back(propInfo);
+  propInfo.setId(static_cast<uint32_t>(m_props.size()));
+  m_props.push_back(std::move(propInfo));
 }
 
 void dmProviderInfo::setIsList(bool isList)
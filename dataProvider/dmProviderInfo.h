@@ -21,11 +21,13 @@
 #include <vector>
 
 class dmProviderDatabase;
+class dmModelImage;
 class dmPropertyInfo;
 
 class dmProviderInfo
 {
   friend class dmProviderDatabase;
+  friend class dmModelImage;
 
 public:
   inline std::string const& objectName() const
@@ -46,7 +48,7 @@ private:
   dmProviderInfo();
   void setProviderName(std::string const& name);
   void setObjectName(std::string const& name);
-  void addProperty(dmPropertyInfo const& propInfo);
+  void addProperty(dmPropertyInfo propInfo);
   void setIsList(bool isList);
 
 private:
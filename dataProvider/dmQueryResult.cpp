@@ -22,6 +22,7 @@
 #include <stdio.h>
 #include <iostream>
 #include <string>
+#include <utility>
 
 static const int kDefaultQueryResult = RT_OK;
 
@@ -50,6 +51,25 @@ dmQueryResult::merge(dmQueryResult const& result)
     setStatusMsg(result.m_statusMsg);
 }
 
+void
+dmQueryResult::merge(dmQueryResult&& result)
+{
+  if (m_values.empty())
+  {
+    m_values = std::move(result.m_values);
+  }
+  else
+  {
+    m_values.insert(std::end(m_values), std::make_move_iterator(std::begin(result.m_values)),
+      std::make_move_iterator(std::end(result.m_values)));
+  }
+  result.m_values.clear();
+  if (m_status == 0 && result.m_status != 0)
+    m_status = result.m_status;
+  if (!result.m_statusMsg.empty())
+    setStatusMsg(result.m_statusMsg);
+}
+
 void
 dmQueryResult::setStatus(int status)
 {
@@ -63,11 +83,11 @@ dmQueryResult::setStatusMsg(std::string statusmsg)
 }
 
 void
-dmQueryResult::addValue(dmPropertyInfo const& prop, dmValue const& val, int code, 
+dmQueryResult::addValue(dmPropertyInfo const& prop, dmValue val, int code,
   char const* message)
 {
   m_status = code;
-  m_values.push_back(dmQueryResult::Param(code, message, val, prop));
+  m_values.emplace_back(code, message, std::move(val), prop);
 
   if (message)
   {
@@ -78,15 +98,21 @@ dmQueryResult::addValue(dmPropertyInfo const& prop, dmValue const& val, int code
 void dmQueryResult::updateFullNames()
 {
   for (auto& param : m_values)
-    if(m_index > 0)
-      param.fullName = dmUtility::getFullNameWithIndex(param.Info.fullName(), m_index);
+  {
+    // values from a batched request carry their own list index
+    int index = (param.Info.index() != static_cast<uint32_t>(-1))
+      ? static_cast<int>(param.Info.index()) + 1
+      : m_index;
+    if(index > 0)
+      param.fullName = dmUtility::getFullNameWithIndex(param.Info.fullName(), index);
     else
       param.fullName = param.Info.fullName();
+  }
 }
 
-dmQueryResult::Param::Param(int code, char const* msg, dmValue const& val, dmPropertyInfo const& info)
+dmQueryResult::Param::Param(int code, char const* msg, dmValue val, dmPropertyInfo const& info)
   : StatusCode(code)
-  , Value(val)
+  , Value(std::move(val))
   , Info(info)
 {
   if (msg)
@@ -29,7 +29,7 @@ class dmQueryResult
 public:
   struct Param
   {
-    Param(int code, char const* msg, dmValue const& val, dmPropertyInfo const& info);
+    Param(int code, char const* msg, dmValue val, dmPropertyInfo const& info);
 
     int StatusCode;
     std::string StatusMessage;
@@ -42,9 +42,12 @@ public:
 
   void clear();
   void merge(dmQueryResult const& resuls);
+  void merge(dmQueryResult&& results);
   void setStatus(int status);
   void setStatusMsg(std::string statusmsg);
-  void addValue(dmPropertyInfo const& prop, dmValue const& val, 
+
+  // val is moved into the result, pass temporaries or std::move to skip a copy
+  void addValue(dmPropertyInfo const& prop, dmValue val,
     int code = 0, char const* message = nullptr);
 
   inline int status() const
@@ -15,6 +15,9 @@
 #include "dmValue.h"
 
 #include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
 #include <sstream>
 #include <vector>
 
@@ -45,56 +48,158 @@ namespace
 
 dmValue::dmValue(bool b)
   : m_type(dmValueType_Boolean)
+  , m_length(0)
   , m_value(b) { }
 
 dmValue::dmValue(std::string const& s)
   : m_type(dmValueType_String)
-  , m_string(s) { }
+  , m_length(0)
+{
+  setString(s.data(), s.size());
+}
 
 dmValue::dmValue(char const* s)
   : m_type(dmValueType_String)
-  , m_string(s) { }
+  , m_length(0)
+{
+  setString(s, s ? strlen(s) : 0);
+}
 
 dmValue::dmValue(int8_t n)
   : m_type(dmValueType_Int8)
+  , m_length(0)
   , m_value(n) { }
 
 dmValue::dmValue(int16_t n)
   : m_type(dmValueType_Int16)
+  , m_length(0)
   , m_value(n) { }
 
 dmValue::dmValue(int32_t n)
   : m_type(dmValueType_Int32)
+  , m_length(0)
   , m_value(n) { }
 
 dmValue::dmValue(int64_t n)
   : m_type(dmValueType_Int64)
+  , m_length(0)
   , m_value(n) { }
 
 dmValue::dmValue(uint8_t n)
   : m_type(dmValueType_UInt8)
+  , m_length(0)
   , m_value(n) { }
 
 dmValue::dmValue(uint16_t n)
   : m_type(dmValueType_UInt16)
+  , m_length(0)
   , m_value(n) { }
 
 dmValue::dmValue(uint32_t n)
   : m_type(dmValueType_UInt32)
+  , m_length(0)
   , m_value(n) { }
 
 dmValue::dmValue(uint64_t n)
   : m_type(dmValueType_UInt64)
+  , m_length(0)
   , m_value(n) { }
 
 dmValue::dmValue(float f)
   : m_type(dmValueType_Single)
+  , m_length(0)
   , m_value(f) { }
 
 dmValue::dmValue(double d)
   : m_type(dmValueType_Double)
+  , m_length(0)
   , m_value(d) { }
 
+dmValue::dmValue(dmValue const& rhs)
+  : m_type(rhs.m_type)
+  , m_length(0)
+{
+  if (rhs.m_type == dmValueType_String)
+    setString(rhs.stringData(), rhs.m_length);
+  else
+    m_value = rhs.m_value;
+}
+
+dmValue::dmValue(dmValue&& rhs) noexcept
+  : m_type(rhs.m_type)
+  , m_length(0)
+{
+  moveFrom(rhs);
+}
+
+dmValue::~dmValue()
+{
+  release();
+}
+
+dmValue&
+dmValue::operator=(dmValue const& rhs)
+{
+  if (this != &rhs)
+  {
+    release();
+    m_type = rhs.m_type;
+    m_length = 0;
+    if (rhs.m_type == dmValueType_String)
+      setString(rhs.stringData(), rhs.m_length);
+    else
+      m_value = rhs.m_value;
+  }
+  return *this;
+}
+
+dmValue&
+dmValue::operator=(dmValue&& rhs) noexcept
+{
+  if (this != &rhs)
+  {
+    release();
+    m_type = rhs.m_type;
+    moveFrom(rhs);
+  }
+  return *this;
+}
+
+void
+dmValue::setString(char const* s, size_t n)
+{
+  m_length = static_cast<uint32_t>(n);
+  char* p = m_value.inlineString;
+  if (isHeapString())
+  {
+    p = new char[n + 1];
+    m_value.heapString = p;
+  }
+  if (n)
+    memcpy(p, s, n);
+  p[n] = '\0';
+}
+
+void
+dmValue::release()
+{
+  if (isHeapString())
+    delete [] m_value.heapString;
+}
+
+// takes rhs's string buffer, rhs is left an empty string
+void
+dmValue::moveFrom(dmValue& rhs)
+{
+  m_length = rhs.m_length;
+  m_value = rhs.m_value;
+  if (rhs.m_type == dmValueType_String)
+  {
+    rhs.m_length = 0;
+    rhs.m_value.inlineString[0] = '\0';
+  }
+}
+
 std::string
 dmValue::toString() const
 {
@@ -108,10 +213,9 @@ dmValue::toString() const
       buff << "(null)";
       break;
     case dmValueType_String:
-      buff.str(m_string);
-      break;
+      return std::string(stringData(), m_length);
     case dmValueType_Int8:
-      buff << m_value.int8Value;
+      buff << static_cast<int>(m_value.int8Value);
       break;
     case dmValueType_Int16:
       buff << m_value.int16Value;
@@ -123,7 +227,7 @@ dmValue::toString() const
       buff << m_value.int64Value;
       break;
     case dmValueType_UInt8:
-      buff << m_value.uint8Value;
+      buff << static_cast<unsigned>(m_value.uint8Value);
       break;
     case dmValueType_UInt16:
       buff << m_value.uint16Value;
@@ -144,6 +248,218 @@ dmValue::toString() const
   return buff.str();
 }
 
+dmValue
+dmValue::fromString(dmValueType t, std::string const& s)
+{
+  char const* p = s.c_str();
+  char* end = nullptr;
+  errno = 0;
+
+  switch (t)
+  {
+    case dmValueType_Int8:
+    case dmValueType_Int16:
+    case dmValueType_Int32:
+    case dmValueType_Int64:
+    {
+      long long n = strtoll(p, &end, 10);
+      if (errno != 0 || end == p || *end != '\0')
+        break;
+      if (t == dmValueType_Int8)
+        return dmValue(static_cast<int8_t>(n));
+      if (t == dmValueType_Int16)
+        return dmValue(static_cast<int16_t>(n));
+      if (t == dmValueType_Int32)
+        return dmValue(static_cast<int32_t>(n));
+      return dmValue(static_cast<int64_t>(n));
+    }
+    case dmValueType_UInt8:
+    case dmValueType_UInt16:
+    case dmValueType_UInt32:
+    case dmValueType_UInt64:
+    {
+      unsigned long long n = strtoull(p, &end, 10);
+      if (errno != 0 || end == p || *end != '\0' || *p == '-')
+        break;
+      if (t == dmValueType_UInt8)
+        return dmValue(static_cast<uint8_t>(n));
+      if (t == dmValueType_UInt16)
+        return dmValue(static_cast<uint16_t>(n));
+      if (t == dmValueType_UInt32)
+        return dmValue(static_cast<uint32_t>(n));
+      return dmValue(static_cast<uint64_t>(n));
+    }
+    case dmValueType_Single:
+    {
+      float f = strtof(p, &end);
+      if (errno != 0 || end == p || *end != '\0')
+        break;
+      return dmValue(f);
+    }
+    case dmValueType_Double:
+    {
+      double d = strtod(p, &end);
+      if (errno != 0 || end == p || *end != '\0')
+        break;
+      return dmValue(d);
+    }
+    case dmValueType_Boolean:
+      if (s == "true" || s == "1")
+        return dmValue(true);
+      if (s == "false" || s == "0")
+        return dmValue(false);
+      break;
+    case dmValueType_String:
+    case dmValueType_Unknown:
+      break;
+  }
+  return dmValue(s);
+}
+
+void
+dmValue::encode(rtMessage m, char const* name) const
+{
+  switch (m_type)
+  {
+    case dmValueType_Boolean:
+      rtMessage_SetBool(m, name, m_value.booleanValue);
+      break;
+    case dmValueType_Int8:
+      rtMessage_SetInt32(m, name, m_value.int8Value);
+      break;
+    case dmValueType_Int16:
+      rtMessage_SetInt32(m, name, m_value.int16Value);
+      break;
+    case dmValueType_Int32:
+      rtMessage_SetInt32(m, name, m_value.int32Value);
+      break;
+    case dmValueType_Int64:
+      rtMessage_SetInt64(m, name, m_value.int64Value);
+      break;
+    case dmValueType_UInt8:
+      rtMessage_SetInt32(m, name, m_value.uint8Value);
+      break;
+    case dmValueType_UInt16:
+      rtMessage_SetInt32(m, name, m_value.uint16Value);
+      break;
+    case dmValueType_UInt32:
+      rtMessage_SetUInt64(m, name, m_value.uint32Value);
+      break;
+    case dmValueType_UInt64:
+      rtMessage_SetUInt64(m, name, m_value.uint64Value);
+      break;
+    case dmValueType_Single:
+      rtMessage_SetDouble(m, name, m_value.singleValue);
+      break;
+    case dmValueType_Double:
+      rtMessage_SetDouble(m, name, m_value.doubleValue);
+      break;
+    case dmValueType_String:
+      rtMessage_SetString(m, name, stringData());
+      break;
+    case dmValueType_Unknown:
+      rtMessage_SetString(m, name, toString().c_str());
+      break;
+  }
+}
+
+dmValue
+dmValue::decode(rtMessage const m, char const* name, dmValueType t)
+{
+  // rtMessage_GetString doesn't check the type, it's null for anything but a string
+  char const* s = nullptr;
+  if (rtMessage_GetString(m, name, &s) == RT_OK && s)
+    return fromString(t, s);
+
+  switch (t)
+  {
+    case dmValueType_Boolean:
+    {
+      bool b = false;
+      if (rtMessage_GetBool(m, name, &b) == RT_OK)
+        return dmValue(b);
+      break;
+    }
+    case dmValueType_Int8:
+    case dmValueType_Int16:
+    case dmValueType_Int32:
+    case dmValueType_Int64:
+    {
+      int64_t n = 0;
+      if (rtMessage_GetInt64(m, name, &n) != RT_OK)
+        break;
+      if (t == dmValueType_Int8)
+        return dmValue(static_cast<int8_t>(n));
+      if (t == dmValueType_Int16)
+        return dmValue(static_cast<int16_t>(n));
+      if (t == dmValueType_Int32)
+        return dmValue(static_cast<int32_t>(n));
+      return dmValue(n);
+    }
+    case dmValueType_UInt8:
+    case dmValueType_UInt16:
+    case dmValueType_UInt32:
+    case dmValueType_UInt64:
+    {
+      uint64_t n = 0;
+      if (rtMessage_GetUInt64(m, name, &n) != RT_OK)
+        break;
+      if (t == dmValueType_UInt8)
+        return dmValue(static_cast<uint8_t>(n));
+      if (t == dmValueType_UInt16)
+        return dmValue(static_cast<uint16_t>(n));
+      if (t == dmValueType_UInt32)
+        return dmValue(static_cast<uint32_t>(n));
+      return dmValue(n);
+    }
+    case dmValueType_Single:
+    case dmValueType_Double:
+    {
+      double d = 0;
+      if (rtMessage_GetDouble(m, name, &d) != RT_OK)
+        break;
+      if (t == dmValueType_Single)
+        return dmValue(static_cast<float>(d));
+      return dmValue(d);
+    }
+    case dmValueType_String:
+    case dmValueType_Unknown:
+      break;
+  }
+  return dmValue("");
+}
+
+int64_t
+dmValue::toInt64() const
+{
+  switch (m_type)
+  {
+    case dmValueType_Boolean:
+      return m_value.booleanValue ? 1 : 0;
+    case dmValueType_Int8:
+      return m_value.int8Value;
+    case dmValueType_Int16:
+      return m_value.int16Value;
+    case dmValueType_Int32:
+      return m_value.int32Value;
+    case dmValueType_Int64:
+      return m_value.int64Value;
+    case dmValueType_UInt8:
+      return m_value.uint8Value;
+    case dmValueType_UInt16:
+      return m_value.uint16Value;
+    case dmValueType_UInt32:
+      return m_value.uint32Value;
+    case dmValueType_UInt64:
+      return static_cast<int64_t>(m_value.uint64Value);
+    case dmValueType_String:
+      return strtoll(stringData(), nullptr, 10);
+    default:
+      break;
+  }
+  return 0;
+}
+
 dmValueType
 dmValueType_fromString(char const* s)
 {
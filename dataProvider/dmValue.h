@@ -19,9 +19,17 @@
 #include <stdint.h>
 #include <memory>
 #include <string>
+#include <utility>
 #include "dmValueType.h"
 #include "dmPropertyInfo.h"
 
+#include <rtMessage.h>
+
+/**
+ * A tagged union of the data model types. Strings up to kInlineStringCapacity
+ * characters are kept inside the value, only longer ones are allocated, so most
+ * values are copied without touching the heap.
+ */
 class dmValue
 {
 public:
@@ -39,8 +47,36 @@ public:
   dmValue(double d);
   dmValue(bool b);
 
+  dmValue(dmValue const& rhs);
+  dmValue(dmValue&& rhs) noexcept;
+  ~dmValue();
+
+  dmValue& operator=(dmValue const& rhs);
+  dmValue& operator=(dmValue&& rhs) noexcept;
+
   std::string toString() const;
 
+  /**
+   * Parses s as a value of type t. Strings that aren't a t stay strings.
+   */
+  static dmValue fromString(dmValueType t, std::string const& s);
+
+  /**
+   * Writes the value to field name of m as a json number, boolean or string
+   * instead of formatting it. 64 bit integers keep their precision.
+   */
+  void encode(rtMessage m, char const* name) const;
+
+  /**
+   * Reads a field written by encode(). Strings, e.g. from older peers, are parsed as t.
+   */
+  static dmValue decode(rtMessage const m, char const* name, dmValueType t);
+
+  /**
+   * Integers and booleans as an int64, strings are parsed. 0 for anything else.
+   */
+  int64_t toInt64() const;
+
   inline dmValueType type() const
     { return m_type; }
 
@@ -48,6 +84,18 @@ public:
     { return m_value.uint32Value; }
 
 private:
+  enum { kInlineStringCapacity = 15 };
+
+  void setString(char const* s, size_t n);
+  void release();
+  void moveFrom(dmValue& rhs);
+
+  inline bool isHeapString() const
+    { return m_type == dmValueType_String && m_length > kInlineStringCapacity; }
+
+  inline char const* stringData() const
+    { return isHeapString() ? m_value.heapString : m_value.inlineString; }
+
   union value {
     value() { }
     value(int8_t n) : int8Value(n) { }
@@ -72,19 +120,21 @@ private:
     float       singleValue;
     double      doubleValue;
     bool        booleanValue;
+    char        inlineString[kInlineStringCapacity + 1];
+    char*       heapString;
   };
 
   dmValueType   m_type;
-  std::string   m_string;
+  uint32_t      m_length; // strings only
   value         m_value;
 };
 
 class dmNamedValue
 {
 public:
-  dmNamedValue(dmPropertyInfo prop, dmValue const& value)
-    : m_prop(prop)
-    , m_value(value) 
+  dmNamedValue(dmPropertyInfo prop, dmValue value)
+    : m_prop(std::move(prop))
+    , m_value(std::move(value))
   {
   }
 
@@ -18,6 +18,7 @@
 #include <getopt.h>
 #include <iostream>
 #include <string>
+#include <vector>
 #include <algorithm>
 #include "dmClient.h"
 
@@ -37,7 +38,7 @@ void print_help()
   printf("\n");
 }
 
-//for non-list query, expect a single onResult or onError
+//parameters are batched per provider, expect a single onResult or onError for each batch
 //for lists, 1 query per list item is made so expect onResult or onError for each item in the list
 class Notifier : public dmClientNotifier
 {
@@ -157,6 +158,7 @@ int main(int argc, char *argv[])
 
   size_t begin = 0;
   size_t end = 0;
+  std::vector<std::string> params;
 
   while (begin != std::string::npos)
   {
@@ -168,12 +170,16 @@ int main(int argc, char *argv[])
       return ::isspace(c);
     }), token.end());
 
-    Notifier notifier;
-    client->runQuery(op, token, &notifier);
+    if (!token.empty())
+      params.push_back(token);
 
     begin = end == std::string::npos ? std::string::npos : end + 1;
   }
 
+  // one request per provider
+  Notifier notifier;
+  client->runQuery(op, params, &notifier);
+
   dmClient::destroy(client);
 
   return exit_code;
@@ -18,13 +18,17 @@
 #include "rtError.h"
 #include "rtLog.h"
 #include "rtMessageHeader.h"
+#include "rtShm.h"
 #include "rtSocket.h"
+#include "rtTopic.h"
 
 #include <arpa/inet.h>
 #include <errno.h>
 #include <fcntl.h>
 #include <netinet/in.h>
 #include <netinet/tcp.h>
+#include <poll.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -33,6 +37,10 @@
 
 #define RTMSG_LISTENERS_MAX 64
 #define RTMSG_SEND_BUFFER_SIZE (1024 * 8)
+#define RTMSG_HELLO_MAX_PEEKS 16
+#define RTMSG_HELLO_TOPIC "_RTROUTED.HELLO"
+#define RTMSG_SHM_SEND_TIMEOUT 1000
+#define RTMSG_SHARED_PAYLOAD_THRESHOLD (64 * 1024)
 
 struct _rtListener
 {
@@ -43,19 +51,38 @@ struct _rtListener
   rtMessageCallback       callback;
 };
 
+struct _rtTopicAlias
+{
+  uint32_t                hash;
+  uint32_t                topic_length;
+  char*                   topic;
+};
+
 struct _rtConnection
 {
   int                     fd;
+  int                     use_shm;
+  rtShmChannel            shm;
   struct sockaddr_storage local_endpoint;
   struct sockaddr_storage remote_endpoint;
   uint8_t*                send_buffer;
   uint8_t*                recv_buffer;
+  uint32_t                recv_buffer_capacity;
   uint32_t                sequence_number;
   char*                   application_name;
   rtConnectionState       state;
+  uint16_t                header_version;
+  int                     hello_peeks;
+  int                     dispatching;
   char                    inbox_name[RTMSG_HEADER_MAX_TOPIC_LENGTH];
   struct _rtListener      listeners[RTMSG_LISTENERS_MAX];
   rtMessage               response;
+  struct _rtTopicAlias    topic_aliases[RTMSG_HEADER_MAX_TOPIC_ALIASES];
+  uint32_t                num_topic_aliases;
+  int                     trace;
+  rtHistogram             latency[rtConnectionLatency_Count];
+  pthread_mutex_t         latency_mutex;
+  pthread_mutex_t         send_mutex;
 };
 
 static void onInboxMessage(rtMessageHeader const* hdr, uint8_t const* p, uint32_t n, void* closure)
@@ -76,6 +103,156 @@ static rtError rtConnection_SendInternal(rtConnection con, char const* topic,
   uint8_t const* buff, uint32_t n, char const* reply_topic, int flags);
   
 
+static rtError
+rtConnection_SendSubscribe(rtConnection con, struct _rtListener const* listener)
+{
+  rtError err;
+  rtMessage m;
+  rtMessage_Create(&m);
+  rtMessage_SetString(m, "topic", listener->expression);
+  rtMessage_SetInt32(m, "route_id", listener->subscription_id);
+  // tell the router we can decode compact headers, it answers in kind
+  rtMessage_SetInt32(m, "header_version", RTMSG_HEADER_MAX_VERSION);
+  // and that we can map shared payloads if we turn out to be local
+  rtMessage_SetInt32(m, "shared_payload", 1);
+  err = rtConnection_SendMessage(con, m, "_RTROUTED.INBOX.SUBSCRIBE");
+  rtMessage_Release(m);
+  return err;
+}
+
+static void
+rtConnection_OnRouterHello(rtConnection con, uint8_t const* p, uint32_t n)
+{
+  int32_t header_version = 0;
+  rtMessage m;
+
+  con->hello_peeks = 0;
+  if (rtMessage_FromBytes(&m, p, n) != RT_OK)
+    return;
+
+  if (rtMessage_GetInt32(m, "header_version", &header_version) == RT_OK)
+  {
+    if (header_version > RTMSG_HEADER_MAX_VERSION)
+      header_version = RTMSG_HEADER_MAX_VERSION;
+    if (header_version > con->header_version)
+      con->header_version = (uint16_t) header_version;
+  }
+  rtMessage_Release(m);
+}
+
+// Newer routers greet each connection with a small v1 hello before anything else.
+// A client that only publishes never dispatches, so look for it without blocking
+// before the first few sends. Anything else at the head of the stream means an
+// older router and the connection stays on v1. Once anyone has dispatched the
+// stream belongs to the reader, which takes the hello itself, so this only runs
+// before then. Called with the send lock held.
+static void
+rtConnection_PeekRouterHello(rtConnection con)
+{
+  ssize_t n;
+  uint32_t length;
+  uint8_t buff[256];
+  rtMessageHeaderView hdr;
+
+  con->hello_peeks--;
+
+  n = recv(con->fd, buff, sizeof(buff) - 1, MSG_PEEK | MSG_DONTWAIT);
+  if (n < RTMSG_HEADER_PREAMBLE_LENGTH)
+    return;
+
+  if (rtMessageHeaderView_Decode(&hdr, buff, (uint32_t) n) != RT_OK)
+  {
+    // not all there yet, or not a hello we can decode
+    if (n == sizeof(buff) - 1)
+      con->hello_peeks = 0;
+    return;
+  }
+
+  if (hdr.topic_length != strlen(RTMSG_HELLO_TOPIC) ||
+      memcmp(hdr.topic, RTMSG_HELLO_TOPIC, hdr.topic_length) != 0)
+  {
+    con->hello_peeks = 0;
+    return;
+  }
+
+  length = hdr.header_length + hdr.payload_length;
+  if (length > (uint32_t) n)
+  {
+    if (length >= sizeof(buff))
+      con->hello_peeks = 0;
+    return;
+  }
+
+  if (recv(con->fd, buff, length, MSG_DONTWAIT) != (ssize_t) length)
+  {
+    con->hello_peeks = 0;
+    return;
+  }
+
+  buff[length] = '\0';
+  rtConnection_OnRouterHello(con, buff + hdr.header_length, hdr.payload_length);
+}
+
+static void
+rtConnection_ClearTopicAliases(rtConnection con)
+{
+  uint32_t i;
+  for (i = 0; i < con->num_topic_aliases; ++i)
+    free(con->topic_aliases[i].topic);
+  con->num_topic_aliases = 0;
+}
+
+// The first send on a topic binds the next free alias, later sends only carry the
+// alias and the router skips matching. Once the table is full new topics are sent
+// in full.
+static void
+rtConnection_SetTopicAlias(rtConnection con, rtMessageHeaderView* hdr)
+{
+  uint32_t i;
+  uint32_t hash;
+  struct _rtTopicAlias* alias;
+
+  if (con->header_version < RTMSG_HEADER_VERSION_2)
+    return;
+
+  hash = rtTopic_Hash(hdr->topic, hdr->topic_length);
+  for (i = 0; i < con->num_topic_aliases; ++i)
+  {
+    alias = &con->topic_aliases[i];
+    if (alias->hash == hash && alias->topic_length == hdr->topic_length &&
+        memcmp(alias->topic, hdr->topic, hdr->topic_length) == 0)
+    {
+      hdr->flags |= rtMessageFlags_TopicAlias;
+      hdr->topic_alias = i + 1;
+      hdr->topic = "";
+      hdr->topic_length = 0;
+      return;
+    }
+  }
+
+  if (con->num_topic_aliases >= RTMSG_HEADER_MAX_TOPIC_ALIASES)
+    return;
+
+  alias = &con->topic_aliases[con->num_topic_aliases++];
+  alias->hash = hash;
+  alias->topic_length = hdr->topic_length;
+  alias->topic = strdup(hdr->topic);
+  hdr->flags |= rtMessageFlags_TopicAlias;
+  hdr->topic_alias = con->num_topic_aliases;
+}
+
+// Anything that writes to the socket or the ring, or replaces them, holds this.
+// Recursive because a reconnect re-sends every subscription.
+static void
+rtConnection_InitSendMutex(rtConnection con)
+{
+  pthread_mutexattr_t attr;
+  pthread_mutexattr_init(&attr);
+  pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+  pthread_mutex_init(&con->send_mutex, &attr);
+  pthread_mutexattr_destroy(&attr);
+}
+
 static uint32_t
 rtConnection_GetNextSubscriptionId()
 {
@@ -88,6 +265,8 @@ rtConnection_ShouldReregister(rtError e)
 {
   if (rtErrorFromErrno(ENOTCONN) == e) return 1;
   if (rtErrorFromErrno(EPIPE) == e) return 1;
+  // a malformed header leaves the stream out of sync, start over
+  if (RT_ERROR_PROTOCOL_ERROR == e) return 1;
   return 0;
 }
 
@@ -104,6 +283,17 @@ rtConnection_ConnectAndRegister(rtConnection con)
 
   if (con->fd != -1)
     close(con->fd);
+  if (con->shm)
+  {
+    rtShmChannel_Destroy(con->shm);
+    con->shm = NULL;
+  }
+
+  // the router may have been replaced, don't assume it understands v2 and forget
+  // any aliases the old one knew about
+  con->header_version = RTMSG_HEADER_VERSION_1;
+  con->hello_peeks = RTMSG_HELLO_MAX_PEEKS;
+  rtConnection_ClearTopicAliases(con);
 
   rtLog_Info("connecting to router");
   con->fd = socket(con->remote_endpoint.ss_family, SOCK_STREAM, 0);
@@ -134,6 +324,17 @@ rtConnection_ConnectAndRegister(rtConnection con)
 
   rtSocket_GetLocalEndpoint(con->fd, &con->local_endpoint);
 
+  // only routers that speak v2 hand out shared memory, and they say hello on the
+  // ring rather than the socket
+  if (con->use_shm)
+  {
+    rtError err = rtShmChannel_Open(&con->shm, con->fd);
+    if (err != RT_OK)
+      return err;
+    con->header_version = RTMSG_HEADER_MAX_VERSION;
+    con->hello_peeks = 0;
+  }
+
   {
     uint16_t local_port;
     uint16_t remote_port;
@@ -148,14 +349,7 @@ rtConnection_ConnectAndRegister(rtConnection con)
   for (i = 0; i < RTMSG_LISTENERS_MAX; ++i)
   {
     if (con->listeners[i].in_use)
-    {
-      rtMessage m;
-      rtMessage_Create(&m);
-      rtMessage_SetString(m, "topic", con->listeners[i].expression);
-      rtMessage_SetInt32(m, "route_id", con->listeners[i].subscription_id);
-      rtConnection_SendMessage(con, m, "_RTROUTED.INBOX.SUBSCRIBE");
-      rtMessage_Release(m);
-    }
+      rtConnection_SendSubscribe(con, &con->listeners[i]);
   }
 
   return RT_OK;
@@ -180,6 +374,48 @@ rtConnection_EnsureRoutingDaemon()
   return RT_OK;
 }
 
+// The socket is only watched for the router going away, everything else arrives
+// on the ring.
+static rtError
+rtConnection_ReadShm(rtConnection con, uint8_t* buff, int count)
+{
+  ssize_t bytes_read = 0;
+  ssize_t bytes_to_read = count;
+
+  while (bytes_read < bytes_to_read)
+  {
+    char c;
+    struct pollfd fds[2];
+    ssize_t n = rtShmChannel_Read(con->shm, buff + bytes_read, (bytes_to_read - bytes_read));
+    if (n > 0)
+    {
+      bytes_read += n;
+      continue;
+    }
+
+    fds[0].fd = rtShmChannel_GetFd(con->shm);
+    fds[0].events = POLLIN;
+    fds[1].fd = con->fd;
+    fds[1].events = POLLIN;
+    if (poll(fds, 2, -1) == -1)
+    {
+      if (errno == EINTR)
+        continue;
+      return rtErrorFromErrno(errno);
+    }
+
+    if (fds[1].revents && recv(con->fd, &c, 1, MSG_PEEK | MSG_DONTWAIT) == 0)
+    {
+      rtLog_Error("Failed to read error : %s", rtStrError(rtErrorFromErrno(ENOTCONN)));
+      return rtErrorFromErrno(ENOTCONN);
+    }
+
+    if (fds[0].revents)
+      rtShmChannel_ClearEvent(con->shm);
+  }
+  return RT_OK;
+}
+
 static rtError
 rtConnection_ReadUntil(rtConnection con, uint8_t* buff, int count, int32_t timeout)
 {
@@ -188,6 +424,9 @@ rtConnection_ReadUntil(rtConnection con, uint8_t* buff, int count, int32_t timeo
 
   (void) timeout;
 
+  if (con->shm)
+    return rtConnection_ReadShm(con, buff, count);
+
   while (bytes_read < bytes_to_read)
   {
     fd_set read_fds;
@@ -254,9 +493,20 @@ rtConnection_Create(rtConnection* con, char const* application_name, char const*
   c->response = NULL;
   c->send_buffer = (uint8_t *) malloc(RTMSG_SEND_BUFFER_SIZE);
   c->recv_buffer = (uint8_t *) malloc(RTMSG_SEND_BUFFER_SIZE);
+  c->recv_buffer_capacity = RTMSG_SEND_BUFFER_SIZE;
   c->sequence_number = 1;
   c->application_name = strdup(application_name);
   c->fd = -1;
+  c->use_shm = (strncmp(router_config, "shm://", 6) == 0);
+  c->shm = NULL;
+  c->header_version = RTMSG_HEADER_VERSION_1;
+  c->hello_peeks = 0;
+  c->dispatching = 0;
+  c->num_topic_aliases = 0;
+  c->trace = 0;
+  rtConnection_InitSendMutex(c);
+  memset(c->latency, 0, sizeof(c->latency));
+  pthread_mutex_init(&c->latency_mutex, NULL);
   memset(c->inbox_name, 0, RTMSG_HEADER_MAX_TOPIC_LENGTH);
   memset(&c->local_endpoint, 0, sizeof(struct sockaddr_storage));
   memset(&c->remote_endpoint, 0, sizeof(struct sockaddr_storage));
@@ -268,6 +518,8 @@ rtConnection_Create(rtConnection* con, char const* application_name, char const*
   if (err != RT_OK)
   {
     rtLog_Warn("failed to parse:%s. %s", router_config, rtStrError(err));
+    pthread_mutex_destroy(&c->latency_mutex);
+    pthread_mutex_destroy(&c->send_mutex);
     free(c);
     return err;
   }
@@ -289,6 +541,8 @@ rtConnection_Create(rtConnection* con, char const* application_name, char const*
 rtError
 rtConnection_Destroy(rtConnection con)
 {
+  int i;
+
   if (con)
   {
     if (con->fd != -1)
@@ -296,12 +550,19 @@ rtConnection_Destroy(rtConnection con)
       shutdown(con->fd, SHUT_RDWR);
       close(con->fd);
     }
+    if (con->shm)
+      rtShmChannel_Destroy(con->shm);
     if (con->send_buffer)
       free(con->send_buffer);
     if (con->recv_buffer)
       free(con->recv_buffer);
     if (con->application_name)
       free(con->application_name);
+    rtConnection_ClearTopicAliases(con);
+    for (i = 0; i < rtConnectionLatency_Count; ++i)
+      rtHistogram_Destroy(con->latency[i]);
+    pthread_mutex_destroy(&con->latency_mutex);
+    pthread_mutex_destroy(&con->send_mutex);
     free(con);
   }
   return 0;
@@ -314,6 +575,7 @@ rtConnection_SendErrorMessageToCaller(int clnt_fd ,rtMessageHeader const* reques
     memset(t_con,0,sizeof(struct _rtConnection));
  
     t_con->fd = clnt_fd;
+    t_con->header_version = RTMSG_HEADER_VERSION_1;
     t_con->send_buffer = (uint8_t *) malloc(RTMSG_SEND_BUFFER_SIZE);
     t_con->recv_buffer = (uint8_t *) malloc(RTMSG_SEND_BUFFER_SIZE);
     memset(t_con->send_buffer, 0, RTMSG_SEND_BUFFER_SIZE);
@@ -338,6 +600,9 @@ rtConnection_SendErrorMessageToCaller(int clnt_fd ,rtMessageHeader const* reques
     rtConnection_SendResponse(t_con, &new_header, res, 1000);
     rtMessage_Release(msg);
     rtMessage_Release(res);
+    free(t_con->send_buffer);
+    free(t_con->recv_buffer);
+    free(t_con);
     return RT_OK;
 }
 rtError
@@ -419,6 +684,26 @@ rtConnection_SendRequest(rtConnection con, rtMessage const req, char const* topi
   return RT_ERROR_TIMEOUT;
 }
 
+// A full ring only means the router is busy unless the socket has closed too.
+static rtError
+rtConnection_SendShm(rtConnection con, uint8_t const* hdr, uint32_t hdr_length,
+  uint8_t const* buff, uint32_t n)
+{
+  char c;
+  rtError err;
+  struct iovec iov[2];
+
+  iov[0].iov_base = (void *) hdr;
+  iov[0].iov_len = hdr_length;
+  iov[1].iov_base = (void *) buff;
+  iov[1].iov_len = n;
+
+  err = rtShmChannel_Write(con->shm, iov, 2, RTMSG_SHM_SEND_TIMEOUT);
+  if (err == RT_ERROR_TIMEOUT && recv(con->fd, &c, 1, MSG_PEEK | MSG_DONTWAIT) == 0)
+    err = rtErrorFromErrno(ENOTCONN);
+  return err;
+}
+
 rtError
 rtConnection_SendInternal(rtConnection con, char const* topic, uint8_t const* buff,
   uint32_t n, char const* reply_topic, int flags)
@@ -427,54 +712,92 @@ rtConnection_SendInternal(rtConnection con, char const* topic, uint8_t const* bu
   int num_attempts;
   int max_attempts;
   ssize_t bytes_sent;
-  rtMessageHeader header;
+  uint8_t const* payload;
+  rtShmSlab slab;
+  rtMessageHeaderView header;
 
   max_attempts = 2;
   num_attempts = 0;
+  slab = NULL;
 
-  rtMessageHeader_Init(&header);
-  header.payload_length = n;
-
-  strcpy(header.topic, topic);
-  header.topic_length = strlen(header.topic);
+  rtMessageHeaderView_Init(&header);
   if (reply_topic)
   {
-    strcpy(header.reply_topic, reply_topic);
+    header.reply_topic = reply_topic;
     header.reply_topic_length = strlen(reply_topic);
   }
-  else
-  {
-    header.reply_topic[0] = '\0';
-    header.reply_topic_length = 0;
-  }
-  header.sequence_number = con->sequence_number++;
-  header.flags = flags;
 
-  err = rtMessageHeader_Encode(&header, con->send_buffer);
-  if (err != RT_OK)
-    return err;
+  pthread_mutex_lock(&con->send_mutex);
+  header.sequence_number = con->sequence_number++;
 
   do
   {
-    bytes_sent = send(con->fd, con->send_buffer, header.header_length, MSG_NOSIGNAL);
-    if (bytes_sent != header.header_length)
+    // re-encoded every attempt, a reconnect drops back to v1 without aliases
+    if (con->hello_peeks > 0 && !con->dispatching)
+      rtConnection_PeekRouterHello(con);
+    header.version = con->header_version;
+    header.flags = flags;
+    header.topic = topic;
+    header.topic_length = strlen(topic);
+    header.topic_alias = 0;
+    header.payload_length = n;
+    payload = buff;
+    if (header.topic_length < RTMSG_HEADER_MAX_TOPIC_LENGTH)
+      rtConnection_SetTopicAlias(con, &header);
+    if (con->trace && con->header_version >= RTMSG_HEADER_VERSION_2)
     {
-      if (bytes_sent == -1)
-        err = rtErrorFromErrno(errno);
-      else
-        err = RT_FAIL;
+      header.flags |= rtMessageFlags_Trace;
+      header.timestamps[rtMessageTimestamp_Send] = rtMessageTimestamp_Now();
     }
 
-    if (err == RT_OK)
+    // large payloads to a local v2 router go through shared memory, the router
+    // takes over our reference
+    if (n >= RTMSG_SHARED_PAYLOAD_THRESHOLD && con->header_version >= RTMSG_HEADER_VERSION_2 &&
+        con->remote_endpoint.ss_family == AF_UNIX)
     {
-      bytes_sent = send(con->fd, buff, header.payload_length, MSG_NOSIGNAL);
-      if (bytes_sent != header.payload_length)
+      if (!slab && rtShmSlab_Create(&slab, buff, n) != RT_OK)
+        slab = NULL;
+      if (slab)
+      {
+        header.flags |= rtMessageFlags_SharedPayload;
+        payload = (uint8_t const *) rtShmSlab_GetName(slab);
+        header.payload_length = strlen(rtShmSlab_GetName(slab));
+      }
+    }
+
+    err = rtMessageHeaderView_Encode(&header, con->send_buffer);
+    if (err != RT_OK)
+    {
+      rtLog_Warn("failed to encode header for topic:%s. %s", topic, rtStrError(err));
+      break;
+    }
+
+    if (con->shm)
+    {
+      err = rtConnection_SendShm(con, con->send_buffer, header.header_length, payload, header.payload_length);
+    }
+    else
+    {
+      bytes_sent = send(con->fd, con->send_buffer, header.header_length, MSG_NOSIGNAL);
+      if (bytes_sent != header.header_length)
       {
         if (bytes_sent == -1)
           err = rtErrorFromErrno(errno);
         else
           err = RT_FAIL;
       }
+
+      if (err == RT_OK)
+      {
+        bytes_sent = send(con->fd, payload, header.payload_length, MSG_NOSIGNAL);
+        if (bytes_sent != header.payload_length)
+        {
+          if (bytes_sent == -1)
+            err = rtErrorFromErrno(errno);
+          else
+            err = RT_FAIL;
+        }
+      }
     }
 
     if (err != RT_OK && rtConnection_ShouldReregister(err))
@@ -485,6 +808,14 @@ rtConnection_SendInternal(rtConnection con, char const* topic, uint8_t const* bu
     }
   }
   while ((err != RT_OK) && (num_attempts++ < max_attempts));
+  pthread_mutex_unlock(&con->send_mutex);
+
+  if (slab)
+  {
+    if (err != RT_OK || !(header.flags & rtMessageFlags_SharedPayload))
+      rtShmSlab_Release(slab);
+    rtShmSlab_Close(slab);
+  }
 
   return err;
 }
@@ -494,6 +825,7 @@ rtConnection_AddListener(rtConnection con, char const* expression, rtMessageCall
 {
   int i;
 
+  pthread_mutex_lock(&con->send_mutex);
   for (i = 0; i < RTMSG_LISTENERS_MAX; ++i)
   {
     if (!con->listeners[i].in_use)
@@ -501,24 +833,92 @@ rtConnection_AddListener(rtConnection con, char const* expression, rtMessageCall
   }
 
   if (i >= RTMSG_LISTENERS_MAX)
+  {
+    pthread_mutex_unlock(&con->send_mutex);
     return rtErrorFromErrno(ENOMEM);
+  }
 
-  con->listeners[i].in_use = 1;
+  // the dispatch thread doesn't take the lock, it skips the slot until in_use is set
   con->listeners[i].subscription_id = rtConnection_GetNextSubscriptionId();
   con->listeners[i].closure = closure;
   con->listeners[i].callback = callback;
   con->listeners[i].expression = strdup(expression);
+  __atomic_store_n(&con->listeners[i].in_use, 1, __ATOMIC_RELEASE);
 
-  rtMessage m;
-  rtMessage_Create(&m);
-  rtMessage_SetString(m, "topic", expression);
-  rtMessage_SetInt32(m, "route_id", con->listeners[i].subscription_id); 
-  rtConnection_SendMessage(con, m, "_RTROUTED.INBOX.SUBSCRIBE");
-  rtMessage_Release(m);
+  rtConnection_SendSubscribe(con, &con->listeners[i]);
+  pthread_mutex_unlock(&con->send_mutex);
 
   return 0;
 }
 
+static void
+rtConnection_RecordLeg(rtConnection con, rtConnectionLatency leg, uint64_t from, uint64_t to)
+{
+  // stages that didn't stamp, or clocks that can't be compared
+  if (from == 0 || to < from)
+    return;
+
+  if (!con->latency[leg] && rtHistogram_Create(&con->latency[leg]) != RT_OK)
+    return;
+  rtHistogram_Record(con->latency[leg], to - from);
+}
+
+static void
+rtConnection_RecordLatency(rtConnection con, rtMessageHeader* hdr)
+{
+  uint64_t const* ts = hdr->timestamps;
+
+  hdr->timestamps[rtMessageTimestamp_Dispatch] = rtMessageTimestamp_Now();
+  pthread_mutex_lock(&con->latency_mutex);
+  rtConnection_RecordLeg(con, rtConnectionLatency_Inbound, ts[rtMessageTimestamp_Send],
+    ts[rtMessageTimestamp_RouterReceive]);
+  rtConnection_RecordLeg(con, rtConnectionLatency_Router, ts[rtMessageTimestamp_RouterReceive],
+    ts[rtMessageTimestamp_RouterForward]);
+  rtConnection_RecordLeg(con, rtConnectionLatency_Outbound, ts[rtMessageTimestamp_RouterForward],
+    ts[rtMessageTimestamp_Dispatch]);
+  rtConnection_RecordLeg(con, rtConnectionLatency_Total, ts[rtMessageTimestamp_Send],
+    ts[rtMessageTimestamp_Dispatch]);
+  pthread_mutex_unlock(&con->latency_mutex);
+}
+
+rtError
+rtConnection_SetTracing(rtConnection con, int enable)
+{
+  if (!con)
+    return RT_ERROR_INVALID_ARG;
+  con->trace = enable;
+  return RT_OK;
+}
+
+rtError
+rtConnection_GetLatency(rtConnection con, rtConnectionLatency leg, rtHistogram hist)
+{
+  rtError err = RT_OK;
+
+  if (!con || !hist || (int) leg < 0 || leg >= rtConnectionLatency_Count)
+    return RT_ERROR_INVALID_ARG;
+
+  rtHistogram_Reset(hist);
+  pthread_mutex_lock(&con->latency_mutex);
+  if (con->latency[leg])
+    err = rtHistogram_Merge(hist, con->latency[leg]);
+  pthread_mutex_unlock(&con->latency_mutex);
+  return err;
+}
+
+rtError
+rtConnection_ResetLatency(rtConnection con, rtConnectionLatency leg)
+{
+  if (!con || (int) leg < 0 || leg >= rtConnectionLatency_Count)
+    return RT_ERROR_INVALID_ARG;
+
+  pthread_mutex_lock(&con->latency_mutex);
+  if (con->latency[leg])
+    rtHistogram_Reset(con->latency[leg]);
+  pthread_mutex_unlock(&con->latency_mutex);
+  return RT_OK;
+}
+
 rtError
 rtConnection_Dispatch(rtConnection con)
 {
@@ -533,6 +933,7 @@ rtConnection_TimedDispatch(rtConnection con, int32_t timeout)
   int max_attempts;
   uint8_t const*  itr;
   rtMessageHeader hdr;
+  rtMessageHeaderView view;
   rtError err;
 
   i = 0;
@@ -541,6 +942,15 @@ rtConnection_TimedDispatch(rtConnection con, int32_t timeout)
 
   rtMessageHeader_Init(&hdr);
 
+  // from here on a sender mustn't consume anything from the stream, and one that
+  // already is finishes before we read
+  if (!con->dispatching)
+  {
+    pthread_mutex_lock(&con->send_mutex);
+    con->dispatching = 1;
+    pthread_mutex_unlock(&con->send_mutex);
+  }
+
   // TODO: no error handling right now, all synch I/O
 
   do
@@ -555,7 +965,10 @@ rtConnection_TimedDispatch(rtConnection con, int32_t timeout)
     {
       itr = &con->recv_buffer[2];
       rtEncoder_DecodeUInt16(&itr, &hdr.header_length);
-      err = rtConnection_ReadUntil(con, con->recv_buffer + 4, (hdr.header_length-4), timeout);
+      if (hdr.header_length < RTMSG_HEADER_PREAMBLE_LENGTH || hdr.header_length >= RTMSG_SEND_BUFFER_SIZE)
+        err = RT_ERROR_PROTOCOL_ERROR;
+      else
+        err = rtConnection_ReadUntil(con, con->recv_buffer + 4, (hdr.header_length-4), timeout);
     }
 
     if (err == RT_OK)
@@ -570,7 +983,27 @@ rtConnection_TimedDispatch(rtConnection con, int32_t timeout)
       }
       printf("\n\n\n");
       #endif
-      err = rtMessageHeader_Decode(&hdr, con->recv_buffer);
+      err = rtMessageHeaderView_Decode(&view, con->recv_buffer, hdr.header_length);
+      if (err == RT_OK)
+        err = rtMessageHeaderView_ToHeader(&view, &hdr);
+    }
+
+    if (err == RT_OK && hdr.payload_length > RTMSG_MAX_PAYLOAD_LENGTH)
+      err = RT_ERROR_PROTOCOL_ERROR;
+
+    if (err == RT_OK && hdr.header_length + hdr.payload_length >= con->recv_buffer_capacity)
+    {
+      uint32_t capacity = hdr.header_length + hdr.payload_length + 1;
+      uint8_t* recv_buffer = (uint8_t *) realloc(con->recv_buffer, capacity);
+      if (recv_buffer)
+      {
+        con->recv_buffer = recv_buffer;
+        con->recv_buffer_capacity = capacity;
+      }
+      else
+      {
+        err = rtErrorFromErrno(ENOMEM);
+      }
     }
 
     if (err == RT_OK)
@@ -587,26 +1020,67 @@ rtConnection_TimedDispatch(rtConnection con, int32_t timeout)
     {
       err = rtConnection_EnsureRoutingDaemon();
       if (err == RT_OK)
+      {
+        pthread_mutex_lock(&con->send_mutex);
         err = rtConnection_ConnectAndRegister(con);
+        pthread_mutex_unlock(&con->send_mutex);
+      }
     }
   }
   while ((err != RT_OK) && (num_attempts++ < max_attempts));
 
   if (err == RT_OK)
   {
+    if (hdr.control_data == 0 && strcmp(hdr.topic, RTMSG_HELLO_TOPIC) == 0)
+    {
+      // not for the caller, wait for the next message instead. once per connection.
+      rtConnection_OnRouterHello(con, con->recv_buffer + hdr.header_length, hdr.payload_length);
+      return rtConnection_TimedDispatch(con, timeout);
+    }
+    con->hello_peeks = 0;
+  }
+
+  if (err == RT_OK && (hdr.flags & rtMessageFlags_Trace))
+    rtConnection_RecordLatency(con, &hdr);
+
+  if (err == RT_OK)
+  {
+    // responses the router makes up itself, e.g. for requests nobody listens to,
+    // don't carry a subscription id. They can only be for the inbox.
+    int no_route = strcmp(hdr.reply_topic, "NO.ROUTE.RESPONSE") == 0;
+
     for (i = 0; i < RTMSG_LISTENERS_MAX; ++i)
     {
-      if(strstr(hdr.reply_topic,"NO.ROUTE.RESPONSE")) {
-        con->listeners[i].subscription_id = 0;
-      }
-      if (con->listeners[i].in_use && (con->listeners[i].subscription_id == hdr.control_data))
+      if (!__atomic_load_n(&con->listeners[i].in_use, __ATOMIC_ACQUIRE))
+        continue;
+
+      if (no_route
+        ? strcmp(con->listeners[i].expression, con->inbox_name) == 0
+        : con->listeners[i].subscription_id == hdr.control_data)
       {
         rtLog_Debug("found subscription match:%d", i);
         break;
       }
     }
 
-    if (i < RTMSG_LISTENERS_MAX)
+    // the router took a reference for us, drop it even if nobody is listening
+    if (hdr.flags & rtMessageFlags_SharedPayload)
+    {
+      rtShmSlab slab;
+      if (rtShmSlab_Open(&slab, (char const *) con->recv_buffer + hdr.header_length, hdr.payload_length) == RT_OK)
+      {
+        hdr.flags &= ~rtMessageFlags_SharedPayload;
+        hdr.payload_length = rtShmSlab_GetLength(slab);
+        if (i < RTMSG_LISTENERS_MAX)
+        {
+          con->listeners[i].callback(&hdr, rtShmSlab_GetData(slab), hdr.payload_length,
+            con->listeners[i].closure);
+        }
+        rtShmSlab_ReleaseHolder(slab, getpid());
+        rtShmSlab_Close(slab);
+      }
+    }
+    else if (i < RTMSG_LISTENERS_MAX)
     {
       con->listeners[i].callback(&hdr, con->recv_buffer + hdr.header_length, hdr.payload_length,
         con->listeners[i].closure);
@@ -16,6 +16,7 @@
 #define __RTMSG_CONNECTION_H__
 
 #include "rtError.h"
+#include "rtHistogram.h"
 #include "rtMessage.h"
 #include "rtMessageHeader.h"
 
@@ -39,7 +40,20 @@ typedef enum
 } rtConnectionState;
 
 /**
- * Creates an rtConnection
+ * Legs of a traced message's trip, see rtMessageTimestamp
+ */
+typedef enum
+{
+  rtConnectionLatency_Inbound,   // publisher send to router receive
+  rtConnectionLatency_Router,    // router receive to forward, includes queueing between router threads
+  rtConnectionLatency_Outbound,  // router forward to dispatch, includes time waiting to be read here
+  rtConnectionLatency_Total,     // publisher send to dispatch
+  rtConnectionLatency_Count
+} rtConnectionLatency;
+
+/**
+ * Creates an rtConnection. Sends and AddListener may be called from any thread,
+ * but only one thread at a time may dispatch.
  * @param con
  * @param application_name
  * @param router_config
@@ -131,6 +145,37 @@ rtConnection_Dispatch(rtConnection con);
 rtError
 rtConnection_TimedDispatch(rtConnection con, int32_t timeout);
 
+/**
+ * Stamp outgoing messages for latency tracing. Only takes effect once the router
+ * has agreed on v2 headers.
+ * @param con
+ * @param enable
+ * @return error
+ */
+rtError
+rtConnection_SetTracing(rtConnection con, int enable);
+
+/**
+ * Copies the latencies in nanoseconds of traced messages dispatched on this
+ * connection into hist, replacing what it held. Safe to call from any thread
+ * while dispatching carries on.
+ * @param con
+ * @param leg
+ * @param hist created by the caller
+ * @return error
+ */
+rtError
+rtConnection_GetLatency(rtConnection con, rtConnectionLatency leg, rtHistogram hist);
+
+/**
+ * Forgets the latencies recorded so far for one leg.
+ * @param con
+ * @param leg
+ * @return error
+ */
+rtError
+rtConnection_ResetLatency(rtConnection con, rtConnectionLatency leg);
+
 #ifdef __cplusplus
 }
 #endif
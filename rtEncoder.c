@@ -93,3 +93,57 @@ rtEncoder_DecodeUInt32(uint8_t const** itr, uint32_t* n)
 {
   return rtEncoder_DecodeInt32(itr, (int32_t *)n);
 }
+
+rtError
+rtEncoder_EncodeUInt64(uint8_t** itr, uint64_t n)
+{
+  rtEncoder_EncodeUInt32(itr, (uint32_t) (n >> 32));
+  return rtEncoder_EncodeUInt32(itr, (uint32_t) n);
+}
+
+rtError
+rtEncoder_DecodeUInt64(uint8_t const** itr, uint64_t* n)
+{
+  uint32_t high = 0;
+  uint32_t low = 0;
+  rtEncoder_DecodeUInt32(itr, &high);
+  rtEncoder_DecodeUInt32(itr, &low);
+  *n = ((uint64_t) high << 32) | low;
+  return RT_OK;
+}
+
+rtError
+rtEncoder_EncodeVarUInt32(uint8_t** itr, uint32_t n)
+{
+  uint8_t* p = *itr;
+  while (n >= 0x80)
+  {
+    *p++ = (uint8_t) (n | 0x80);
+    n >>= 7;
+  }
+  *p++ = (uint8_t) n;
+  *itr = p;
+  return RT_OK;
+}
+
+rtError
+rtEncoder_DecodeVarUInt32(uint8_t const** itr, uint8_t const* end, uint32_t* n)
+{
+  int i;
+  uint32_t value = 0;
+  uint8_t const* p = *itr;
+
+  for (i = 0; i < RTENCODER_VARUINT32_MAX && p < end; ++i)
+  {
+    uint8_t b = *p++;
+    value |= ((uint32_t) (b & 0x7f)) << (7 * i);
+    if (!(b & 0x80))
+    {
+      *n = value;
+      *itr = p;
+      return RT_OK;
+    }
+  }
+
+  return RT_ERROR_PROTOCOL_ERROR;
+}
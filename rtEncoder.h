@@ -22,10 +22,18 @@ rtError rtEncoder_EncodeInt32(uint8_t** itr, int32_t n);
 rtError rtEncoder_DecodeInt32(uint8_t const** itr, int32_t* n);
 rtError rtEncoder_EncodeUInt32(uint8_t** itr, uint32_t n);
 rtError rtEncoder_DecodeUInt32(uint8_t const** itr, uint32_t* n);
+rtError rtEncoder_EncodeUInt64(uint8_t** itr, uint64_t n);
+rtError rtEncoder_DecodeUInt64(uint8_t const** itr, uint64_t* n);
 rtError rtEncoder_EncodeUInt16(uint8_t** itr, uint16_t n);
 rtError rtEncoder_DecodeUInt16(uint8_t const** itr, uint16_t* n);
 rtError rtEncoder_EncodeString(uint8_t** itr, char const* s, uint32_t* n);
 rtError rtEncoder_DecodeString(uint8_t const** itr, char* s, uint32_t* n);
 
+/* LEB128 variable length unsigned integers, at most RTENCODER_VARUINT32_MAX bytes */
+#define RTENCODER_VARUINT32_MAX 5
+
+rtError rtEncoder_EncodeVarUInt32(uint8_t** itr, uint32_t n);
+rtError rtEncoder_DecodeVarUInt32(uint8_t const** itr, uint8_t const* end, uint32_t* n);
+
 
 #endif
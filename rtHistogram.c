@@ -0,0 +1,180 @@
+/* Copyright [2017] [Comcast, Corp.]
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "rtHistogram.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Values below 2 * SUB_BUCKETS get a bucket each. Above that every power of two is
+// split into SUB_BUCKETS equal parts.
+#define RTHISTOGRAM_SUB_BUCKET_BITS 5
+#define RTHISTOGRAM_SUB_BUCKETS (1 << RTHISTOGRAM_SUB_BUCKET_BITS)
+#define RTHISTOGRAM_LINEAR_BUCKETS (2 * RTHISTOGRAM_SUB_BUCKETS)
+#define RTHISTOGRAM_NUM_BUCKETS \
+  (RTHISTOGRAM_LINEAR_BUCKETS + (64 - RTHISTOGRAM_SUB_BUCKET_BITS - 1) * RTHISTOGRAM_SUB_BUCKETS)
+
+struct _rtHistogram
+{
+  uint64_t count;
+  uint64_t sum;
+  uint64_t min;
+  uint64_t max;
+  uint64_t buckets[RTHISTOGRAM_NUM_BUCKETS];
+};
+
+static uint32_t
+rtHistogram_GetIndex(uint64_t value)
+{
+  int msb;
+  int shift;
+
+  if (value < RTHISTOGRAM_LINEAR_BUCKETS)
+    return (uint32_t) value;
+
+  msb = 63 - __builtin_clzll(value);
+  shift = msb - RTHISTOGRAM_SUB_BUCKET_BITS;
+  return RTHISTOGRAM_LINEAR_BUCKETS + (shift - 1) * RTHISTOGRAM_SUB_BUCKETS +
+    (uint32_t) ((value >> shift) - RTHISTOGRAM_SUB_BUCKETS);
+}
+
+// largest value that lands in bucket index
+static uint64_t
+rtHistogram_GetHighestValue(uint32_t index)
+{
+  int shift;
+  uint64_t top;
+
+  if (index < RTHISTOGRAM_LINEAR_BUCKETS)
+    return index;
+
+  index -= RTHISTOGRAM_LINEAR_BUCKETS;
+  shift = (int) (index / RTHISTOGRAM_SUB_BUCKETS) + 1;
+  top = (index % RTHISTOGRAM_SUB_BUCKETS) + RTHISTOGRAM_SUB_BUCKETS;
+  return ((top + 1) << shift) - 1;
+}
+
+rtError
+rtHistogram_Create(rtHistogram* hist)
+{
+  rtHistogram h = (rtHistogram) malloc(sizeof(struct _rtHistogram));
+  if (!h)
+    return rtErrorFromErrno(ENOMEM);
+  rtHistogram_Reset(h);
+  *hist = h;
+  return RT_OK;
+}
+
+rtError
+rtHistogram_Destroy(rtHistogram hist)
+{
+  if (hist)
+    free(hist);
+  return RT_OK;
+}
+
+void
+rtHistogram_Record(rtHistogram hist, uint64_t value)
+{
+  hist->buckets[rtHistogram_GetIndex(value)]++;
+  hist->count++;
+  hist->sum += value;
+  if (value < hist->min)
+    hist->min = value;
+  if (value > hist->max)
+    hist->max = value;
+}
+
+void
+rtHistogram_Reset(rtHistogram hist)
+{
+  memset(hist, 0, sizeof(struct _rtHistogram));
+  hist->min = UINT64_MAX;
+}
+
+rtError
+rtHistogram_Merge(rtHistogram hist, rtHistogram const other)
+{
+  uint32_t i;
+
+  if (!hist || !other)
+    return RT_ERROR_INVALID_ARG;
+
+  for (i = 0; i < RTHISTOGRAM_NUM_BUCKETS; ++i)
+    hist->buckets[i] += other->buckets[i];
+  hist->count += other->count;
+  hist->sum += other->sum;
+  if (other->min < hist->min)
+    hist->min = other->min;
+  if (other->max > hist->max)
+    hist->max = other->max;
+  return RT_OK;
+}
+
+uint64_t
+rtHistogram_GetCount(rtHistogram const hist)
+{
+  return hist->count;
+}
+
+uint64_t
+rtHistogram_GetMin(rtHistogram const hist)
+{
+  return hist->count ? hist->min : 0;
+}
+
+uint64_t
+rtHistogram_GetMax(rtHistogram const hist)
+{
+  return hist->max;
+}
+
+double
+rtHistogram_GetMean(rtHistogram const hist)
+{
+  return hist->count ? ((double) hist->sum / hist->count) : 0.0;
+}
+
+uint64_t
+rtHistogram_GetValueAtPercentile(rtHistogram const hist, double percentile)
+{
+  uint32_t i;
+  uint64_t seen;
+  uint64_t target;
+
+  if (hist->count == 0)
+    return 0;
+
+  if (percentile < 0.0)
+    percentile = 0.0;
+  if (percentile > 100.0)
+    percentile = 100.0;
+
+  target = (uint64_t) ((percentile / 100.0) * hist->count + 0.5);
+  if (target == 0)
+    target = 1;
+
+  for (i = 0, seen = 0; i < RTHISTOGRAM_NUM_BUCKETS; ++i)
+  {
+    seen += hist->buckets[i];
+    if (seen >= target)
+    {
+      uint64_t value = rtHistogram_GetHighestValue(i);
+      return value < hist->max ? value : hist->max;
+    }
+  }
+
+  return hist->max;
+}
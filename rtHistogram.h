@@ -0,0 +1,61 @@
+/* Copyright [2017] [Comcast, Corp.]
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef __RT_HISTOGRAM_H__
+#define __RT_HISTOGRAM_H__
+
+#include "rtError.h"
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * High dynamic range histogram of unsigned 64 bit values, typically latencies in
+ * nanoseconds. Buckets are log-linear, every value is kept to within about 3% and
+ * recording is a couple of shifts and an increment. Not thread safe.
+ */
+struct _rtHistogram;
+typedef struct _rtHistogram* rtHistogram;
+
+rtError rtHistogram_Create(rtHistogram* hist);
+rtError rtHistogram_Destroy(rtHistogram hist);
+
+void rtHistogram_Record(rtHistogram hist, uint64_t value);
+void rtHistogram_Reset(rtHistogram hist);
+
+/**
+ * Adds the counts from other to hist.
+ */
+rtError rtHistogram_Merge(rtHistogram hist, rtHistogram const other);
+
+uint64_t rtHistogram_GetCount(rtHistogram const hist);
+uint64_t rtHistogram_GetMin(rtHistogram const hist);
+uint64_t rtHistogram_GetMax(rtHistogram const hist);
+double   rtHistogram_GetMean(rtHistogram const hist);
+
+/**
+ * Smallest value that percentile percent of the recorded values are at or below,
+ * rounded up to the bucket boundary.
+ * @param hist
+ * @param percentile 0 to 100
+ * @return value or 0 if nothing has been recorded
+ */
+uint64_t rtHistogram_GetValueAtPercentile(rtHistogram const hist, double percentile);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
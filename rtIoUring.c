@@ -0,0 +1,299 @@
+/* Copyright [2017] [Comcast, Corp.]
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "rtIoUring.h"
+
+#include <errno.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+static int
+rtIoUring_SysSetup(uint32_t entries, struct io_uring_params* params)
+{
+  return (int) syscall(__NR_io_uring_setup, entries, params);
+}
+
+static int
+rtIoUring_SysEnter(int fd, uint32_t to_submit, uint32_t min_complete, uint32_t flags,
+  void* arg, size_t arg_size)
+{
+  return (int) syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, arg, arg_size);
+}
+
+static int
+rtIoUring_SysRegister(int fd, uint32_t opcode, void* arg, uint32_t nr_args)
+{
+  return (int) syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+static rtError
+rtIoUring_RegisterFiles(rtIoUring* ring, uint32_t num_files)
+{
+  uint32_t i;
+  int ret;
+  int* fds = (int *) malloc(sizeof(int) * num_files);
+
+  if (!fds)
+    return rtErrorFromErrno(ENOMEM);
+
+  // -1 leaves the slot empty until rtIoUring_SetFile
+  for (i = 0; i < num_files; ++i)
+    fds[i] = -1;
+  ret = rtIoUring_SysRegister(ring->fd, IORING_REGISTER_FILES, fds, num_files);
+  free(fds);
+
+  return ret == -1 ? rtErrorFromErrno(errno) : RT_OK;
+}
+
+static rtError
+rtIoUring_RegisterBuffers(rtIoUring* ring, uint32_t num_buffers, uint32_t buffer_size)
+{
+  uint32_t i;
+  struct io_uring_buf_reg reg;
+
+  ring->buf_ring_size = sizeof(struct io_uring_buf) * num_buffers;
+  ring->buf_ring = (struct io_uring_buf_ring *) mmap(NULL, ring->buf_ring_size, PROT_READ | PROT_WRITE,
+    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (ring->buf_ring == MAP_FAILED)
+  {
+    ring->buf_ring = NULL;
+    return rtErrorFromErrno(errno);
+  }
+
+  ring->buffers = (uint8_t *) malloc((size_t) num_buffers * buffer_size);
+  if (!ring->buffers)
+    return rtErrorFromErrno(ENOMEM);
+  ring->num_buffers = num_buffers;
+  ring->buffer_size = buffer_size;
+
+  memset(&reg, 0, sizeof(reg));
+  reg.ring_addr = (uint64_t) (uintptr_t) ring->buf_ring;
+  reg.ring_entries = num_buffers;
+  reg.bgid = RTIOURING_BUFFER_GROUP;
+  if (rtIoUring_SysRegister(ring->fd, IORING_REGISTER_PBUF_RING, &reg, 1) == -1)
+    return rtErrorFromErrno(errno);
+
+  for (i = 0; i < num_buffers; ++i)
+    rtIoUring_RecycleBuffer(ring, (uint16_t) i);
+  return RT_OK;
+}
+
+rtError
+rtIoUring_Init(rtIoUring* ring, uint32_t entries, uint32_t num_files, uint32_t num_buffers,
+  uint32_t buffer_size)
+{
+  rtError err;
+  uint8_t* p;
+  struct io_uring_params params;
+
+  memset(ring, 0, sizeof(rtIoUring));
+  ring->fd = -1;
+
+  // only ever used from the thread that creates it, newer kernels can skip some
+  // locking and task work interrupts for that
+  memset(&params, 0, sizeof(params));
+  params.flags = IORING_SETUP_SINGLE_ISSUER | IORING_SETUP_COOP_TASKRUN;
+  ring->fd = rtIoUring_SysSetup(entries, &params);
+  if (ring->fd == -1 && errno == EINVAL)
+  {
+    memset(&params, 0, sizeof(params));
+    ring->fd = rtIoUring_SysSetup(entries, &params);
+  }
+
+  if (ring->fd == -1)
+    return rtErrorFromErrno(errno);
+
+  if (!(params.features & IORING_FEAT_SINGLE_MMAP) || !(params.features & IORING_FEAT_EXT_ARG))
+  {
+    err = RT_ERROR_NOT_IMPLEMENTED;
+    goto error;
+  }
+
+  ring->ring_size = params.sq_off.array + params.sq_entries * sizeof(uint32_t);
+  if (ring->ring_size < params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe))
+    ring->ring_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+
+  ring->ring_mem = mmap(NULL, ring->ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+    ring->fd, IORING_OFF_SQ_RING);
+  if (ring->ring_mem == MAP_FAILED)
+  {
+    ring->ring_mem = NULL;
+    err = rtErrorFromErrno(errno);
+    goto error;
+  }
+
+  ring->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+  ring->sqes = (struct io_uring_sqe *) mmap(NULL, ring->sqes_size, PROT_READ | PROT_WRITE,
+    MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+  if (ring->sqes == MAP_FAILED)
+  {
+    ring->sqes = NULL;
+    err = rtErrorFromErrno(errno);
+    goto error;
+  }
+
+  p = (uint8_t *) ring->ring_mem;
+  ring->sq_head = (uint32_t *) (p + params.sq_off.head);
+  ring->sq_tail = (uint32_t *) (p + params.sq_off.tail);
+  ring->sq_mask = *(uint32_t *) (p + params.sq_off.ring_mask);
+  ring->sq_entries = params.sq_entries;
+  ring->cq_head = (uint32_t *) (p + params.cq_off.head);
+  ring->cq_tail = (uint32_t *) (p + params.cq_off.tail);
+  ring->cq_mask = *(uint32_t *) (p + params.cq_off.ring_mask);
+  ring->cqes = (struct io_uring_cqe *) (p + params.cq_off.cqes);
+  ring->sqe_tail = *ring->sq_tail;
+  ring->sqe_submitted = ring->sqe_tail;
+
+  // submission entries are always used in order, map the index array once
+  {
+    uint32_t i;
+    uint32_t* array = (uint32_t *) (p + params.sq_off.array);
+    for (i = 0; i < params.sq_entries; ++i)
+      array[i] = i;
+  }
+
+  err = rtIoUring_RegisterFiles(ring, num_files);
+  if (err == RT_OK)
+    err = rtIoUring_RegisterBuffers(ring, num_buffers, buffer_size);
+  if (err != RT_OK)
+    goto error;
+
+  return RT_OK;
+
+error:
+  rtIoUring_Destroy(ring);
+  return err;
+}
+
+void
+rtIoUring_Destroy(rtIoUring* ring)
+{
+  if (ring->fd != -1)
+    close(ring->fd);
+  if (ring->sqes)
+    munmap(ring->sqes, ring->sqes_size);
+  if (ring->ring_mem)
+    munmap(ring->ring_mem, ring->ring_size);
+  if (ring->buf_ring)
+    munmap(ring->buf_ring, ring->buf_ring_size);
+  if (ring->buffers)
+    free(ring->buffers);
+  memset(ring, 0, sizeof(rtIoUring));
+  ring->fd = -1;
+}
+
+struct io_uring_sqe*
+rtIoUring_GetSqe(rtIoUring* ring)
+{
+  struct io_uring_sqe* sqe;
+  uint32_t head = __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+
+  if (ring->sqe_tail - head >= ring->sq_entries)
+  {
+    rtIoUring_Submit(ring, 0, 0);
+    head = __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+    if (ring->sqe_tail - head >= ring->sq_entries)
+      return NULL;
+  }
+
+  sqe = &ring->sqes[ring->sqe_tail & ring->sq_mask];
+  ring->sqe_tail++;
+  memset(sqe, 0, sizeof(struct io_uring_sqe));
+  return sqe;
+}
+
+rtError
+rtIoUring_Submit(rtIoUring* ring, uint32_t wait_nr, int timeout)
+{
+  int ret;
+  uint32_t flags;
+  uint32_t to_submit;
+  struct __kernel_timespec ts;
+  struct io_uring_getevents_arg arg;
+
+  to_submit = ring->sqe_tail - ring->sqe_submitted;
+  __atomic_store_n(ring->sq_tail, ring->sqe_tail, __ATOMIC_RELEASE);
+  ring->sqe_submitted = ring->sqe_tail;
+
+  if (to_submit == 0 && wait_nr == 0)
+    return RT_OK;
+
+  memset(&arg, 0, sizeof(arg));
+  ts.tv_sec = timeout / 1000;
+  ts.tv_nsec = (timeout % 1000) * 1000000;
+  arg.sigmask_sz = _NSIG / 8;
+  arg.ts = (uint64_t) (uintptr_t) &ts;
+
+  flags = IORING_ENTER_EXT_ARG;
+  if (wait_nr > 0)
+    flags |= IORING_ENTER_GETEVENTS;
+
+  ret = rtIoUring_SysEnter(ring->fd, to_submit, wait_nr, flags, &arg, sizeof(arg));
+  if (ret == -1 && errno != EINTR && errno != ETIME && errno != EBUSY)
+    return rtErrorFromErrno(errno);
+  return RT_OK;
+}
+
+struct io_uring_cqe*
+rtIoUring_PeekCqe(rtIoUring* ring)
+{
+  uint32_t head = *ring->cq_head;
+  uint32_t tail = __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE);
+
+  if (head == tail)
+    return NULL;
+  return &ring->cqes[head & ring->cq_mask];
+}
+
+void
+rtIoUring_CqeSeen(rtIoUring* ring)
+{
+  __atomic_store_n(ring->cq_head, *ring->cq_head + 1, __ATOMIC_RELEASE);
+}
+
+rtError
+rtIoUring_SetFile(rtIoUring* ring, uint32_t slot, int fd)
+{
+  struct io_uring_files_update update;
+
+  memset(&update, 0, sizeof(update));
+  update.offset = slot;
+  update.fds = (uint64_t) (uintptr_t) &fd;
+  if (rtIoUring_SysRegister(ring->fd, IORING_REGISTER_FILES_UPDATE, &update, 1) == -1)
+    return rtErrorFromErrno(errno);
+  return RT_OK;
+}
+
+uint8_t*
+rtIoUring_GetBuffer(rtIoUring* ring, uint16_t bid)
+{
+  return ring->buffers + ((size_t) bid * ring->buffer_size);
+}
+
+void
+rtIoUring_RecycleBuffer(rtIoUring* ring, uint16_t bid)
+{
+  struct io_uring_buf* buf = &ring->buf_ring->bufs[ring->buf_tail & (ring->num_buffers - 1)];
+
+  buf->addr = (uint64_t) (uintptr_t) rtIoUring_GetBuffer(ring, bid);
+  buf->len = ring->buffer_size;
+  buf->bid = bid;
+  ring->buf_tail++;
+  __atomic_store_n(&ring->buf_ring->tail, ring->buf_tail, __ATOMIC_RELEASE);
+}
@@ -0,0 +1,104 @@
+/* Copyright [2017] [Comcast, Corp.]
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef __RT_IO_URING_H__
+#define __RT_IO_URING_H__
+
+#include "rtError.h"
+
+#include <linux/io_uring.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Just enough of io_uring for rtrouted, talking to the kernel directly so there's
+ * no dependency on liburing. One ring per thread, not thread safe.
+ *
+ * Every ring has a sparse table of registered files and a single group
+ * (RTIOURING_BUFFER_GROUP) of provided receive buffers.
+ */
+#define RTIOURING_BUFFER_GROUP 0
+
+typedef struct
+{
+  int                       fd;
+  void*                     ring_mem;
+  size_t                    ring_size;
+  struct io_uring_sqe*      sqes;
+  size_t                    sqes_size;
+  uint32_t*                 sq_head;
+  uint32_t*                 sq_tail;
+  uint32_t                  sq_mask;
+  uint32_t                  sq_entries;
+  uint32_t                  sqe_tail;
+  uint32_t                  sqe_submitted;
+  uint32_t*                 cq_head;
+  uint32_t*                 cq_tail;
+  uint32_t                  cq_mask;
+  struct io_uring_cqe*      cqes;
+  struct io_uring_buf_ring* buf_ring;
+  size_t                    buf_ring_size;
+  uint8_t*                  buffers;
+  uint32_t                  num_buffers;
+  uint32_t                  buffer_size;
+  uint16_t                  buf_tail;
+} rtIoUring;
+
+/**
+ * Sets up the ring, num_buffers must be a power of two. Fails on kernels without
+ * multishot receive and provided buffer rings so callers can fall back.
+ */
+rtError rtIoUring_Init(rtIoUring* ring, uint32_t entries, uint32_t num_files,
+  uint32_t num_buffers, uint32_t buffer_size);
+
+void rtIoUring_Destroy(rtIoUring* ring);
+
+/**
+ * Returns a zeroed submission entry, submitting what's queued first if the
+ * submission queue is full.
+ */
+struct io_uring_sqe* rtIoUring_GetSqe(rtIoUring* ring);
+
+/**
+ * Submits everything queued and waits for at least wait_nr completions or
+ * timeout milliseconds.
+ */
+rtError rtIoUring_Submit(rtIoUring* ring, uint32_t wait_nr, int timeout);
+
+/**
+ * Next completion or NULL, call rtIoUring_CqeSeen once done with it.
+ */
+struct io_uring_cqe* rtIoUring_PeekCqe(rtIoUring* ring);
+void rtIoUring_CqeSeen(rtIoUring* ring);
+
+/**
+ * Points registered file slot at fd, -1 clears it.
+ */
+rtError rtIoUring_SetFile(rtIoUring* ring, uint32_t slot, int fd);
+
+uint8_t* rtIoUring_GetBuffer(rtIoUring* ring, uint16_t bid);
+
+/**
+ * Hands a provided buffer back to the kernel.
+ */
+void rtIoUring_RecycleBuffer(rtIoUring* ring, uint16_t bid);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
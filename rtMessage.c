@@ -16,12 +16,17 @@
 #include "rtMessage.h"
 
 #include <cJSON.h>
+#include <errno.h>
+#include <inttypes.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdint.h>
 #include <string.h>
 #include <stdatomic.h>
 
+// integers up to this size survive a round trip through a json number
+#define RT_MESSAGE_MAX_EXACT_INTEGER (1ll << 53)
+
 struct _rtMessage
 {
   cJSON* json;
@@ -92,6 +97,7 @@ rtMessage_FromBytes(rtMessage* message, uint8_t const* bytes, int n)
   if (message)
   {
     (*message)->json = cJSON_Parse((char *) bytes);
+    (*message)->count = 1;
     return RT_OK;
   }
   return RT_FAIL;
@@ -182,6 +188,63 @@ rtMessage_SetDouble(rtMessage message, char const* name, double value)
   cJSON_AddItemToObject(message->json, name, cJSON_CreateNumber(value));
 }
 
+/**
+ * Add boolean field to the message
+ * @param message to be modified
+ * @param name of the field to be added
+ * @param boolean value of the field to be added
+ * @return void
+ **/
+void
+rtMessage_SetBool(rtMessage message, char const* name, bool value)
+{
+  cJSON_AddItemToObject(message->json, name, cJSON_CreateBool(value));
+}
+
+/**
+ * Add 64 bit integer field to the message
+ * @param message to be modified
+ * @param name of the field to be added
+ * @param integer value of the field to be added
+ * @return void
+ **/
+void
+rtMessage_SetInt64(rtMessage message, char const* name, int64_t value)
+{
+  if (value <= RT_MESSAGE_MAX_EXACT_INTEGER && value >= -RT_MESSAGE_MAX_EXACT_INTEGER)
+  {
+    cJSON_AddItemToObject(message->json, name, cJSON_CreateNumber((double) value));
+  }
+  else
+  {
+    char buff[32];
+    snprintf(buff, sizeof(buff), "%" PRId64, value);
+    cJSON_AddItemToObject(message->json, name, cJSON_CreateString(buff));
+  }
+}
+
+/**
+ * Add unsigned 64 bit integer field to the message
+ * @param message to be modified
+ * @param name of the field to be added
+ * @param integer value of the field to be added
+ * @return void
+ **/
+void
+rtMessage_SetUInt64(rtMessage message, char const* name, uint64_t value)
+{
+  if (value <= (uint64_t) RT_MESSAGE_MAX_EXACT_INTEGER)
+  {
+    cJSON_AddItemToObject(message->json, name, cJSON_CreateNumber((double) value));
+  }
+  else
+  {
+    char buff[32];
+    snprintf(buff, sizeof(buff), "%" PRIu64, value);
+    cJSON_AddItemToObject(message->json, name, cJSON_CreateString(buff));
+  }
+}
+
 /**
  * Add sub message field to the message
  * @param message to be modified
@@ -285,6 +348,99 @@ rtMessage_GetDouble(rtMessage const  message, char const* name,double* value)
   return RT_FAIL;
 }
 
+/**
+ * Get field value of type boolean using field name.
+ * @param message to get field
+ * @param name of the field
+ * @param pointer to boolean value obtained.
+ * @return rtError
+ **/
+rtError
+rtMessage_GetBool(rtMessage const message, char const* name, bool* value)
+{
+  cJSON* p = cJSON_GetObjectItem(message->json, name);
+  if (p && ((p->type & 0xff) == cJSON_True || (p->type & 0xff) == cJSON_False))
+  {
+    *value = (p->type & 0xff) == cJSON_True;
+    return RT_OK;
+  }
+  return RT_FAIL;
+}
+
+/**
+ * Get field value of type 64 bit integer using field name.
+ * @param message to get field
+ * @param name of the field
+ * @param pointer to integer value obtained.
+ * @return rtError
+ **/
+rtError
+rtMessage_GetInt64(rtMessage const message, char const* name, int64_t* value)
+{
+  cJSON* p = cJSON_GetObjectItem(message->json, name);
+  if (!p)
+    return RT_FAIL;
+
+  // valueint is only an int. Casting NaN or anything out of range is undefined,
+  // both fail these comparisons.
+  if ((p->type & 0xff) == cJSON_Number)
+  {
+    if (!(p->valuedouble >= -9223372036854775808.0 && p->valuedouble < 9223372036854775808.0))
+      return RT_FAIL;
+    *value = (int64_t) p->valuedouble;
+    return RT_OK;
+  }
+
+  if ((p->type & 0xff) == cJSON_String && p->valuestring)
+  {
+    char* end = NULL;
+    errno = 0;
+    long long n = strtoll(p->valuestring, &end, 10);
+    if (errno == 0 && end != p->valuestring && *end == '\0')
+    {
+      *value = (int64_t) n;
+      return RT_OK;
+    }
+  }
+  return RT_FAIL;
+}
+
+/**
+ * Get field value of type unsigned 64 bit integer using field name.
+ * @param message to get field
+ * @param name of the field
+ * @param pointer to integer value obtained.
+ * @return rtError
+ **/
+rtError
+rtMessage_GetUInt64(rtMessage const message, char const* name, uint64_t* value)
+{
+  cJSON* p = cJSON_GetObjectItem(message->json, name);
+  if (!p)
+    return RT_FAIL;
+
+  if ((p->type & 0xff) == cJSON_Number)
+  {
+    if (!(p->valuedouble >= 0 && p->valuedouble < 18446744073709551616.0))
+      return RT_FAIL;
+    *value = (uint64_t) p->valuedouble;
+    return RT_OK;
+  }
+
+  if ((p->type & 0xff) == cJSON_String && p->valuestring && p->valuestring[0] != '-')
+  {
+    char* end = NULL;
+    errno = 0;
+    unsigned long long n = strtoull(p->valuestring, &end, 10);
+    if (errno == 0 && end != p->valuestring && *end == '\0')
+    {
+      *value = (uint64_t) n;
+      return RT_OK;
+    }
+  }
+  return RT_FAIL;
+}
+
 /**
  * Get field value of type message using name
  * @param message to get field
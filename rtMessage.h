@@ -17,6 +17,9 @@
 
 #include "rtError.h"
 
+#include <stdbool.h>
+#include <stdint.h>
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -142,6 +145,37 @@ rtMessage_SetInt32(rtMessage message, char const* name, int32_t value);
 void
 rtMessage_SetDouble(rtMessage message, char const* name, double value);
 
+/**
+ * Add boolean field to the message
+ * @param message to be modified
+ * @param name of the field to be added
+ * @param boolean value of the field to be added
+ * @return void
+ **/
+void
+rtMessage_SetBool(rtMessage message, char const* name, bool value);
+
+/**
+ * Add 64 bit integer field to the message. Json numbers are doubles, so values
+ * beyond 2^53 are sent as decimal strings, rtMessage_GetInt64 reads either.
+ * @param message to be modified
+ * @param name of the field to be added
+ * @param integer value of the field to be added
+ * @return void
+ **/
+void
+rtMessage_SetInt64(rtMessage message, char const* name, int64_t value);
+
+/**
+ * Add unsigned 64 bit integer field to the message, same encoding as rtMessage_SetInt64
+ * @param message to be modified
+ * @param name of the field to be added
+ * @param integer value of the field to be added
+ * @return void
+ **/
+void
+rtMessage_SetUInt64(rtMessage message, char const* name, uint64_t value);
+
 /**
  * Add sub message field to the message
  * @param message to be modified
@@ -193,6 +227,36 @@ rtMessage_GetInt32(rtMessage const m, char const* name, int32_t* value);
 rtError
 rtMessage_GetDouble(rtMessage const m, char const* name, double* value);
 
+/**
+ * Get field value of type boolean using field name.
+ * @param message to get field
+ * @param name of the field
+ * @param pointer to boolean value obtained.
+ * @return rtError
+ **/
+rtError
+rtMessage_GetBool(rtMessage const m, char const* name, bool* value);
+
+/**
+ * Get field value of type 64 bit integer using field name.
+ * @param message to get field
+ * @param name of the field
+ * @param pointer to integer value obtained.
+ * @return rtError
+ **/
+rtError
+rtMessage_GetInt64(rtMessage const m, char const* name, int64_t* value);
+
+/**
+ * Get field value of type unsigned 64 bit integer using field name.
+ * @param message to get field
+ * @param name of the field
+ * @param pointer to integer value obtained.
+ * @return rtError
+ **/
+rtError
+rtMessage_GetUInt64(rtMessage const m, char const* name, uint64_t* value);
+
 /**
  * Get field value of type message using name
  * @param message to get field
@@ -17,8 +17,15 @@
 #include "rtLog.h"
 
 #include <string.h>
+#include <time.h>
 
-#define RTMSG_HEADER_VERSION 1
+#define RTMSG_HEADER_VERSION RTMSG_HEADER_VERSION_1
+
+// stamps that are carried in the header, dispatch never is
+#define RTMSG_HEADER_WIRE_TIMESTAMPS rtMessageTimestamp_Dispatch
+
+// size of the v1 header without the topic strings
+#define RTMSG_HEADER_V1_FIXED_LENGTH 28
 
 rtError
 rtMessageHeader_Init(rtMessageHeader* hdr)
@@ -33,53 +40,308 @@ rtMessageHeader_Init(rtMessageHeader* hdr)
   memset(hdr->topic, 0, RTMSG_HEADER_MAX_TOPIC_LENGTH);
   hdr->reply_topic_length = 0;
   memset(hdr->reply_topic, 0, RTMSG_HEADER_MAX_TOPIC_LENGTH);
+  memset(hdr->timestamps, 0, sizeof(hdr->timestamps));
   return RT_OK;
 }
 
 rtError
 rtMessageHeader_Encode(rtMessageHeader* hdr, uint8_t* buff)
+{
+  rtError err;
+  rtMessageHeaderView view;
+
+  view.version = hdr->version;
+  view.sequence_number = hdr->sequence_number;
+  view.flags = hdr->flags;
+  view.control_data = hdr->control_data;
+  view.payload_length = hdr->payload_length;
+  view.topic = hdr->topic;
+  view.topic_length = strlen(hdr->topic);
+  view.reply_topic = hdr->reply_topic;
+  view.reply_topic_length = strlen(hdr->reply_topic);
+  view.topic_alias = 0;
+  memcpy(view.timestamps, hdr->timestamps, sizeof(view.timestamps));
+
+  err = rtMessageHeaderView_Encode(&view, buff);
+  if (err == RT_OK)
+    hdr->header_length = view.header_length;
+
+  return err;
+}
+
+rtError
+rtMessageHeader_Decode(rtMessageHeader* hdr, uint8_t const* buff)
+{
+  rtError err;
+  uint16_t header_length;
+  uint8_t const* ptr;
+  rtMessageHeaderView view;
+
+  ptr = buff + 2;
+  rtEncoder_DecodeUInt16(&ptr, &header_length);
+
+  err = rtMessageHeaderView_Decode(&view, buff, header_length);
+  if (err != RT_OK)
+    return err;
+
+  return rtMessageHeaderView_ToHeader(&view, hdr);
+}
+
+rtError
+rtMessageHeader_SetIsRequest(rtMessageHeader* hdr)
+{
+  hdr->flags |= rtMessageFlags_Request;
+  return RT_OK;
+}
+
+int
+rtMessageHeader_IsRequest(rtMessageHeader const* hdr)
+{
+  return ((hdr->flags & rtMessageFlags_Request) == rtMessageFlags_Request ? 1 : 0);
+}
+
+rtError
+rtMessageHeaderView_Init(rtMessageHeaderView* hdr)
+{
+  memset(hdr, 0, sizeof(rtMessageHeaderView));
+  hdr->version = RTMSG_HEADER_VERSION;
+  hdr->topic = "";
+  hdr->reply_topic = "";
+  return RT_OK;
+}
+
+static rtError
+rtMessageHeaderView_EncodeV1(rtMessageHeaderView* hdr, uint8_t* buff)
 {
   uint8_t* ptr = buff;
-  static uint16_t const kSizeWithoutStringsInBytes = 28;
-  uint16_t length = kSizeWithoutStringsInBytes
-    + strlen(hdr->topic)
-    + strlen(hdr->reply_topic);
-  hdr->header_length = length;
-  rtEncoder_EncodeUInt16(&ptr, RTMSG_HEADER_VERSION);
+
+  hdr->header_length = RTMSG_HEADER_V1_FIXED_LENGTH + hdr->topic_length + hdr->reply_topic_length;
+  rtEncoder_EncodeUInt16(&ptr, RTMSG_HEADER_VERSION_1);
   rtEncoder_EncodeUInt16(&ptr, hdr->header_length);
-  rtEncoder_EncodeInt32(&ptr, hdr->sequence_number); // con->sequence_number++);
-  rtEncoder_EncodeInt32(&ptr, hdr->flags);
+  rtEncoder_EncodeInt32(&ptr, hdr->sequence_number);
+  rtEncoder_EncodeInt32(&ptr, hdr->flags & ~(rtMessageFlags_TopicAlias | rtMessageFlags_Trace));
   rtEncoder_EncodeInt32(&ptr, hdr->control_data);
   rtEncoder_EncodeInt32(&ptr, hdr->payload_length);
-  rtEncoder_EncodeString(&ptr, hdr->topic, NULL);
-  rtEncoder_EncodeString(&ptr, hdr->reply_topic, NULL);
+  rtEncoder_EncodeString(&ptr, hdr->topic, &hdr->topic_length);
+  rtEncoder_EncodeString(&ptr, hdr->reply_topic, &hdr->reply_topic_length);
+  return RT_OK;
+}
+
+static rtError
+rtMessageHeaderView_EncodeV2(rtMessageHeaderView* hdr, uint8_t* buff)
+{
+  uint8_t* ptr = buff + RTMSG_HEADER_PREAMBLE_LENGTH;
+  uint8_t* len = buff + 2;
+
+  rtEncoder_EncodeVarUInt32(&ptr, hdr->sequence_number);
+  rtEncoder_EncodeVarUInt32(&ptr, hdr->flags);
+  rtEncoder_EncodeVarUInt32(&ptr, hdr->control_data);
+  rtEncoder_EncodeVarUInt32(&ptr, hdr->payload_length);
+  rtEncoder_EncodeVarUInt32(&ptr, hdr->topic_length);
+  memcpy(ptr, hdr->topic, hdr->topic_length);
+  ptr += hdr->topic_length;
+  if (hdr->flags & rtMessageFlags_TopicAlias)
+    rtEncoder_EncodeVarUInt32(&ptr, hdr->topic_alias);
+  // an absent reply topic costs a single zero byte
+  rtEncoder_EncodeVarUInt32(&ptr, hdr->reply_topic_length);
+  memcpy(ptr, hdr->reply_topic, hdr->reply_topic_length);
+  ptr += hdr->reply_topic_length;
+  if (hdr->flags & rtMessageFlags_Trace)
+  {
+    int i;
+    rtEncoder_EncodeVarUInt32(&ptr, RTMSG_HEADER_WIRE_TIMESTAMPS);
+    for (i = 0; i < RTMSG_HEADER_WIRE_TIMESTAMPS; ++i)
+      rtEncoder_EncodeUInt64(&ptr, hdr->timestamps[i]);
+  }
+
+  hdr->header_length = (uint16_t) (ptr - buff);
+  rtEncoder_EncodeUInt16(&buff, RTMSG_HEADER_VERSION_2);
+  rtEncoder_EncodeUInt16(&len, hdr->header_length);
   return RT_OK;
 }
 
 rtError
-rtMessageHeader_Decode(rtMessageHeader* hdr, uint8_t const* buff)
+rtMessageHeaderView_Encode(rtMessageHeaderView* hdr, uint8_t* buff)
 {
-  uint8_t const* ptr = buff;
-  rtEncoder_DecodeUInt16(&ptr, &hdr->version);
-  rtEncoder_DecodeUInt16(&ptr, &hdr->header_length);
+  if (hdr->topic_length >= RTMSG_HEADER_MAX_TOPIC_LENGTH ||
+      hdr->reply_topic_length >= RTMSG_HEADER_MAX_TOPIC_LENGTH)
+    return RT_ERROR_INVALID_ARG;
+
+  if (hdr->version == RTMSG_HEADER_VERSION_2)
+  {
+    if ((hdr->flags & rtMessageFlags_TopicAlias) &&
+        (hdr->topic_alias == 0 || hdr->topic_alias > RTMSG_HEADER_MAX_TOPIC_ALIASES))
+      return RT_ERROR_INVALID_ARG;
+    return rtMessageHeaderView_EncodeV2(hdr, buff);
+  }
+
+  // v1 has no aliases, the full topic is required
+  if ((hdr->flags & rtMessageFlags_TopicAlias) && hdr->topic_length == 0)
+    return RT_ERROR_INVALID_ARG;
+
+  hdr->version = RTMSG_HEADER_VERSION_1;
+  return rtMessageHeaderView_EncodeV1(hdr, buff);
+}
+
+static rtError
+rtMessageHeaderView_DecodeTopic(uint8_t const** itr, uint8_t const* end, uint32_t length,
+  char const** topic)
+{
+  if (length >= RTMSG_HEADER_MAX_TOPIC_LENGTH || (uint32_t) (end - *itr) < length)
+    return RT_ERROR_PROTOCOL_ERROR;
+  *topic = (char const *) *itr;
+  *itr += length;
+  return RT_OK;
+}
+
+static rtError
+rtMessageHeaderView_DecodeV1(rtMessageHeaderView* hdr, uint8_t const* ptr, uint8_t const* end)
+{
+  rtError err;
+
+  if (end - ptr < (RTMSG_HEADER_V1_FIXED_LENGTH - RTMSG_HEADER_PREAMBLE_LENGTH))
+    return RT_ERROR_PROTOCOL_ERROR;
+
+  hdr->topic_alias = 0;
+  memset(hdr->timestamps, 0, sizeof(hdr->timestamps));
   rtEncoder_DecodeUInt32(&ptr, &hdr->sequence_number);
   rtEncoder_DecodeUInt32(&ptr, &hdr->flags);
+  hdr->flags &= ~rtMessageFlags_Trace;
   rtEncoder_DecodeUInt32(&ptr, &hdr->control_data);
   rtEncoder_DecodeUInt32(&ptr, &hdr->payload_length);
-  rtEncoder_DecodeString(&ptr, hdr->topic, &hdr->topic_length);
-  rtEncoder_DecodeString(&ptr, hdr->reply_topic, &hdr->reply_topic_length);
+  rtEncoder_DecodeUInt32(&ptr, &hdr->topic_length);
+
+  err = rtMessageHeaderView_DecodeTopic(&ptr, end, hdr->topic_length, &hdr->topic);
+  if (err == RT_OK && end - ptr < 4)
+    err = RT_ERROR_PROTOCOL_ERROR;
+  if (err == RT_OK)
+  {
+    rtEncoder_DecodeUInt32(&ptr, &hdr->reply_topic_length);
+    err = rtMessageHeaderView_DecodeTopic(&ptr, end, hdr->reply_topic_length, &hdr->reply_topic);
+  }
+  return err;
+}
+
+// stamps from newer stages than this build knows about are skipped
+static rtError
+rtMessageHeaderView_DecodeTimestamps(rtMessageHeaderView* hdr, uint8_t const** itr, uint8_t const* end)
+{
+  uint32_t i;
+  uint32_t count;
+  rtError err;
+
+  err = rtEncoder_DecodeVarUInt32(itr, end, &count);
+  if (err != RT_OK)
+    return err;
+
+  if (count > (uint32_t) (end - *itr) / 8)
+    return RT_ERROR_PROTOCOL_ERROR;
+
+  for (i = 0; i < count; ++i)
+  {
+    uint64_t timestamp;
+    rtEncoder_DecodeUInt64(itr, &timestamp);
+    if (i < RTMSG_HEADER_WIRE_TIMESTAMPS)
+      hdr->timestamps[i] = timestamp;
+  }
   return RT_OK;
 }
 
+static rtError
+rtMessageHeaderView_DecodeV2(rtMessageHeaderView* hdr, uint8_t const* ptr, uint8_t const* end)
+{
+  rtError err;
+
+  hdr->topic_alias = 0;
+  memset(hdr->timestamps, 0, sizeof(hdr->timestamps));
+  err = rtEncoder_DecodeVarUInt32(&ptr, end, &hdr->sequence_number);
+  if (err == RT_OK)
+    err = rtEncoder_DecodeVarUInt32(&ptr, end, &hdr->flags);
+  if (err == RT_OK)
+    err = rtEncoder_DecodeVarUInt32(&ptr, end, &hdr->control_data);
+  if (err == RT_OK)
+    err = rtEncoder_DecodeVarUInt32(&ptr, end, &hdr->payload_length);
+  if (err == RT_OK)
+    err = rtEncoder_DecodeVarUInt32(&ptr, end, &hdr->topic_length);
+  if (err == RT_OK)
+    err = rtMessageHeaderView_DecodeTopic(&ptr, end, hdr->topic_length, &hdr->topic);
+  if (err == RT_OK && (hdr->flags & rtMessageFlags_TopicAlias))
+  {
+    err = rtEncoder_DecodeVarUInt32(&ptr, end, &hdr->topic_alias);
+    if (err == RT_OK && (hdr->topic_alias == 0 || hdr->topic_alias > RTMSG_HEADER_MAX_TOPIC_ALIASES))
+      err = RT_ERROR_PROTOCOL_ERROR;
+  }
+  if (err == RT_OK)
+    err = rtEncoder_DecodeVarUInt32(&ptr, end, &hdr->reply_topic_length);
+  if (err == RT_OK)
+    err = rtMessageHeaderView_DecodeTopic(&ptr, end, hdr->reply_topic_length, &hdr->reply_topic);
+  if (err == RT_OK && (hdr->flags & rtMessageFlags_Trace))
+    err = rtMessageHeaderView_DecodeTimestamps(hdr, &ptr, end);
+  return err;
+}
+
 rtError
-rtMessageHeader_SetIsRequest(rtMessageHeader* hdr)
+rtMessageHeaderView_Decode(rtMessageHeaderView* hdr, uint8_t const* buff, uint32_t n)
 {
-  hdr->flags |= rtMessageFlags_Request;
+  uint8_t const* ptr = buff;
+  uint8_t const* end;
+
+  if (n < RTMSG_HEADER_PREAMBLE_LENGTH)
+    return RT_ERROR_PROTOCOL_ERROR;
+
+  rtEncoder_DecodeUInt16(&ptr, &hdr->version);
+  rtEncoder_DecodeUInt16(&ptr, &hdr->header_length);
+  if (hdr->header_length < RTMSG_HEADER_PREAMBLE_LENGTH || hdr->header_length > n)
+    return RT_ERROR_PROTOCOL_ERROR;
+
+  end = buff + hdr->header_length;
+  switch (hdr->version)
+  {
+    case RTMSG_HEADER_VERSION_1:
+      return rtMessageHeaderView_DecodeV1(hdr, ptr, end);
+    case RTMSG_HEADER_VERSION_2:
+      return rtMessageHeaderView_DecodeV2(hdr, ptr, end);
+    default:
+      break;
+  }
+
+  rtLog_Warn("unsupported message header version:%d", (int) hdr->version);
+  return RT_ERROR_PROTOCOL_ERROR;
+}
+
+rtError
+rtMessageHeaderView_ToHeader(rtMessageHeaderView const* view, rtMessageHeader* hdr)
+{
+  if (view->topic_length >= RTMSG_HEADER_MAX_TOPIC_LENGTH ||
+      view->reply_topic_length >= RTMSG_HEADER_MAX_TOPIC_LENGTH)
+    return RT_ERROR_INVALID_ARG;
+
+  hdr->version = view->version;
+  hdr->header_length = view->header_length;
+  hdr->sequence_number = view->sequence_number;
+  hdr->flags = view->flags & ~rtMessageFlags_TopicAlias;
+  hdr->control_data = view->control_data;
+  hdr->payload_length = view->payload_length;
+  hdr->topic_length = view->topic_length;
+  memcpy(hdr->topic, view->topic, view->topic_length);
+  hdr->topic[view->topic_length] = '\0';
+  hdr->reply_topic_length = view->reply_topic_length;
+  memcpy(hdr->reply_topic, view->reply_topic, view->reply_topic_length);
+  hdr->reply_topic[view->reply_topic_length] = '\0';
+  memcpy(hdr->timestamps, view->timestamps, sizeof(hdr->timestamps));
   return RT_OK;
 }
 
 int
-rtMessageHeader_IsRequest(rtMessageHeader const* hdr)
+rtMessageHeaderView_IsRequest(rtMessageHeaderView const* hdr)
 {
   return ((hdr->flags & rtMessageFlags_Request) == rtMessageFlags_Request ? 1 : 0);
 }
+
+uint64_t
+rtMessageTimestamp_Now()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ((uint64_t) ts.tv_sec * 1000000000ull) + (uint64_t) ts.tv_nsec;
+}
@@ -21,6 +21,22 @@
 
 #define RTMSG_HEADER_MAX_TOPIC_LENGTH 128
 
+// v1 uses fixed width fields, v2 uses varints and is only sent to peers that
+// have advertised support for it
+#define RTMSG_HEADER_VERSION_1 1
+#define RTMSG_HEADER_VERSION_2 2
+#define RTMSG_HEADER_MAX_VERSION RTMSG_HEADER_VERSION_2
+
+// every version starts with uint16 version, uint16 header_length
+#define RTMSG_HEADER_PREAMBLE_LENGTH 4
+
+// topic aliases are numbered 1..RTMSG_HEADER_MAX_TOPIC_ALIASES per connection
+#define RTMSG_HEADER_MAX_TOPIC_ALIASES 64
+
+// largest payload either end will buffer, bigger local payloads travel in shared
+// memory slabs (rtMessageFlags_SharedPayload) and the payload is the slab's name
+#define RTMSG_MAX_PAYLOAD_LENGTH (16 * 1024 * 1024)
+
 // size of all fields in 
 // #define RTMSG_HEADER_SIZE (24 + (2 * RTMSG_HEADER_MAX_TOPIC_LENGTH))
 
@@ -31,9 +47,27 @@ extern "C" {
 typedef enum
 {
   rtMessageFlags_Request = 0x01,
-  rtMessageFlags_Response = 0x02
+  rtMessageFlags_Response = 0x02,
+  rtMessageFlags_TopicAlias = 0x04,
+  rtMessageFlags_SharedPayload = 0x08,
+  rtMessageFlags_Trace = 0x10
 } rtMessageFlags;
 
+/**
+ * Where a traced message (rtMessageFlags_Trace) was along its way, CLOCK_MONOTONIC
+ * nanoseconds. Comparable between processes on the same host only. The first
+ * three travel in the header, dispatch is filled in by the receiving connection
+ * just before the callback. Zero when a stage didn't stamp the message.
+ */
+typedef enum
+{
+  rtMessageTimestamp_Send = 0,
+  rtMessageTimestamp_RouterReceive = 1,
+  rtMessageTimestamp_RouterForward = 2,
+  rtMessageTimestamp_Dispatch = 3,
+  rtMessageTimestamp_Count = 4
+} rtMessageTimestamp;
+
 typedef struct
 {
   uint16_t version;
@@ -46,14 +80,54 @@ typedef struct
   char     topic[RTMSG_HEADER_MAX_TOPIC_LENGTH];
   uint32_t reply_topic_length;
   char     reply_topic[RTMSG_HEADER_MAX_TOPIC_LENGTH];
+  uint64_t timestamps[rtMessageTimestamp_Count];
 } rtMessageHeader;
 
+/**
+ * Same fields as rtMessageHeader but the topics reference external storage. When
+ * decoded, topic and reply_topic point into the source buffer and are not NUL
+ * terminated, use the length fields.
+ *
+ * v2 only: with rtMessageFlags_TopicAlias set, topic_alias follows the topic. A
+ * non-empty topic binds the alias to it, an empty topic refers to a previously
+ * bound alias. Aliases are scoped to a single connection.
+ *
+ * v2 only: with rtMessageFlags_Trace set, the reply topic is followed by a count
+ * and that many 64 bit timestamps. v1 encoding drops the flag.
+ */
+typedef struct
+{
+  uint16_t    version;
+  uint16_t    header_length;
+  uint32_t    sequence_number;
+  uint32_t    flags;
+  uint32_t    control_data;
+  uint32_t    payload_length;
+  uint32_t    topic_length;
+  char const* topic;
+  uint32_t    reply_topic_length;
+  char const* reply_topic;
+  uint32_t    topic_alias;
+  uint64_t    timestamps[rtMessageTimestamp_Count];
+} rtMessageHeaderView;
+
 rtError rtMessageHeader_Init(rtMessageHeader* hdr);
 rtError rtMessageHeader_Encode(rtMessageHeader* hdr, uint8_t* buff);
 rtError rtMessageHeader_Decode(rtMessageHeader* hdr, uint8_t const* buff);
 rtError rtMessageHeader_SetIsRequest(rtMessageHeader* hdr);
 int     rtMessageHeader_IsRequest(rtMessageHeader const* hdr);
 
+rtError rtMessageHeaderView_Init(rtMessageHeaderView* hdr);
+rtError rtMessageHeaderView_Encode(rtMessageHeaderView* hdr, uint8_t* buff);
+rtError rtMessageHeaderView_Decode(rtMessageHeaderView* hdr, uint8_t const* buff, uint32_t n);
+rtError rtMessageHeaderView_ToHeader(rtMessageHeaderView const* view, rtMessageHeader* hdr);
+int     rtMessageHeaderView_IsRequest(rtMessageHeaderView const* hdr);
+
+/**
+ * Current time in the clock used for trace timestamps.
+ */
+uint64_t rtMessageTimestamp_Now();
+
 #ifdef __cplusplus
 }
 #endif
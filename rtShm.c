@@ -0,0 +1,716 @@
+/* Copyright [2017] [Comcast, Corp.]
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include "rtShm.h"
+#include "rtLog.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#define RTSHM_MAGIC 0x72747368
+#define RTSHM_SLAB_MAGIC 0x72747362
+#define RTSHM_NUM_FDS 3
+#define RTSHM_SLAB_DIR "/dev/shm"
+
+// head and tail run freely and wrap, size is a power of two
+typedef struct
+{
+  uint32_t head;
+  uint8_t  pad0[60];
+  uint32_t tail;
+  uint8_t  pad1[60];
+} rtShmRingControl;
+
+// ring 0 carries client to router, ring 1 router to client. data for each ring
+// follows the header.
+typedef struct
+{
+  uint32_t          magic;
+  uint32_t          ring_size;
+  uint8_t           pad[56];
+  rtShmRingControl  rings[2];
+} rtShmRegion;
+
+typedef struct
+{
+  rtShmRingControl* control;
+  uint8_t*          data;
+  uint32_t          mask;
+} rtShmRing;
+
+struct _rtShmChannel
+{
+  rtShmRegion*  region;
+  size_t        region_size;
+  rtShmRing     rx;
+  rtShmRing     tx;
+  int           rx_fd;
+  int           tx_fd;
+};
+
+static void
+rtShmChannel_Map(rtShmChannel chan, int rx_ring)
+{
+  uint32_t size = chan->region->ring_size;
+  uint8_t* data = ((uint8_t *) chan->region) + sizeof(rtShmRegion);
+
+  chan->rx.control = &chan->region->rings[rx_ring];
+  chan->rx.data = data + (rx_ring * size);
+  chan->rx.mask = size - 1;
+  chan->tx.control = &chan->region->rings[!rx_ring];
+  chan->tx.data = data + (!rx_ring * size);
+  chan->tx.mask = size - 1;
+}
+
+static rtError
+rtShmChannel_SendFds(int sock, int const* fds)
+{
+  char c = 0;
+  struct iovec iov;
+  struct msghdr msg;
+  struct cmsghdr* cmsg;
+  char control[CMSG_SPACE(sizeof(int) * RTSHM_NUM_FDS)];
+
+  memset(&msg, 0, sizeof(msg));
+  memset(control, 0, sizeof(control));
+  iov.iov_base = &c;
+  iov.iov_len = 1;
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = control;
+  msg.msg_controllen = sizeof(control);
+
+  cmsg = CMSG_FIRSTHDR(&msg);
+  cmsg->cmsg_level = SOL_SOCKET;
+  cmsg->cmsg_type = SCM_RIGHTS;
+  cmsg->cmsg_len = CMSG_LEN(sizeof(int) * RTSHM_NUM_FDS);
+  memcpy(CMSG_DATA(cmsg), fds, sizeof(int) * RTSHM_NUM_FDS);
+
+  if (sendmsg(sock, &msg, MSG_NOSIGNAL) == -1)
+    return rtErrorFromErrno(errno);
+  return RT_OK;
+}
+
+static rtError
+rtShmChannel_RecvFds(int sock, int* fds)
+{
+  char c;
+  ssize_t n;
+  struct iovec iov;
+  struct msghdr msg;
+  struct cmsghdr* cmsg;
+  char control[CMSG_SPACE(sizeof(int) * RTSHM_NUM_FDS)];
+
+  memset(&msg, 0, sizeof(msg));
+  iov.iov_base = &c;
+  iov.iov_len = 1;
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = control;
+  msg.msg_controllen = sizeof(control);
+
+  do
+  {
+    n = recvmsg(sock, &msg, MSG_CMSG_CLOEXEC);
+  }
+  while (n == -1 && errno == EINTR);
+
+  if (n == -1)
+    return rtErrorFromErrno(errno);
+  if (n == 0)
+    return RT_ERROR_STREAM_CLOSED;
+
+  cmsg = CMSG_FIRSTHDR(&msg);
+  if (!cmsg || cmsg->cmsg_type != SCM_RIGHTS || cmsg->cmsg_len != CMSG_LEN(sizeof(int) * RTSHM_NUM_FDS))
+  {
+    rtLog_Warn("router didn't send a shared memory region");
+    return RT_ERROR_PROTOCOL_ERROR;
+  }
+
+  memcpy(fds, CMSG_DATA(cmsg), sizeof(int) * RTSHM_NUM_FDS);
+  return RT_OK;
+}
+
+rtError
+rtShmChannel_Create(rtShmChannel* chan, int sock, uint32_t ring_size)
+{
+  int fds[RTSHM_NUM_FDS];
+  rtError err;
+  rtShmChannel c;
+
+  if (ring_size == 0 || (ring_size & (ring_size - 1)) != 0)
+    return RT_ERROR_INVALID_ARG;
+
+  c = (rtShmChannel) calloc(1, sizeof(struct _rtShmChannel));
+  if (!c)
+    return rtErrorFromErrno(ENOMEM);
+
+  c->rx_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  c->tx_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  c->region_size = sizeof(rtShmRegion) + (2 * (size_t) ring_size);
+  fds[0] = memfd_create("rtmessage", MFD_CLOEXEC);
+
+  if (c->rx_fd == -1 || c->tx_fd == -1 || fds[0] == -1 || ftruncate(fds[0], c->region_size) == -1)
+  {
+    err = rtErrorFromErrno(errno);
+    goto error;
+  }
+
+  c->region = (rtShmRegion *) mmap(NULL, c->region_size, PROT_READ | PROT_WRITE, MAP_SHARED, fds[0], 0);
+  if (c->region == MAP_FAILED)
+  {
+    c->region = NULL;
+    err = rtErrorFromErrno(errno);
+    goto error;
+  }
+
+  c->region->magic = RTSHM_MAGIC;
+  c->region->ring_size = ring_size;
+  rtShmChannel_Map(c, 0);
+
+  // client's view: reads ring 1 and waits on our tx_fd
+  fds[1] = c->rx_fd;
+  fds[2] = c->tx_fd;
+  err = rtShmChannel_SendFds(sock, fds);
+  if (err != RT_OK)
+    goto error;
+
+  close(fds[0]);
+  *chan = c;
+  return RT_OK;
+
+error:
+  rtLog_Warn("failed to create shared memory channel. %s", rtStrError(err));
+  if (fds[0] != -1)
+    close(fds[0]);
+  rtShmChannel_Destroy(c);
+  return err;
+}
+
+rtError
+rtShmChannel_Open(rtShmChannel* chan, int sock)
+{
+  int fds[RTSHM_NUM_FDS];
+  rtError err;
+  struct stat st;
+  rtShmChannel c;
+
+  err = rtShmChannel_RecvFds(sock, fds);
+  if (err != RT_OK)
+    return err;
+
+  c = (rtShmChannel) calloc(1, sizeof(struct _rtShmChannel));
+  if (!c)
+  {
+    close(fds[0]);
+    close(fds[1]);
+    close(fds[2]);
+    return rtErrorFromErrno(ENOMEM);
+  }
+
+  // the router's rx is our tx
+  c->tx_fd = fds[1];
+  c->rx_fd = fds[2];
+
+  if (fstat(fds[0], &st) == -1 || (size_t) st.st_size < sizeof(rtShmRegion))
+  {
+    err = RT_ERROR_PROTOCOL_ERROR;
+    goto error;
+  }
+
+  c->region_size = st.st_size;
+  c->region = (rtShmRegion *) mmap(NULL, c->region_size, PROT_READ | PROT_WRITE, MAP_SHARED, fds[0], 0);
+  if (c->region == MAP_FAILED)
+  {
+    c->region = NULL;
+    err = rtErrorFromErrno(errno);
+    goto error;
+  }
+
+  if (c->region->magic != RTSHM_MAGIC ||
+      c->region_size != sizeof(rtShmRegion) + (2 * (size_t) c->region->ring_size))
+  {
+    err = RT_ERROR_PROTOCOL_ERROR;
+    goto error;
+  }
+
+  rtShmChannel_Map(c, 1);
+  close(fds[0]);
+  *chan = c;
+  return RT_OK;
+
+error:
+  rtLog_Warn("failed to open shared memory channel. %s", rtStrError(err));
+  close(fds[0]);
+  rtShmChannel_Destroy(c);
+  return err;
+}
+
+rtError
+rtShmChannel_Destroy(rtShmChannel chan)
+{
+  if (!chan)
+    return RT_ERROR_INVALID_ARG;
+  if (chan->region)
+    munmap(chan->region, chan->region_size);
+  if (chan->rx_fd != -1)
+    close(chan->rx_fd);
+  if (chan->tx_fd != -1)
+    close(chan->tx_fd);
+  free(chan);
+  return RT_OK;
+}
+
+int
+rtShmChannel_GetFd(rtShmChannel chan)
+{
+  return chan->rx_fd;
+}
+
+uint32_t
+rtShmChannel_GetCapacity(rtShmChannel chan)
+{
+  return chan->tx.mask + 1;
+}
+
+void
+rtShmChannel_ClearEvent(rtShmChannel chan)
+{
+  uint64_t count;
+  if (read(chan->rx_fd, &count, sizeof(count)) == -1 && errno != EAGAIN)
+    rtLog_Warn("failed to read shared memory event. %s", strerror(errno));
+}
+
+ssize_t
+rtShmChannel_Read(rtShmChannel chan, void* buff, size_t n)
+{
+  uint32_t head;
+  uint32_t tail;
+  uint32_t offset;
+  uint32_t count;
+  uint32_t first;
+  rtShmRing* ring = &chan->rx;
+
+  head = __atomic_load_n(&ring->control->head, __ATOMIC_RELAXED);
+  tail = __atomic_load_n(&ring->control->tail, __ATOMIC_SEQ_CST);
+
+  count = tail - head;
+  if (count > n)
+    count = (uint32_t) n;
+  if (count == 0)
+    return 0;
+
+  offset = head & ring->mask;
+  first = ring->mask + 1 - offset;
+  if (first > count)
+    first = count;
+  memcpy(buff, ring->data + offset, first);
+  memcpy((uint8_t *) buff + first, ring->data, count - first);
+
+  // pairs with the check in rtShmChannel_Write, see there
+  __atomic_store_n(&ring->control->head, head + count, __ATOMIC_SEQ_CST);
+  return count;
+}
+
+rtError
+rtShmChannel_Write(rtShmChannel chan, struct iovec const* iov, int iovcnt, int32_t timeout)
+{
+  int i;
+  uint32_t head;
+  uint32_t tail;
+  uint32_t size;
+  uint32_t offset;
+  size_t total;
+  useconds_t backoff;
+  struct timespec start;
+  struct timespec now;
+  rtShmRing* ring = &chan->tx;
+
+  size = ring->mask + 1;
+  for (i = 0, total = 0; i < iovcnt; ++i)
+    total += iov[i].iov_len;
+  if (total > size)
+    return RT_ERROR_INVALID_ARG;
+
+  backoff = 10;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  tail = __atomic_load_n(&ring->control->tail, __ATOMIC_RELAXED);
+
+  // the reader doesn't signal free space, poll for it
+  while (1)
+  {
+    head = __atomic_load_n(&ring->control->head, __ATOMIC_ACQUIRE);
+    if (size - (tail - head) >= total)
+      break;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    if (((now.tv_sec - start.tv_sec) * 1000) + ((now.tv_nsec - start.tv_nsec) / 1000000) >= timeout)
+      return RT_ERROR_TIMEOUT;
+
+    usleep(backoff);
+    if (backoff < 1000)
+      backoff *= 2;
+  }
+
+  offset = tail & ring->mask;
+  for (i = 0; i < iovcnt; ++i)
+  {
+    size_t first = size - offset;
+    size_t len = iov[i].iov_len;
+
+    if (first > len)
+      first = len;
+    memcpy(ring->data + offset, iov[i].iov_base, first);
+    memcpy(ring->data, (uint8_t const *) iov[i].iov_base + first, len - first);
+    offset = (offset + len) & ring->mask;
+  }
+
+  __atomic_store_n(&ring->control->tail, tail + (uint32_t) total, __ATOMIC_SEQ_CST);
+
+  // Only wake the reader if it had caught up with everything before this write.
+  // Both sides store their own index then load the other's, so either the reader
+  // sees the new tail before it stops draining or we see it caught up here.
+  head = __atomic_load_n(&ring->control->head, __ATOMIC_SEQ_CST);
+  if (head == tail)
+  {
+    uint64_t one = 1;
+    if (write(chan->tx_fd, &one, sizeof(one)) == -1 && errno != EAGAIN)
+      return rtErrorFromErrno(errno);
+  }
+
+  return RT_OK;
+}
+
+// holders are the pids that were handed a reference, a slot is 0 when free
+typedef struct
+{
+  uint32_t          magic;
+  uint32_t          ref_count;
+  uint32_t          length;
+  uint32_t          reserved;
+  int32_t           holders[RTSHM_SLAB_MAX_HOLDERS];
+  uint8_t           data[];
+} rtShmSlabRegion;
+
+struct _rtShmSlab
+{
+  rtShmSlabRegion*  region;
+  size_t            region_size;
+  char              name[RTSHM_SLAB_NAME_MAX];
+};
+
+// only names of the form rtShmSlab_Create makes, "/rtmessage.<pid>.<n>"
+static int
+rtShmSlab_ParseName(char const* name, uint32_t name_length, pid_t* pid)
+{
+  static char const prefix[] = "/rtmessage.";
+  uint32_t i;
+  uint32_t digits;
+  long owner;
+
+  if (name_length >= RTSHM_SLAB_NAME_MAX || name_length <= sizeof(prefix) - 1 ||
+      memcmp(name, prefix, sizeof(prefix) - 1) != 0)
+    return 0;
+
+  owner = 0;
+  i = sizeof(prefix) - 1;
+  for (digits = 0; i < name_length && name[i] >= '0' && name[i] <= '9'; ++i, ++digits)
+  {
+    if (digits >= 10)
+      return 0;
+    owner = (owner * 10) + (name[i] - '0');
+  }
+  if (digits == 0 || i >= name_length || name[i++] != '.')
+    return 0;
+
+  for (digits = 0; i < name_length && name[i] >= '0' && name[i] <= '9'; ++i, ++digits)
+    ;
+  if (digits == 0 || digits > 10 || i != name_length)
+    return 0;
+
+  if (pid)
+    *pid = (pid_t) owner;
+  return 1;
+}
+
+rtError
+rtShmSlab_Create(rtShmSlab* slab, uint8_t const* buff, uint32_t n)
+{
+  int fd;
+  int i;
+  rtError err;
+  rtShmSlab s;
+  static uint32_t next_id = 0;
+
+  s = (rtShmSlab) calloc(1, sizeof(struct _rtShmSlab));
+  if (!s)
+    return rtErrorFromErrno(ENOMEM);
+
+  // names are only unique per process, skip over anything left by a crashed one
+  fd = -1;
+  for (i = 0; i < 16 && fd == -1; ++i)
+  {
+    snprintf(s->name, sizeof(s->name), "/rtmessage.%d.%u", (int) getpid(),
+      __atomic_fetch_add(&next_id, 1, __ATOMIC_RELAXED));
+    fd = shm_open(s->name, O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0600);
+    if (fd == -1 && errno != EEXIST)
+      break;
+  }
+
+  if (fd == -1)
+  {
+    err = rtErrorFromErrno(errno);
+    rtLog_Warn("failed to create shared memory slab. %s", rtStrError(err));
+    free(s);
+    return err;
+  }
+
+  s->region_size = sizeof(rtShmSlabRegion) + n + 1;
+  if (ftruncate(fd, s->region_size) == -1)
+  {
+    err = rtErrorFromErrno(errno);
+    goto error;
+  }
+
+  s->region = (rtShmSlabRegion *) mmap(NULL, s->region_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if (s->region == MAP_FAILED)
+  {
+    s->region = NULL;
+    err = rtErrorFromErrno(errno);
+    goto error;
+  }
+
+  close(fd);
+  s->region->magic = RTSHM_SLAB_MAGIC;
+  s->region->ref_count = 1;
+  s->region->length = n;
+  memcpy(s->region->data, buff, n);
+  s->region->data[n] = '\0';
+  *slab = s;
+  return RT_OK;
+
+error:
+  rtLog_Warn("failed to create shared memory slab. %s", rtStrError(err));
+  close(fd);
+  shm_unlink(s->name);
+  free(s);
+  return err;
+}
+
+rtError
+rtShmSlab_Open(rtShmSlab* slab, char const* name, uint32_t name_length)
+{
+  int fd;
+  rtError err;
+  struct stat st;
+  rtShmSlab s;
+
+  if (!rtShmSlab_ParseName(name, name_length, NULL))
+    return RT_ERROR_INVALID_ARG;
+
+  s = (rtShmSlab) calloc(1, sizeof(struct _rtShmSlab));
+  if (!s)
+    return rtErrorFromErrno(ENOMEM);
+
+  memcpy(s->name, name, name_length);
+  s->name[name_length] = '\0';
+
+  fd = shm_open(s->name, O_RDWR | O_CLOEXEC, 0);
+  if (fd == -1)
+  {
+    err = rtErrorFromErrno(errno);
+    rtLog_Warn("failed to open shared memory slab %s. %s", s->name, rtStrError(err));
+    free(s);
+    return err;
+  }
+
+  err = RT_OK;
+  if (fstat(fd, &st) == -1)
+    err = rtErrorFromErrno(errno);
+  else if ((size_t) st.st_size <= sizeof(rtShmSlabRegion))
+    err = RT_ERROR_PROTOCOL_ERROR;
+
+  if (err == RT_OK)
+  {
+    s->region_size = st.st_size;
+    s->region = (rtShmSlabRegion *) mmap(NULL, s->region_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (s->region == MAP_FAILED)
+    {
+      s->region = NULL;
+      err = rtErrorFromErrno(errno);
+    }
+  }
+  close(fd);
+
+  if (err == RT_OK && (s->region->magic != RTSHM_SLAB_MAGIC ||
+      s->region_size != sizeof(rtShmSlabRegion) + s->region->length + 1))
+    err = RT_ERROR_PROTOCOL_ERROR;
+
+  if (err != RT_OK)
+  {
+    rtLog_Warn("failed to map shared memory slab %s. %s", s->name, rtStrError(err));
+    rtShmSlab_Close(s);
+    return err;
+  }
+
+  *slab = s;
+  return RT_OK;
+}
+
+int
+rtShmSlab_IsOwnedBy(char const* name, uint32_t name_length, pid_t pid)
+{
+  pid_t owner;
+  return rtShmSlab_ParseName(name, name_length, &owner) && owner == pid;
+}
+
+void
+rtShmSlab_Unlink(char const* name, uint32_t name_length)
+{
+  char buff[RTSHM_SLAB_NAME_MAX];
+
+  if (!rtShmSlab_ParseName(name, name_length, NULL))
+    return;
+
+  memcpy(buff, name, name_length);
+  buff[name_length] = '\0';
+  shm_unlink(buff);
+}
+
+char const*
+rtShmSlab_GetName(rtShmSlab slab)
+{
+  return slab->name;
+}
+
+uint8_t const*
+rtShmSlab_GetData(rtShmSlab slab)
+{
+  return slab->region->data;
+}
+
+uint32_t
+rtShmSlab_GetLength(rtShmSlab slab)
+{
+  return slab->region->length;
+}
+
+rtError
+rtShmSlab_AddHolder(rtShmSlab slab, pid_t pid)
+{
+  int i;
+
+  for (i = 0; i < RTSHM_SLAB_MAX_HOLDERS; ++i)
+  {
+    int32_t expected = 0;
+    if (__atomic_compare_exchange_n(&slab->region->holders[i], &expected, (int32_t) pid, 0,
+        __ATOMIC_ACQ_REL, __ATOMIC_RELAXED))
+    {
+      __atomic_add_fetch(&slab->region->ref_count, 1, __ATOMIC_RELAXED);
+      return RT_OK;
+    }
+  }
+  return rtErrorFromErrno(ENOSPC);
+}
+
+int
+rtShmSlab_ReleaseHolder(rtShmSlab slab, pid_t pid)
+{
+  int i;
+
+  // whoever clears the slot drops the reference, so the holder and someone
+  // cleaning up after it can't both do it
+  for (i = 0; i < RTSHM_SLAB_MAX_HOLDERS; ++i)
+  {
+    int32_t expected = (int32_t) pid;
+    if (__atomic_compare_exchange_n(&slab->region->holders[i], &expected, 0, 0,
+        __ATOMIC_ACQ_REL, __ATOMIC_RELAXED))
+    {
+      rtShmSlab_Release(slab);
+      return 1;
+    }
+  }
+  return 0;
+}
+
+int
+rtShmSlab_IsHeldBy(rtShmSlab slab, pid_t pid)
+{
+  int i;
+
+  for (i = 0; i < RTSHM_SLAB_MAX_HOLDERS; ++i)
+  {
+    if (__atomic_load_n(&slab->region->holders[i], __ATOMIC_ACQUIRE) == (int32_t) pid)
+      return 1;
+  }
+  return 0;
+}
+
+int
+rtShmSlab_Sweep()
+{
+  int count;
+  DIR* dir;
+  pid_t owner;
+  struct dirent* entry;
+  char name[RTSHM_SLAB_NAME_MAX];
+
+  dir = opendir(RTSHM_SLAB_DIR);
+  if (!dir)
+    return 0;
+
+  count = 0;
+  while ((entry = readdir(dir)) != NULL)
+  {
+    int n = snprintf(name, sizeof(name), "/%s", entry->d_name);
+    if (n <= 0 || n >= (int) sizeof(name) || !rtShmSlab_ParseName(name, (uint32_t) n, &owner))
+      continue;
+    if (kill(owner, 0) == -1 && errno == ESRCH && shm_unlink(name) == 0)
+      count++;
+  }
+  closedir(dir);
+  return count;
+}
+
+void
+rtShmSlab_Release(rtShmSlab slab)
+{
+  if (__atomic_sub_fetch(&slab->region->ref_count, 1, __ATOMIC_ACQ_REL) == 0)
+    shm_unlink(slab->name);
+}
+
+void
+rtShmSlab_Close(rtShmSlab slab)
+{
+  if (!slab)
+    return;
+  if (slab->region)
+    munmap(slab->region, slab->region_size);
+  free(slab);
+}
@@ -0,0 +1,159 @@
+/* Copyright [2017] [Comcast, Corp.]
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef __RT_SHM_H__
+#define __RT_SHM_H__
+
+#include "rtError.h"
+
+#include <stdint.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+
+#define RTSHM_DEFAULT_RING_SIZE (1024 * 1024)
+#define RTSHM_SLAB_NAME_MAX 64
+#define RTSHM_SLAB_MAX_HOLDERS 28
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * A bidirectional byte stream between the router and one local client: two single
+ * producer/single consumer rings in a memfd, with an eventfd per direction for
+ * wakeups. The router creates the channel and passes the memfd and eventfds over
+ * the unix socket the client connected on. That socket stays open so either side
+ * notices when the other goes away.
+ */
+struct _rtShmChannel;
+typedef struct _rtShmChannel* rtShmChannel;
+
+/**
+ * Router side. Creates the shared region and sends it to the client on sock.
+ * @param chan
+ * @param sock connected unix domain socket
+ * @param ring_size bytes per direction, power of two
+ */
+rtError rtShmChannel_Create(rtShmChannel* chan, int sock, uint32_t ring_size);
+
+/**
+ * Client side. Receives the region from the router on sock and maps it.
+ */
+rtError rtShmChannel_Open(rtShmChannel* chan, int sock);
+
+rtError rtShmChannel_Destroy(rtShmChannel chan);
+
+/**
+ * File descriptor that becomes readable when the peer has written to an empty ring.
+ * Readers must drain the ring with rtShmChannel_Read after every wakeup.
+ */
+int rtShmChannel_GetFd(rtShmChannel chan);
+
+/**
+ * Resets the wakeup fd, call before draining the ring.
+ */
+void rtShmChannel_ClearEvent(rtShmChannel chan);
+
+/**
+ * Copies up to n bytes out of the ring without blocking.
+ * @return number of bytes read, 0 when the ring is empty
+ */
+ssize_t rtShmChannel_Read(rtShmChannel chan, void* buff, size_t n);
+
+/**
+ * Largest write rtShmChannel_Write accepts, larger messages have to go in a slab.
+ */
+uint32_t rtShmChannel_GetCapacity(rtShmChannel chan);
+
+/**
+ * Writes all of iov as one unit, waiting up to timeout milliseconds for room.
+ * Nothing is written on failure so message framing is preserved.
+ */
+rtError rtShmChannel_Write(rtShmChannel chan, struct iovec const* iov, int iovcnt, int32_t timeout);
+
+/**
+ * A named, reference counted shared memory segment holding one message payload.
+ * Publishers copy a large payload into a slab once and send its name, local
+ * subscribers map the same pages. Whoever drops the last reference unlinks it.
+ * Handles are per process, closing one doesn't affect the reference count.
+ * Slabs are only readable by the user that created them and are named
+ * /rtmessage.<pid>.<n> after the creating process, nothing else is opened.
+ */
+struct _rtShmSlab;
+typedef struct _rtShmSlab* rtShmSlab;
+
+/**
+ * Creates a slab holding a copy of buff with a single reference, the creator's.
+ * The data is followed by a NUL for the benefit of string parsers.
+ */
+rtError rtShmSlab_Create(rtShmSlab* slab, uint8_t const* buff, uint32_t n);
+
+/**
+ * Maps an existing slab by name, name needn't be NUL terminated.
+ */
+rtError rtShmSlab_Open(rtShmSlab* slab, char const* name, uint32_t name_length);
+
+/**
+ * Whether name is one rtShmSlab_Create made in process pid. Check names that come
+ * from a peer against the peer's pid before opening them.
+ */
+int rtShmSlab_IsOwnedBy(char const* name, uint32_t name_length, pid_t pid);
+
+/**
+ * Removes a slab by name without mapping it, for a reference that was handed over
+ * but can't be opened and so can't be released.
+ */
+void rtShmSlab_Unlink(char const* name, uint32_t name_length);
+
+char const* rtShmSlab_GetName(rtShmSlab slab);
+uint8_t const* rtShmSlab_GetData(rtShmSlab slab);
+uint32_t rtShmSlab_GetLength(rtShmSlab slab);
+
+/**
+ * Takes a reference on behalf of process pid and records it in the slab, so that
+ * it can be dropped for pid with rtShmSlab_ReleaseHolder if pid never gets to.
+ * Fails once RTSHM_SLAB_MAX_HOLDERS references are held this way.
+ */
+rtError rtShmSlab_AddHolder(rtShmSlab slab, pid_t pid);
+
+/**
+ * Drops one of pid's references, either by pid itself or by someone cleaning up
+ * after it. Safe to race, only one caller drops each reference.
+ * @return 1 if a reference was dropped, 0 if pid held none
+ */
+int rtShmSlab_ReleaseHolder(rtShmSlab slab, pid_t pid);
+
+int rtShmSlab_IsHeldBy(rtShmSlab slab, pid_t pid);
+
+/**
+ * Drops the creator's reference, the handle stays open.
+ */
+void rtShmSlab_Release(rtShmSlab slab);
+
+/**
+ * Unlinks every slab made by a process that no longer exists. Only safe when
+ * nothing still depends on those slabs, e.g. when the router starts.
+ * @return number of slabs removed
+ */
+int rtShmSlab_Sweep();
+
+/**
+ * Unmaps the slab and frees the handle.
+ */
+void rtShmSlab_Close(rtShmSlab slab);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
@@ -123,6 +123,15 @@ rtSocketStorage_FromString(struct sockaddr_storage* ss, char const* addr)
     return RT_OK;
   }
 
+  // shared memory rings are set up over a unix domain socket at the same path
+  if (strncmp(addr, "shm://", 6) == 0)
+  {
+    struct sockaddr_un* un = (struct sockaddr_un*) ss;
+    un->sun_family = AF_UNIX;
+    strcpy(un->sun_path, addr + 6);
+    return RT_OK;
+  }
+
   if (strncmp(addr, "tcp://", 6) != 0)
     return RT_ERROR_INVALID_ARG;
 
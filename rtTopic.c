@@ -0,0 +1,127 @@
+/* Copyright [2017] [Comcast, Corp.]
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "rtTopic.h"
+
+#include <string.h>
+
+uint32_t
+rtTopic_Hash(char const* topic, uint32_t topic_length)
+{
+  uint32_t i;
+  uint32_t h = 2166136261u;
+  for (i = 0; i < topic_length; ++i)
+  {
+    h ^= (uint8_t) topic[i];
+    h *= 16777619u;
+  }
+  return h;
+}
+
+static int
+rtTopic_IsMatchFrom(char const* t, char const* end, char const* e)
+{
+  while (t < end && *e)
+  {
+    if (*e == '*')
+    {
+      // memchr is vectorized, segments are often long
+      char const* dot = (char const *) memchr(t, '.', end - t);
+      t = dot ? dot : end;
+      e++;
+    }
+
+    if (*e == '>')
+    {
+      t = end;
+      e++;
+    }
+
+    if (!(t < end || *e))
+      break;
+
+    if (t == end || *t != *e)
+      break;
+
+    t++;
+    e++;
+  }
+
+  return !(t < end || *e);
+}
+
+int
+rtTopic_IsMatch(char const* topic, uint32_t topic_length, char const* expression)
+{
+  return rtTopic_IsMatchFrom(topic, topic + topic_length, expression);
+}
+
+void
+rtTopicExpression_Compile(rtTopicExpression* exp, char const* expression)
+{
+  uint32_t n = (uint32_t) strlen(expression);
+  uint32_t prefix = (uint32_t) strcspn(expression, "*>");
+
+  exp->expression = expression;
+  exp->length = n;
+  exp->prefix_length = prefix;
+  exp->suffix_length = 0;
+  exp->hash = 0;
+
+  if (prefix == n)
+  {
+    exp->type = rtTopicExpressionType_Literal;
+    exp->hash = rtTopic_Hash(expression, n);
+  }
+  else if (expression[prefix] == '>' && prefix + 1 == n)
+  {
+    exp->type = rtTopicExpressionType_Prefix;
+  }
+  else
+  {
+    // without '>' the text after the last '*' has to be exactly the end of the topic
+    exp->type = rtTopicExpressionType_Pattern;
+    if (!strchr(expression, '>'))
+      exp->suffix_length = n - (uint32_t) (strrchr(expression, '*') - expression) - 1;
+  }
+}
+
+int
+rtTopicExpression_IsMatch(rtTopicExpression const* exp, char const* topic, uint32_t topic_length,
+  uint32_t topic_hash)
+{
+  switch (exp->type)
+  {
+    case rtTopicExpressionType_Literal:
+      return exp->hash == topic_hash && exp->length == topic_length &&
+        memcmp(exp->expression, topic, topic_length) == 0;
+
+    // '>' needs at least one character to swallow
+    case rtTopicExpressionType_Prefix:
+      return topic_length > exp->prefix_length &&
+        memcmp(exp->expression, topic, exp->prefix_length) == 0;
+
+    default:
+      break;
+  }
+
+  if (topic_length < exp->prefix_length + exp->suffix_length ||
+      memcmp(exp->expression, topic, exp->prefix_length) != 0 ||
+      memcmp(exp->expression + exp->length - exp->suffix_length,
+        topic + topic_length - exp->suffix_length, exp->suffix_length) != 0)
+    return 0;
+
+  return rtTopic_IsMatchFrom(topic + exp->prefix_length, topic + topic_length,
+    exp->expression + exp->prefix_length);
+}
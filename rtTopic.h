@@ -0,0 +1,82 @@
+/* Copyright [2017] [Comcast, Corp.]
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef __RT_TOPIC_H__
+#define __RT_TOPIC_H__
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Topic expressions are compared a character at a time except for
+ *   '*' matches the rest of the current topic segment, up to the next '.'
+ *   '>' matches one or more remaining characters
+ * Topics are not NUL terminated, they usually point into a read buffer.
+ */
+typedef enum
+{
+  rtTopicExpressionType_Literal,  // no wildcards, plain equality
+  rtTopicExpressionType_Prefix,   // literal prefix followed by a final '>'
+  rtTopicExpressionType_Pattern   // everything else
+} rtTopicExpressionType;
+
+/**
+ * An expression classified once so the common cases skip the character loop.
+ * The expression string isn't copied and has to outlive this.
+ */
+typedef struct
+{
+  char const*           expression;
+  uint32_t              length;
+  uint32_t              prefix_length;  // characters before the first wildcard
+  uint32_t              suffix_length;  // characters after the last '*' of patterns without '>'
+  uint32_t              hash;           // rtTopic_Hash of the expression, literals only
+  rtTopicExpressionType type;
+} rtTopicExpression;
+
+/**
+ * FNV-1a of the topic
+ */
+uint32_t rtTopic_Hash(char const* topic, uint32_t topic_length);
+
+/**
+ * Matches without any precompiling
+ * @param topic
+ * @param topic_length
+ * @param expression NUL terminated
+ * @return non-zero on a match
+ */
+int rtTopic_IsMatch(char const* topic, uint32_t topic_length, char const* expression);
+
+void rtTopicExpression_Compile(rtTopicExpression* exp, char const* expression);
+
+/**
+ * Same result as rtTopic_IsMatch
+ * @param exp
+ * @param topic
+ * @param topic_length
+ * @param topic_hash rtTopic_Hash of the topic, worked out once by callers matching
+ *   one topic against many expressions
+ * @return non-zero on a match
+ */
+int rtTopicExpression_IsMatch(rtTopicExpression const* exp, char const* topic, uint32_t topic_length,
+  uint32_t topic_hash);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
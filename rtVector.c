@@ -16,6 +16,8 @@
 
 #include <errno.h>
 #include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
 
 #define RTVECT_BLOCKSIZE 16
 
@@ -58,58 +60,166 @@ rtVector_Destroy(rtVector v, rtVector_Cleanup destroyer)
   return RT_OK;
 }
 
+static rtError
+rtVector_Grow(rtVector v, size_t capacity)
+{
+  void** data;
+
+  if (capacity <= v->capacity)
+    return RT_OK;
+
+  data = (void **) realloc(v->data, capacity * sizeof(void *));
+  if (!data)
+    return rtErrorFromErrno(ENOMEM);
+
+  v->data = data;
+  v->capacity = capacity;
+  return RT_OK;
+}
+
+static ssize_t
+rtVector_IndexOf(rtVector v, void* item)
+{
+  size_t i;
+  for (i = 0; i < v->count; ++i)
+  {
+    if (v->data[i] == item)
+      return (ssize_t) i;
+  }
+  return -1;
+}
+
 rtError
 rtVector_PushBack(rtVector v, void* item)
 {
+  rtError err;
+
   if (!v)
     return RT_ERROR_INVALID_ARG;
 
-  if (!v->data)
-  {
-    v->data = calloc(RTVECT_BLOCKSIZE, sizeof(void *));
-    v->capacity = RTVECT_BLOCKSIZE;
-  }
-  else if (v->count + 1 >= v->capacity)
+  if (v->count == v->capacity)
   {
-    v->data = realloc(v->data, v->capacity + RTVECT_BLOCKSIZE);
-    v->capacity += RTVECT_BLOCKSIZE;
+    err = rtVector_Grow(v, v->capacity ? (v->capacity * 2) : RTVECT_BLOCKSIZE);
+    if (err != RT_OK)
+      return err;
   }
 
-  if (!v->data)
-    return rtErrorFromErrno(ENOMEM);
-
   v->data[v->count++] = item;
   return RT_OK;
 }
 
+rtError
+rtVector_Reserve(rtVector v, size_t capacity)
+{
+  if (!v)
+    return RT_ERROR_INVALID_ARG;
+  return rtVector_Grow(v, capacity);
+}
+
 rtError
 rtVector_RemoveItem(rtVector v, void* item, rtVector_Cleanup destroyer)
+{
+  ssize_t i;
+
+  if (!v)
+    return RT_ERROR_INVALID_ARG;
+
+  i = rtVector_IndexOf(v, item);
+  if (i == -1)
+    return RT_ERROR_INVALID_ARG;
+
+  return rtVector_RemoveAt(v, (size_t) i, destroyer);
+}
+
+rtError
+rtVector_RemoveAt(rtVector v, size_t index, rtVector_Cleanup destroyer)
+{
+  if (!v || index >= v->count)
+    return RT_ERROR_INVALID_ARG;
+
+  if (destroyer)
+    destroyer(v->data[index]);
+
+  memmove(&v->data[index], &v->data[index + 1], (v->count - index - 1) * sizeof(void *));
+  v->data[--v->count] = NULL;
+  return RT_OK;
+}
+
+rtError
+rtVector_SwapRemoveItem(rtVector v, void* item, rtVector_Cleanup destroyer)
+{
+  ssize_t i;
+
+  if (!v)
+    return RT_ERROR_INVALID_ARG;
+
+  i = rtVector_IndexOf(v, item);
+  if (i == -1)
+    return RT_ERROR_INVALID_ARG;
+
+  return rtVector_SwapRemoveAt(v, (size_t) i, destroyer);
+}
+
+rtError
+rtVector_SwapRemoveAt(rtVector v, size_t index, rtVector_Cleanup destroyer)
+{
+  if (!v || index >= v->count)
+    return RT_ERROR_INVALID_ARG;
+
+  if (destroyer)
+    destroyer(v->data[index]);
+
+  v->data[index] = v->data[v->count - 1];
+  v->data[--v->count] = NULL;
+  return RT_OK;
+}
+
+rtError
+rtVector_RemoveIf(rtVector v, rtVector_Predicate predicate, void* closure,
+  rtVector_Cleanup destroyer)
 {
   size_t i;
-  for (i = 0; i < v->count; ++i)
+  size_t j;
+
+  if (!v || !predicate)
+    return RT_ERROR_INVALID_ARG;
+
+  for (i = 0, j = 0; i < v->count; ++i)
   {
-    if (v->data[i] == item)
+    if (predicate(v->data[i], closure))
     {
       if (destroyer)
         destroyer(v->data[i]);
-      break;
+    }
+    else
+    {
+      v->data[j++] = v->data[i];
     }
   }
 
-  while (i < v->count)
-  {
-    v->data[i] = v->data[i+1];
-    i++;
-  }
+  for (i = j; i < v->count; ++i)
+    v->data[i] = NULL;
 
-  v->count -= 1;
+  v->count = j;
+  return RT_OK;
+}
+
+rtError
+rtVector_Clear(rtVector v, rtVector_Cleanup destroyer)
+{
+  size_t i;
 
-  while (i < v->capacity)
+  if (!v)
+    return RT_ERROR_INVALID_ARG;
+
+  for (i = 0; i < v->count; ++i)
   {
+    if (destroyer)
+      destroyer(v->data[i]);
     v->data[i] = NULL;
-    i++;
   }
 
+  v->count = 0;
   return RT_OK;
 }
 
@@ -22,11 +22,24 @@ struct _rtVector;
 typedef struct _rtVector* rtVector;
 
 typedef void (*rtVector_Cleanup)(void *);
+typedef int  (*rtVector_Predicate)(void* item, void* closure);
 
 rtError rtVector_Create(rtVector* v);
 rtError rtVector_Destroy(rtVector v, rtVector_Cleanup destroyer);
 rtError rtVector_PushBack(rtVector v, void* item);
+rtError rtVector_Reserve(rtVector v, size_t capacity);
 rtError rtVector_RemoveItem(rtVector v, void* item, rtVector_Cleanup destroyer);
+rtError rtVector_RemoveAt(rtVector v, size_t index, rtVector_Cleanup destroyer);
+
+/* O(1) removal that moves the last item into the vacated slot. Does not preserve order. */
+rtError rtVector_SwapRemoveItem(rtVector v, void* item, rtVector_Cleanup destroyer);
+rtError rtVector_SwapRemoveAt(rtVector v, size_t index, rtVector_Cleanup destroyer);
+
+/* Removes every item matching the predicate in a single pass, preserving order. */
+rtError rtVector_RemoveIf(rtVector v, rtVector_Predicate predicate, void* closure,
+  rtVector_Cleanup destroyer);
+rtError rtVector_Clear(rtVector v, rtVector_Cleanup destroyer);
+
 void*   rtVector_At(rtVector v, size_t index);
 size_t  rtVector_Size(rtVector v);
 
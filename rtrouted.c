@@ -12,27 +12,42 @@
  * See the License for the specific language governing permissions and
  * limitations under the License.
  */
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
 #include "rtMessage.h"
 #include "rtDebug.h"
 #include "rtLog.h"
 #include "rtEncoder.h"
 #include "rtError.h"
 #include "rtMessageHeader.h"
+#include "rtShm.h"
 #include "rtSocket.h"
+#include "rtTopic.h"
 #include "rtVector.h"
 #include "rtConnection.h"
+#ifdef RTROUTED_WITH_IO_URING
+#include "rtIoUring.h"
+#endif
 
 #include <arpa/inet.h>
 #include <errno.h>
 #include <getopt.h>
 #include <netinet/in.h>
 #include <netinet/tcp.h>
+#include <poll.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
 #include <sys/socket.h>
 #include <sys/types.h>
+#include <sys/un.h>
+#include <time.h>
 #include <unistd.h>
 #include <sys/file.h>
 
@@ -42,18 +57,119 @@
 #define RTMSG_INVALID_FD -1
 #define RTMSG_MAX_EXPRESSION_LEN 128
 #define RTMSG_ADDR_MAX 128
+#define RTMSG_MAX_LISTENERS 8
+#define RTMSG_LISTEN_BACKLOG SOMAXCONN
+#define RTMSG_DEFAULT_SOCKET "tcp://127.0.0.1:10001"
+#define RTMSG_ROUTE_CACHE_SIZE 1024
+#define RTMSG_MAX_SHARDS 64
+#define RTMSG_SHARD_RING_SIZE 4096
+#define RTMSG_SHARD_MAX_EVENTS 64
+#define RTMSG_SHARD_POST_RETRIES 1000
+#define RTMSG_SHM_SEND_POLL 100
+#define RTMSG_SHM_STALL_WARN 10
+#define RTMSG_URING_ENTRIES 1024
+#define RTMSG_URING_MAX_FILES 1024
+#define RTMSG_URING_NUM_BUFFERS 256
+#define RTMSG_URING_BUFFER_SIZE (1024 * 8)
+#define RTMSG_URING_MAX_IOV 64
+#define RTMSG_URING_MAX_QUEUED_BYTES (4 * 1024 * 1024)
+#define RTMSG_URING_RESUME_QUEUED_BYTES (RTMSG_URING_MAX_QUEUED_BYTES / 2)
+#define RTMSG_URING_CONGESTED_WARN_INTERVAL 10
+#define RTMSG_STATS_TOPIC "_RTROUTED.STATS"
+
+// The routes matching a single topic, valid while generation matches the route table.
+// Used for the topic cache and for client topic aliases.
+typedef struct
+{
+  uint32_t                  generation;
+  uint32_t                  hash;
+  uint32_t                  topic_length;
+  char                      topic[RTMSG_HEADER_MAX_TOPIC_LENGTH];
+  rtVector                  routes;
+} rtRouteSet;
+
+struct _rtRouterShard;
+
+// Counters only ever go up and are read from any thread. Most are bumped by the
+// thread that owns them, but route counters and a client's dropped count are also
+// bumped by whichever shard is routing a message, so every update is an atomic add.
+// Relaxed is enough, a snapshot isn't consistent across counters anyway.
+typedef struct
+{
+  uint64_t                  messages_in;
+  uint64_t                  bytes_in;
+  uint64_t                  messages_out;
+  uint64_t                  bytes_out;
+  uint64_t                  dropped;
+} rtTrafficStats;
+
+// per thread totals, summed when a snapshot is taken
+typedef struct
+{
+  rtTrafficStats            traffic;
+  uint64_t                  no_route;
+  uint64_t                  connections;
+  uint64_t                  disconnections;
+} rtRouterStats;
+
+// A message waiting for its turn on an io_uring client's socket. Header and
+// payload are copied together since the source buffers are reused right away.
+typedef struct _rtOutboundMessage
+{
+  struct _rtOutboundMessage* next;
+  uint32_t                  length;
+  uint8_t                   data[];
+} rtOutboundMessage;
+
+// A slab reference handed to a client, kept until the client drops it so that the
+// router can drop it instead if the client goes away first. Clients dispatch in
+// order, so the oldest are released first.
+typedef struct _rtHeldSlab
+{
+  struct _rtHeldSlab*       next;
+  rtShmSlab                 slab;
+} rtHeldSlab;
 
 typedef struct
 {
   int                       fd;
   struct sockaddr_storage   endpoint;
   char                      ident[RTMSG_ADDR_MAX];
+  struct _rtRouterShard*    shard;
+  rtShmChannel              shm;
   uint8_t*                  read_buffer;
+  uint32_t                  read_buffer_capacity;
   uint8_t*                  send_buffer;
   rtConnectionState         state;
   int                       bytes_read;
   int                       bytes_to_read;
-  rtMessageHeader           header;
+  rtMessageHeaderView       header;
+  uint16_t                  header_version;
+  int                       shared_payload;
+  pid_t                     peer_pid;
+  uid_t                     peer_uid;
+  rtShmSlab                 current_slab;
+  rtHeldSlab*               held_head;
+  rtHeldSlab*               held_tail;
+  rtVector                  routes;
+  rtRouteSet*               topic_aliases;
+  rtRouteSet*               current_alias;
+  int                       file_slot;
+  int                       uring_ops;
+  int                       send_in_flight;
+  int                       send_pending;
+  uint32_t                  send_offset;
+  uint32_t                  send_queued_bytes;
+  int                       congested;
+  int64_t                   congested_warned;
+  int                       recv_armed;
+  int                       recv_throttled;
+  int                       recv_cancelled;
+  rtOutboundMessage*        send_head;
+  rtOutboundMessage*        send_tail;
+  struct msghdr             send_msg;
+  struct iovec              send_iov[RTMSG_URING_MAX_IOV];
+  rtTrafficStats            stats;
 } rtConnectedClient;
 
 typedef struct
@@ -62,7 +178,7 @@ typedef struct
   rtConnectedClient* client;
 } rtSubscription;
 
-typedef rtError (*rtRouteMessageHandler)(rtConnectedClient* sender, rtMessageHeader* hdr,
+typedef rtError (*rtRouteMessageHandler)(rtConnectedClient* sender, rtMessageHeaderView* hdr,
   uint8_t const* buff, int n, rtSubscription* subscription);
 
 typedef struct
@@ -70,18 +186,123 @@ typedef struct
   rtSubscription*       subscription;
   rtRouteMessageHandler message_handler;
   char                  expression[RTMSG_MAX_EXPRESSION_LEN];
+  rtTopicExpression     compiled;
+  uint64_t              messages;
+  uint64_t              bytes;
 } rtRouteEntry;
 
 typedef struct
 {
   int fd;
+  int is_shm;
   struct sockaddr_storage local_endpoint;
 } rtListener;
 
+// Replaced, never modified, once published. Readers load the current table without
+// locking, writers copy it under route_table_lock and retire the old one.
+typedef struct
+{
+  rtVector                  routes;
+  uint32_t                  generation;
+} rtRouteTable;
+
+// single producer/single consumer queue of pointers
+typedef struct
+{
+  void**                    items;
+  uint32_t                  mask;
+  uint32_t                  head;
+  char                      pad[64 - sizeof(uint32_t)];
+  uint32_t                  tail;
+} rtRing;
+
+typedef struct
+{
+  void*                     item;
+  void                      (*destroy)(void* item);
+  uint64_t                  seen[];
+} rtRetiredItem;
+
+// A forwarded message handed to the shard that owns the subscriber
+typedef struct
+{
+  rtConnectedClient*        client;
+  uint32_t                  subscription_id;
+  rtMessageHeaderView       header;
+  uint32_t                  payload_length;
+  uint8_t                   data[];
+} rtShardMessage;
+
+typedef struct
+{
+  int                       fd;
+  int                       is_shm;
+  struct sockaddr_storage   endpoint;
+} rtShardNewClient;
+
+// Each shard owns its clients and is the only thread that reads from or writes to
+// their sockets. quiescent is odd while the shard may hold references into the
+// route table and is bumped every time around the loop.
+typedef struct _rtRouterShard
+{
+  int                       index;
+  pthread_t                 thread;
+  int                       epoll_fd;
+  int                       event_fd;
+  uint64_t                  quiescent;
+  rtVector                  clients;
+  rtVector                  retired;
+  rtRing                    new_clients;
+  rtRing*                   inbound;
+  uint8_t*                  notify;
+  int                       use_uring;
+  int                       resume_senders;
+#ifdef RTROUTED_WITH_IO_URING
+  rtIoUring                 uring;
+#endif
+  int*                      free_slots;
+  int                       num_free_slots;
+  rtVector                  flush;
+  rtRouterStats             stats;
+} rtRouterShard;
+
 rtVector clients;
 rtVector listeners;
-rtVector routes;
-//rtListener        listeners[RTMSG_MAX_LISTENERS];
+
+static rtRouteTable* route_table = NULL;
+static pthread_mutex_t route_table_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static rtRouterShard* shards = NULL;
+static int num_shards = 0;
+static int use_io_uring = 0;
+static int stats_interval = 0;
+static struct timespec start_time;
+static rtRouterStats main_stats;
+
+// NULL on the main thread
+static __thread rtRouterShard* current_shard = NULL;
+
+// direct mapped by topic hash, a collision just evicts the previous topic
+static __thread rtRouteSet* route_cache = NULL;
+
+static void
+rtRouted_Count(uint64_t* counter, uint64_t n)
+{
+  __atomic_fetch_add(counter, n, __ATOMIC_RELAXED);
+}
+
+static uint64_t
+rtRouted_ReadCounter(uint64_t const* counter)
+{
+  return __atomic_load_n(counter, __ATOMIC_RELAXED);
+}
+
+// the calling thread's totals
+static rtRouterStats*
+rtRouted_GetStats()
+{
+  return current_shard ? &current_shard->stats : &main_stats;
+}
 //rtRouteEntry      routes[RTMSG_MAX_ROUTES];
 
 static void
@@ -89,366 +310,2170 @@ rtRouted_PrintHelp()
 {
   printf("rtrouted [OPTIONS]...\n");
   printf("\t-f, --foreground          Run in foreground\n");
-  printf("\t-d, --no-delay            Enabled debugging\n");
+  printf("\t-d, --no-delay            Set TCP_NODELAY on tcp connections\n");
   printf("\t-l, --log-level <level>   Change logging level\n");
   printf("\t-r, --debug-route         Add a catch all route that dumps messages to stdout\n");
-  printf("\t-s, --socket              [tcp://ip:port unix:///path/to/domain_socket]\n");
+  printf("\t-s, --socket              [tcp://ip:port unix:///path/to/domain_socket shm:///path/to/domain_socket]\n");
+  printf("\t                          Repeat to listen on several, default %s\n", RTMSG_DEFAULT_SOCKET);
+  printf("\t-t, --threads <count>     Spread clients over <count> worker threads (default 0, single threaded)\n");
+  printf("\t-u, --io-uring            Use io_uring in worker threads when the kernel supports it, implies -t 1\n");
+  printf("\t-i, --stats-interval <s>  Publish statistics on %s every <s> seconds\n", RTMSG_STATS_TOPIC);
   printf("\t-h, --help                Print this help\n");
   exit(0);
 }
 
+// Frees item once no shard can still be using it. Shards only hold references while
+// online, so it's enough to see every shard that was online go around its loop.
+static void
+rtRouted_Retire(void* item, void (*destroy)(void* item))
+{
+  int i;
+  rtRetiredItem* retired;
+
+  if (!current_shard)
+  {
+    destroy(item);
+    return;
+  }
+
+  retired = (rtRetiredItem *) malloc(sizeof(rtRetiredItem) + sizeof(uint64_t) * num_shards);
+  retired->item = item;
+  retired->destroy = destroy;
+  for (i = 0; i < num_shards; ++i)
+    retired->seen[i] = __atomic_load_n(&shards[i].quiescent, __ATOMIC_SEQ_CST);
+  rtVector_PushBack(current_shard->retired, retired);
+}
+
+static rtRouteTable*
+rtRouted_GetRouteTable()
+{
+  return __atomic_load_n(&route_table, __ATOMIC_SEQ_CST);
+}
+
+static void
+rtRouteTable_Destroy(void* item)
+{
+  rtRouteTable* table = (rtRouteTable *) item;
+  rtVector_Destroy(table->routes, NULL);
+  free(table);
+}
+
+static rtRouteTable*
+rtRouteTable_Copy(rtRouteTable const* table)
+{
+  size_t i;
+  size_t n;
+  rtRouteTable* copy = (rtRouteTable *) malloc(sizeof(rtRouteTable));
+
+  rtVector_Create(&copy->routes);
+  copy->generation = table->generation + 1;
+  n = rtVector_Size(table->routes);
+  rtVector_Reserve(copy->routes, n + 1);
+  for (i = 0; i < n; ++i)
+    rtVector_PushBack(copy->routes, rtVector_At(table->routes, i));
+  return copy;
+}
+
+// caller holds route_table_lock
+static void
+rtRouted_PublishRouteTable(rtRouteTable* table)
+{
+  rtRouteTable* old = route_table;
+  __atomic_store_n(&route_table, table, __ATOMIC_SEQ_CST);
+  if (old)
+    rtRouted_Retire(old, rtRouteTable_Destroy);
+}
+
+static void
+rtRouted_PushRoute(rtRouteEntry* route)
+{
+  rtRouteTable* table;
+
+  pthread_mutex_lock(&route_table_lock);
+  table = rtRouteTable_Copy(route_table);
+  rtVector_PushBack(table->routes, route);
+  rtRouted_PublishRouteTable(table);
+  pthread_mutex_unlock(&route_table_lock);
+}
+
+static void
+rtRouteEntry_SetExpression(rtRouteEntry* route, char const* exp)
+{
+  strncpy(route->expression, exp, RTMSG_MAX_EXPRESSION_LEN - 1);
+  route->expression[RTMSG_MAX_EXPRESSION_LEN - 1] = '\0';
+  rtTopicExpression_Compile(&route->compiled, route->expression);
+}
+
 static rtError
 rtRouted_AddRoute(rtRouteMessageHandler handler, char const* exp, rtSubscription* subscription)
 {
-  rtRouteEntry* route = (rtRouteEntry *) malloc(sizeof(rtRouteEntry));
+  rtRouteEntry* route = (rtRouteEntry *) calloc(1, sizeof(rtRouteEntry));
   route->subscription = subscription;
   route->message_handler = handler;
-  strncpy(route->expression, exp, RTMSG_MAX_EXPRESSION_LEN);
-  rtVector_PushBack(routes, route);
+  rtRouteEntry_SetExpression(route, exp);
+  rtRouted_PushRoute(route);
+  rtVector_PushBack(subscription->client->routes, route);
   rtLog_Info("client [%s] added new route:%s", subscription->client->ident, exp);
   return RT_OK;
 }
 
+static int
+rtRouted_IsClientRoute(void* item, void* closure)
+{
+  rtRouteEntry* route = (rtRouteEntry *) item;
+  return route->subscription && route->subscription->client == (rtConnectedClient *) closure;
+}
+
+static void
+rtRouted_DestroyRoute(void* item)
+{
+  rtRouteEntry* route = (rtRouteEntry *) item;
+  if (route->subscription)
+    free(route->subscription);
+  free(route);
+}
+
 static rtError
 rtRouted_ClearClientRoutes(rtConnectedClient* clnt)
 {
   size_t i;
-  for (i = 0; i < rtVector_Size(routes);)
+  size_t n;
+  rtRouteTable* table;
+
+  if (rtVector_Size(clnt->routes) == 0)
+    return RT_OK;
+
+  // drop all of the client's entries from the routing table in one pass, then free
+  // them through the client's own list
+  pthread_mutex_lock(&route_table_lock);
+  table = rtRouteTable_Copy(route_table);
+  rtVector_RemoveIf(table->routes, rtRouted_IsClientRoute, clnt, NULL);
+  rtRouted_PublishRouteTable(table);
+  pthread_mutex_unlock(&route_table_lock);
+
+  for (i = 0, n = rtVector_Size(clnt->routes); i < n; ++i)
+    rtRouted_Retire(rtVector_At(clnt->routes, i), rtRouted_DestroyRoute);
+  rtVector_Clear(clnt->routes, NULL);
+
+  return RT_OK;
+}
+
+// takes over the handle
+static void
+rtConnectedClient_HoldSlab(rtConnectedClient* clnt, rtShmSlab slab)
+{
+  rtHeldSlab* held;
+
+  // forget whatever the client has already dropped
+  while (clnt->held_head && !rtShmSlab_IsHeldBy(clnt->held_head->slab, clnt->peer_pid))
+  {
+    held = clnt->held_head;
+    clnt->held_head = held->next;
+    rtShmSlab_Close(held->slab);
+    free(held);
+  }
+  if (!clnt->held_head)
+    clnt->held_tail = NULL;
+
+  held = (rtHeldSlab *) malloc(sizeof(rtHeldSlab));
+  if (!held)
+  {
+    rtShmSlab_Close(slab);
+    return;
+  }
+  held->next = NULL;
+  held->slab = slab;
+  if (clnt->held_tail)
+    clnt->held_tail->next = held;
+  else
+    clnt->held_head = held;
+  clnt->held_tail = held;
+}
+
+// one reference per entry, unless the client dropped it first
+static void
+rtConnectedClient_ReleaseSlabs(rtConnectedClient* clnt)
+{
+  while (clnt->held_head)
+  {
+    rtHeldSlab* held = clnt->held_head;
+    clnt->held_head = held->next;
+    rtShmSlab_ReleaseHolder(held->slab, clnt->peer_pid);
+    rtShmSlab_Close(held->slab);
+    free(held);
+  }
+  clnt->held_tail = NULL;
+}
+
+static void rtRouted_ResumeSenders();
+
+static void
+rtConnectedClient_Close(rtConnectedClient* clnt)
+{
+  rtRouted_ClearClientRoutes(clnt);
+  rtConnectedClient_ReleaseSlabs(clnt);
+
+  // publishers held back for this client would otherwise wait for it forever
+  if (__atomic_exchange_n(&clnt->congested, 0, __ATOMIC_SEQ_CST))
+    rtRouted_ResumeSenders();
+
+  if (clnt->shm)
+    rtShmChannel_Destroy(clnt->shm);
+  clnt->shm = NULL;
+
+  if (clnt->fd != -1)
+  {
+    close(clnt->fd);
+    rtRouted_Count(&rtRouted_GetStats()->disconnections, 1);
+  }
+  clnt->fd = -1;
+}
+
+static void
+rtConnectedClient_Free(void* item)
+{
+  rtConnectedClient* clnt = (rtConnectedClient *) item;
+
+  if (clnt->read_buffer)
+    free(clnt->read_buffer);
+
+  if (clnt->send_buffer)
+    free(clnt->send_buffer);
+
+  if (clnt->topic_aliases)
+  {
+    int i;
+    for (i = 0; i < RTMSG_HEADER_MAX_TOPIC_ALIASES; ++i)
+      rtVector_Destroy(clnt->topic_aliases[i].routes, NULL);
+    free(clnt->topic_aliases);
+  }
+
+  while (clnt->send_head)
+  {
+    rtOutboundMessage* next = clnt->send_head->next;
+    free(clnt->send_head);
+    clnt->send_head = next;
+  }
+
+  rtVector_Destroy(clnt->routes, NULL);
+  free(clnt);
+}
+
+// with shards, other shards may still have messages queued for the client
+static void
+rtConnectedClient_Destroy(rtConnectedClient* clnt)
+{
+  rtConnectedClient_Close(clnt);
+  rtRouted_Retire(clnt, rtConnectedClient_Free);
+}
+
+// io_uring shards send at the end of each loop, one sendmsg per client for
+// everything queued. Nothing is dropped, a client that stops reading holds back
+// its publishers instead, see rtRouted_ThrottleSender.
+static rtError
+rtConnectedClient_QueueSend(rtConnectedClient* clnt, struct iovec const* iov, int iovcnt)
+{
+  int i;
+  uint8_t* p;
+  uint32_t length;
+  rtOutboundMessage* msg;
+
+  if (clnt->fd == -1)
+    return rtErrorFromErrno(EBADF);
+
+  for (i = 0, length = 0; i < iovcnt; ++i)
+    length += iov[i].iov_len;
+
+  msg = (rtOutboundMessage *) malloc(sizeof(rtOutboundMessage) + length);
+  if (!msg)
+    return rtErrorFromErrno(ENOMEM);
+
+  msg->next = NULL;
+  msg->length = length;
+  for (i = 0, p = msg->data; i < iovcnt; ++i)
+  {
+    memcpy(p, iov[i].iov_base, iov[i].iov_len);
+    p += iov[i].iov_len;
+  }
+
+  if (clnt->send_tail)
+    clnt->send_tail->next = msg;
+  else
+    clnt->send_head = msg;
+  clnt->send_tail = msg;
+  __atomic_fetch_add(&clnt->send_queued_bytes, length, __ATOMIC_SEQ_CST);
+
+  if (!clnt->send_pending)
+  {
+    clnt->send_pending = 1;
+    rtVector_PushBack(clnt->shard->flush, clnt);
+  }
+  return RT_OK;
+}
+
+static void
+rtConnectedClient_CountSend(rtConnectedClient* clnt, rtError err, uint32_t length)
+{
+  rtRouterStats* stats = rtRouted_GetStats();
+
+  if (err == RT_OK)
+  {
+    rtRouted_Count(&clnt->stats.messages_out, 1);
+    rtRouted_Count(&clnt->stats.bytes_out, length);
+    rtRouted_Count(&stats->traffic.messages_out, 1);
+    rtRouted_Count(&stats->traffic.bytes_out, length);
+  }
+  else if (err != rtErrorFromErrno(EBADF))
+  {
+    rtRouted_Count(&clnt->stats.dropped, 1);
+    rtRouted_Count(&stats->traffic.dropped, 1);
+  }
+}
+
+// A full ring holds the router up the way a full socket buffer does a blocking send,
+// nothing more is read from publishers until the client catches up. Only the client
+// going away ends the wait.
+static rtError
+rtConnectedClient_WriteShm(rtConnectedClient* clnt, struct iovec const* iov, int iovcnt)
+{
+  char c;
+  rtError err;
+  int polls;
+
+  polls = 0;
+  while ((err = rtShmChannel_Write(clnt->shm, iov, iovcnt, RTMSG_SHM_SEND_POLL)) == RT_ERROR_TIMEOUT)
   {
-    rtRouteEntry* route = (rtRouteEntry *) rtVector_At(routes, i);
-    if (route->subscription && route->subscription->client == clnt)
+    if (recv(clnt->fd, &c, 1, MSG_PEEK | MSG_DONTWAIT) == 0)
+      return RT_ERROR_STREAM_CLOSED;
+    if (++polls == RTMSG_SHM_STALL_WARN)
+      rtLog_Warn("client [%s] isn't reading, waiting for room in its ring", clnt->ident);
+  }
+  return err;
+}
+
+// Header and payload go out together.
+static rtError
+rtConnectedClient_Send(rtConnectedClient* clnt, uint8_t const* hdr, uint32_t hdr_length,
+  uint8_t const* buff, uint32_t n)
+{
+  rtError err;
+  ssize_t bytes_sent;
+  struct msghdr msg;
+  struct iovec iov[2];
+
+  iov[0].iov_base = (void *) hdr;
+  iov[0].iov_len = hdr_length;
+  iov[1].iov_base = (void *) buff;
+  iov[1].iov_len = n;
+
+  if (clnt->shm)
+  {
+    err = rtConnectedClient_WriteShm(clnt, iov, 2);
+    if (err != RT_OK)
     {
-      rtVector_RemoveItem(routes, route, NULL);
-      free(route->subscription);
-      free(route);
+      rtLog_Warn("error forwarding message to client [%s]. %s", clnt->ident, rtStrError(err));
+      err = RT_FAIL;
     }
-    else
+  }
+  else if (clnt->shard && clnt->shard->use_uring)
+  {
+    err = rtConnectedClient_QueueSend(clnt, iov, 2);
+  }
+  else
+  {
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = iov;
+    msg.msg_iovlen = 2;
+
+    err = RT_OK;
+    bytes_sent = sendmsg(clnt->fd, &msg, MSG_NOSIGNAL);
+    if (bytes_sent == -1)
     {
-      i++;
+      if (errno == EBADF)
+      {
+        return rtErrorFromErrno(errno);
+      }
+      else
+      {
+        rtLog_Warn("error forwarding message to client. %d %s", errno, strerror(errno));
+      }
+      err = RT_FAIL;
     }
   }
 
-  return RT_OK;
+  rtConnectedClient_CountSend(clnt, err, hdr_length + n);
+  return err;
+}
+
+static rtError
+rtConnectedClient_Forward(rtConnectedClient* clnt, rtMessageHeaderView const* hdr, uint32_t subscription_id,
+  uint8_t const* buff, int n)
+{
+  rtError err;
+  rtShmSlab slab;
+
+  // topics still reference the sender's read buffer, re-encoded in whatever
+  // version the subscriber understands
+  rtMessageHeaderView new_header = *hdr;
+  new_header.version = clnt->header_version;
+  new_header.control_data = subscription_id;
+  new_header.payload_length = n;
+  new_header.flags &= ~rtMessageFlags_TopicAlias;
+  new_header.topic_alias = 0;
+  if (new_header.flags & rtMessageFlags_Trace)
+    new_header.timestamps[rtMessageTimestamp_RouterForward] = rtMessageTimestamp_Now();
+  err = rtMessageHeaderView_Encode(&new_header, clnt->send_buffer);
+  if (err != RT_OK)
+    return err;
+
+  // rtDebug_PrintBuffer("fwd header", clnt->send_buffer, new_header.length);
+
+  if (!clnt->shm || new_header.header_length + (uint32_t) n <= rtShmChannel_GetCapacity(clnt->shm))
+  {
+    err = rtConnectedClient_Send(clnt, clnt->send_buffer, new_header.header_length, buff, n);
+    if (err == RT_OK && (new_header.flags & rtMessageFlags_SharedPayload) &&
+        rtShmSlab_Open(&slab, (char const *) buff, n) == RT_OK)
+      rtConnectedClient_HoldSlab(clnt, slab);
+    return err;
+  }
+
+  // Too big for the ring, e.g. from a tcp publisher. Shared memory clients always
+  // take slabs, so hand it over in one that the client releases, if it can open ours.
+  if (clnt->peer_uid != geteuid())
+  {
+    rtLog_Warn("message too large for client [%s] of another user", clnt->ident);
+    rtConnectedClient_CountSend(clnt, RT_FAIL, 0);
+    return RT_FAIL;
+  }
+
+  err = rtShmSlab_Create(&slab, buff, n);
+  if (err == RT_OK)
+  {
+    // the client's reference replaces ours
+    err = rtShmSlab_AddHolder(slab, clnt->peer_pid);
+    rtShmSlab_Release(slab);
+    if (err != RT_OK)
+      rtShmSlab_Close(slab);
+  }
+  if (err != RT_OK)
+  {
+    rtLog_Warn("failed to create slab for client [%s]. %s", clnt->ident, rtStrError(err));
+    rtConnectedClient_CountSend(clnt, RT_FAIL, 0);
+    return RT_FAIL;
+  }
+
+  new_header.flags |= rtMessageFlags_SharedPayload;
+  new_header.payload_length = strlen(rtShmSlab_GetName(slab));
+  err = rtMessageHeaderView_Encode(&new_header, clnt->send_buffer);
+  if (err == RT_OK)
+    err = rtConnectedClient_Send(clnt, clnt->send_buffer, new_header.header_length,
+      (uint8_t const *) rtShmSlab_GetName(slab), new_header.payload_length);
+  if (err == RT_OK)
+  {
+    rtConnectedClient_HoldSlab(clnt, slab);
+  }
+  else
+  {
+    rtShmSlab_ReleaseHolder(slab, clnt->peer_pid);
+    rtShmSlab_Close(slab);
+  }
+  return err;
+}
+
+static int
+rtRing_Init(rtRing* ring, uint32_t size)
+{
+  ring->items = (void **) calloc(size, sizeof(void *));
+  ring->mask = size - 1;
+  ring->head = 0;
+  ring->tail = 0;
+  return ring->items != NULL;
+}
+
+static int
+rtRing_Push(rtRing* ring, void* item)
+{
+  uint32_t tail = __atomic_load_n(&ring->tail, __ATOMIC_RELAXED);
+  uint32_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+
+  if (tail - head > ring->mask)
+    return 0;
+
+  ring->items[tail & ring->mask] = item;
+  __atomic_store_n(&ring->tail, tail + 1, __ATOMIC_RELEASE);
+  return 1;
+}
+
+static void*
+rtRing_Pop(rtRing* ring)
+{
+  void* item;
+  uint32_t head = __atomic_load_n(&ring->head, __ATOMIC_RELAXED);
+  uint32_t tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+
+  if (head == tail)
+    return NULL;
+
+  item = ring->items[head & ring->mask];
+  __atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+  return item;
 }
 
 static void
-rtConnectedClient_Destroy(rtConnectedClient* clnt)
+rtRouterShard_Notify(rtRouterShard* shard)
+{
+  uint64_t one = 1;
+  if (write(shard->event_fd, &one, sizeof(one)) == -1 && errno != EAGAIN)
+    rtLog_Warn("failed to wake shard %d. %s", shard->index, strerror(errno));
+}
+
+// wakes every shard to read again from the publishers it held back
+static void
+rtRouted_ResumeSenders()
+{
+  int i;
+
+  for (i = 0; i < num_shards; ++i)
+  {
+    __atomic_store_n(&shards[i].resume_senders, 1, __ATOMIC_SEQ_CST);
+    rtRouterShard_Notify(&shards[i]);
+  }
+}
+
+static void rtRouterShard_DrainInbound(rtRouterShard* shard);
+
+// Copies the message so the owning shard can send it after the sender's read buffer
+// has been reused. When that shard has fallen behind, wait a little for it while
+// draining our own queues, two shards waiting on each other would otherwise never
+// make progress. Dropped if it still hasn't caught up.
+static rtError
+rtRouterShard_Post(rtConnectedClient* clnt, rtMessageHeaderView const* hdr, uint32_t subscription_id,
+  uint8_t const* buff, int n)
+{
+  int retries;
+  uint8_t* p;
+  rtShardMessage* msg;
+
+  msg = (rtShardMessage *) malloc(sizeof(rtShardMessage) + hdr->topic_length + hdr->reply_topic_length + n);
+  if (!msg)
+    return rtErrorFromErrno(ENOMEM);
+
+  p = msg->data;
+  msg->client = clnt;
+  msg->subscription_id = subscription_id;
+  msg->header = *hdr;
+  msg->payload_length = n;
+  memcpy(p, hdr->topic, hdr->topic_length);
+  msg->header.topic = (char const *) p;
+  p += hdr->topic_length;
+  memcpy(p, hdr->reply_topic, hdr->reply_topic_length);
+  msg->header.reply_topic = (char const *) p;
+  p += hdr->reply_topic_length;
+  memcpy(p, buff, n);
+
+  retries = 0;
+  while (!rtRing_Push(&clnt->shard->inbound[current_shard->index], msg) && retries++ < RTMSG_SHARD_POST_RETRIES)
+  {
+    if (retries == 1)
+      rtRouterShard_Notify(clnt->shard);
+    rtRouterShard_DrainInbound(current_shard);
+    sched_yield();
+  }
+
+  if (retries > RTMSG_SHARD_POST_RETRIES)
+  {
+    rtLog_Warn("shard %d queue full, dropping message for client [%s]", clnt->shard->index, clnt->ident);
+    rtRouted_Count(&clnt->stats.dropped, 1);
+    rtRouted_Count(&current_shard->stats.traffic.dropped, 1);
+    free(msg);
+    return RT_FAIL;
+  }
+
+  current_shard->notify[clnt->shard->index] = 1;
+  return RT_OK;
+}
+
+// io_uring shards queue rather than block, so a subscriber that isn't keeping up
+// holds back whoever is publishing to it instead. The shard draining its queue
+// wakes everyone once it's down to half, congested is set before the queue is
+// looked at again so that can't be missed.
+static void
+rtRouted_ThrottleSender(rtConnectedClient* sender, rtConnectedClient* clnt)
+{
+  struct timespec now;
+
+  if (__atomic_load_n(&clnt->send_queued_bytes, __ATOMIC_RELAXED) <= RTMSG_URING_MAX_QUEUED_BYTES)
+    return;
+
+  if (!__atomic_exchange_n(&clnt->congested, 1, __ATOMIC_SEQ_CST))
+  {
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    if (now.tv_sec - __atomic_load_n(&clnt->congested_warned, __ATOMIC_RELAXED) >= RTMSG_URING_CONGESTED_WARN_INTERVAL)
+    {
+      __atomic_store_n(&clnt->congested_warned, (int64_t) now.tv_sec, __ATOMIC_RELAXED);
+      rtLog_Warn("client [%s] isn't keeping up, holding back its publishers", clnt->ident);
+    }
+  }
+
+  if (__atomic_load_n(&clnt->send_queued_bytes, __ATOMIC_SEQ_CST) > RTMSG_URING_MAX_QUEUED_BYTES)
+    sender->recv_throttled = 1;
+}
+
+static rtError
+rtRouted_ForwardMessage(rtConnectedClient* sender, rtMessageHeaderView* hdr, uint8_t const* buff, int n, rtSubscription* subscription)
+{
+  rtError err;
+  rtMessageHeaderView shared_header;
+  rtConnectedClient* clnt = subscription->client;
+
+  // subscribers that can map the slab get its name and a reference of their own,
+  // everyone else gets a copy of the payload. Slabs are private to their user.
+  if (sender->current_slab && clnt->shared_payload && clnt->peer_uid == sender->peer_uid &&
+      rtShmSlab_AddHolder(sender->current_slab, clnt->peer_pid) == RT_OK)
+  {
+    shared_header = *hdr;
+    shared_header.flags |= rtMessageFlags_SharedPayload;
+    hdr = &shared_header;
+    buff = (uint8_t const *) rtShmSlab_GetName(sender->current_slab);
+    n = strlen((char const *) buff);
+  }
+
+  if (clnt->shard != current_shard)
+    err = rtRouterShard_Post(clnt, hdr, subscription->id, buff, n);
+  else
+    err = rtConnectedClient_Forward(clnt, hdr, subscription->id, buff, n);
+
+  if (err != RT_OK && (hdr->flags & rtMessageFlags_SharedPayload))
+    rtShmSlab_ReleaseHolder(sender->current_slab, clnt->peer_pid);
+  else if (err == RT_OK && current_shard && current_shard->use_uring)
+    rtRouted_ThrottleSender(sender, clnt);
+  return err;
+}
+
+static rtError 
+rtRouted_PrintMessage(rtConnectedClient* sender, rtMessageHeaderView* hdr, uint8_t const* buff,
+  int n, rtSubscription* subscription)
+{
+  (void) hdr;
+  (void) sender;
+  (void) subscription;
+
+  printf("message debug\n");
+  printf("'%.*s'\n", n, (char *) buff);
+  return RT_OK;
+}
+
+static void rtRouted_SendResponse(rtConnectedClient* clnt, rtMessage res);
+static rtMessage rtRouted_GetStatsSnapshot();
+
+static int
+rtRouted_IsTopic(rtMessageHeaderView const* hdr, char const* topic)
+{
+  return hdr->topic_length == strlen(topic) && memcmp(hdr->topic, topic, hdr->topic_length) == 0;
+}
+
+static rtError
+rtRouted_OnMessage(rtConnectedClient* sender, rtMessageHeaderView* hdr, uint8_t const* buff,
+  int n, rtSubscription* not_unsed)
+{
+  (void) not_unsed;
+
+  if (rtRouted_IsTopic(hdr, "_RTROUTED.INBOX.SUBSCRIBE"))
+  {
+    char const* expression = NULL;
+    int32_t route_id = 0;
+    int32_t header_version = 0;
+    int32_t shared_payload = 0;
+
+    rtMessage m;
+    rtMessage_FromBytes(&m, buff, n);
+    rtMessage_GetString(m, "topic", &expression);
+    rtMessage_GetInt32(m, "route_id", &route_id);
+
+    // older clients don't send this and only get v1 headers
+    if (rtMessage_GetInt32(m, "header_version", &header_version) == RT_OK)
+    {
+      if (header_version > RTMSG_HEADER_MAX_VERSION)
+        header_version = RTMSG_HEADER_MAX_VERSION;
+      if (header_version > sender->header_version)
+        sender->header_version = (uint16_t) header_version;
+    }
+
+    // slab names are only any use to clients on this host
+    if (rtMessage_GetInt32(m, "shared_payload", &shared_payload) == RT_OK && shared_payload &&
+        sender->endpoint.ss_family == AF_UNIX && sender->peer_pid != 0)
+      sender->shared_payload = 1;
+
+    rtSubscription* subscription = (rtSubscription *) malloc(sizeof(rtSubscription));
+    subscription->id = route_id;
+    subscription->client = sender;
+    rtRouted_AddRoute(rtRouted_ForwardMessage, expression, subscription);
+
+    rtMessage_Release(m);
+  }
+  else if (rtRouted_IsTopic(hdr, "_RTROUTED.INBOX.HELLO"))
+  {
+    char const* inbox = NULL;
+
+    rtMessage m;
+    rtMessage_FromBytes(&m, buff, n);
+    rtMessage_GetString(m, "inbox", &inbox);
+
+    rtSubscription* subscription = (rtSubscription *) malloc(sizeof(rtSubscription));
+    subscription->id = 0;
+    subscription->client = sender;
+    rtRouted_AddRoute(rtRouted_ForwardMessage, inbox, subscription);
+
+    rtMessage_Release(m);
+  }
+  else if (rtRouted_IsTopic(hdr, "_RTROUTED.INBOX.STATS"))
+  {
+    if (rtMessageHeaderView_IsRequest(hdr))
+    {
+      rtMessage m = rtRouted_GetStatsSnapshot();
+      rtRouted_SendResponse(sender, m);
+      rtMessage_Release(m);
+    }
+  }
+  else
+  {
+    rtLog_Info("no handler for message:%.*s", (int) hdr->topic_length, hdr->topic);
+  }
+  return RT_OK;
+}
+
+static void
+rtConnectedClient_Init(rtConnectedClient* clnt, int fd, struct sockaddr_storage* remote_endpoint)
+{
+  clnt->fd = fd;
+  clnt->state = rtConnectionState_ReadHeaderPreamble;
+  clnt->bytes_read = 0;
+  clnt->bytes_to_read = 4;
+  clnt->read_buffer = (uint8_t *) malloc(RTMSG_CLIENT_READ_BUFFER_SIZE);
+  clnt->read_buffer_capacity = RTMSG_CLIENT_READ_BUFFER_SIZE;
+  clnt->send_buffer = (uint8_t *) malloc(RTMSG_CLIENT_READ_BUFFER_SIZE);
+  memcpy(&clnt->endpoint, remote_endpoint, sizeof(struct sockaddr_storage));
+  memset(clnt->read_buffer, 0, RTMSG_CLIENT_READ_BUFFER_SIZE);
+  memset(clnt->send_buffer, 0, RTMSG_CLIENT_READ_BUFFER_SIZE);
+  rtMessageHeaderView_Init(&clnt->header);
+  clnt->header_version = RTMSG_HEADER_VERSION_1;
+  clnt->shared_payload = 0;
+  clnt->peer_pid = 0;
+  clnt->peer_uid = (uid_t) -1;
+  clnt->current_slab = NULL;
+  clnt->held_head = NULL;
+  clnt->held_tail = NULL;
+  rtVector_Create(&clnt->routes);
+  clnt->topic_aliases = NULL;
+  clnt->current_alias = NULL;
+  clnt->shard = NULL;
+  clnt->shm = NULL;
+  clnt->file_slot = -1;
+  clnt->uring_ops = 0;
+  clnt->send_in_flight = 0;
+  clnt->send_pending = 0;
+  clnt->send_offset = 0;
+  clnt->send_queued_bytes = 0;
+  clnt->congested = 0;
+  clnt->congested_warned = 0;
+  clnt->recv_armed = 0;
+  clnt->recv_throttled = 0;
+  clnt->recv_cancelled = 0;
+  clnt->send_head = NULL;
+  clnt->send_tail = NULL;
+  memset(&clnt->stats, 0, sizeof(clnt->stats));
+
+  // who's on the other end decides which slabs a local client may use
+  if (remote_endpoint->ss_family == AF_UNIX)
+  {
+    struct ucred cred;
+    socklen_t len = sizeof(cred);
+    if (getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &cred, &len) == 0)
+    {
+      clnt->peer_pid = cred.pid;
+      clnt->peer_uid = cred.uid;
+    }
+  }
+}
+
+static rtError
+rtConnectedClient_ResolveTopicAlias(rtConnectedClient* clnt)
+{
+  rtRouteSet* alias;
+  rtMessageHeaderView* hdr = &clnt->header;
+
+  clnt->current_alias = NULL;
+  if (!(hdr->flags & rtMessageFlags_TopicAlias))
+    return RT_OK;
+
+  if (!clnt->topic_aliases)
+  {
+    int i;
+    clnt->topic_aliases = (rtRouteSet *) calloc(RTMSG_HEADER_MAX_TOPIC_ALIASES, sizeof(rtRouteSet));
+    for (i = 0; i < RTMSG_HEADER_MAX_TOPIC_ALIASES; ++i)
+      rtVector_Create(&clnt->topic_aliases[i].routes);
+  }
+
+  // decode has already checked the range
+  alias = &clnt->topic_aliases[hdr->topic_alias - 1];
+  if (hdr->topic_length > 0)
+  {
+    memcpy(alias->topic, hdr->topic, hdr->topic_length);
+    alias->topic_length = hdr->topic_length;
+    alias->generation = 0;
+    rtLog_Debug("client [%s] bound topic alias %d to %.*s", clnt->ident, (int) hdr->topic_alias,
+      (int) hdr->topic_length, hdr->topic);
+  }
+  else if (alias->topic_length == 0)
+  {
+    rtLog_Warn("client [%s] used unknown topic alias:%d", clnt->ident, (int) hdr->topic_alias);
+    return RT_ERROR_PROTOCOL_ERROR;
+  }
+
+  hdr->topic = alias->topic;
+  hdr->topic_length = alias->topic_length;
+  clnt->current_alias = alias;
+  return RT_OK;
+}
+
+static void
+rtRouteSet_Update(rtRouteSet* set)
+{
+  size_t i;
+  size_t n;
+  uint32_t hash;
+  rtRouteTable* table = rtRouted_GetRouteTable();
+
+  if (set->generation == table->generation)
+    return;
+
+  hash = rtTopic_Hash(set->topic, set->topic_length);
+  rtVector_Clear(set->routes, NULL);
+  for (i = 0, n = rtVector_Size(table->routes); i < n; ++i)
+  {
+    rtRouteEntry* route = (rtRouteEntry *) rtVector_At(table->routes, i);
+    if (rtTopicExpression_IsMatch(&route->compiled, set->topic, set->topic_length, hash))
+      rtVector_PushBack(set->routes, route);
+  }
+  set->generation = table->generation;
+}
+
+static void
+rtRouted_InitRouteCache()
+{
+  int i;
+  route_cache = (rtRouteSet *) calloc(RTMSG_ROUTE_CACHE_SIZE, sizeof(rtRouteSet));
+  for (i = 0; i < RTMSG_ROUTE_CACHE_SIZE; ++i)
+    rtVector_Create(&route_cache[i].routes);
+}
+
+static rtRouteSet*
+rtRouted_GetRouteSet(char const* topic, uint32_t topic_length, uint32_t hash)
+{
+  rtRouteSet* set = &route_cache[hash & (RTMSG_ROUTE_CACHE_SIZE - 1)];
+
+  if (set->hash != hash || set->topic_length != topic_length ||
+      memcmp(set->topic, topic, topic_length) != 0)
+  {
+    memcpy(set->topic, topic, topic_length);
+    set->topic_length = topic_length;
+    set->hash = hash;
+    set->generation = 0;
+  }
+
+  rtRouteSet_Update(set);
+  return set;
+}
+
+// Answers the request clnt is currently dispatching.
+static void
+rtRouted_SendResponse(rtConnectedClient* clnt, rtMessage res)
+{
+  uint8_t* p;
+  uint32_t n;
+  rtMessageHeaderView hdr;
+
+  rtMessage_ToByteArray(res, &p, &n);
+
+  rtMessageHeaderView_Init(&hdr);
+  hdr.version = clnt->header_version;
+  hdr.flags = rtMessageFlags_Response;
+  hdr.topic = clnt->header.reply_topic;
+  hdr.topic_length = clnt->header.reply_topic_length;
+  hdr.reply_topic = "NO.ROUTE.RESPONSE";
+  hdr.reply_topic_length = strlen(hdr.reply_topic);
+  hdr.payload_length = n;
+
+  if (rtMessageHeaderView_Encode(&hdr, clnt->send_buffer) == RT_OK)
+    rtConnectedClient_Send(clnt, clnt->send_buffer, hdr.header_length, p, n);
+  free(p);
+}
+
+// Answers a request nobody subscribes to so the caller doesn't wait out its timeout.
+static void
+rtRouted_SendNoRoute(rtConnectedClient* clnt)
+{
+  rtMessage res;
+  rtMessage msg;
+
+  rtMessage_Create(&res);
+  rtMessage_Create(&msg);
+  rtMessage_SetString(msg, "name", "");
+  rtMessage_SetString(msg, "value", "");
+  rtMessage_SetInt32(msg, "status", 1);
+  rtMessage_SetString(msg, "status_msg", "No Route found for this Parameter");
+  rtMessage_AddMessage(res, "result", msg);
+  rtRouted_SendResponse(clnt, res);
+  rtMessage_Release(msg);
+  rtMessage_Release(res);
+}
+
+static void
+rtTrafficStats_Add(rtTrafficStats* total, rtTrafficStats const* stats)
+{
+  total->messages_in += rtRouted_ReadCounter(&stats->messages_in);
+  total->bytes_in += rtRouted_ReadCounter(&stats->bytes_in);
+  total->messages_out += rtRouted_ReadCounter(&stats->messages_out);
+  total->bytes_out += rtRouted_ReadCounter(&stats->bytes_out);
+  total->dropped += rtRouted_ReadCounter(&stats->dropped);
+}
+
+static void
+rtTrafficStats_Write(rtTrafficStats const* stats, rtMessage m)
+{
+  rtMessage_SetDouble(m, "messages_in", (double) rtRouted_ReadCounter(&stats->messages_in));
+  rtMessage_SetDouble(m, "bytes_in", (double) rtRouted_ReadCounter(&stats->bytes_in));
+  rtMessage_SetDouble(m, "messages_out", (double) rtRouted_ReadCounter(&stats->messages_out));
+  rtMessage_SetDouble(m, "bytes_out", (double) rtRouted_ReadCounter(&stats->bytes_out));
+  rtMessage_SetDouble(m, "dropped", (double) rtRouted_ReadCounter(&stats->dropped));
+}
+
+// Counters are read while the shards keep running so they can be slightly out of
+// step with each other. Clients are found through the route table, every client
+// has at least its inbox route.
+static rtMessage
+rtRouted_GetStatsSnapshot()
+{
+  int i;
+  size_t j;
+  size_t k;
+  size_t n;
+  rtMessage m;
+  rtMessage item;
+  rtVector seen;
+  rtRouterStats total;
+  struct timespec now;
+  rtRouteTable* table = rtRouted_GetRouteTable();
+
+  memset(&total, 0, sizeof(total));
+  for (i = -1; i < num_shards; ++i)
+  {
+    rtRouterStats const* stats = i == -1 ? &main_stats : &shards[i].stats;
+    rtTrafficStats_Add(&total.traffic, &stats->traffic);
+    total.no_route += rtRouted_ReadCounter(&stats->no_route);
+    total.connections += rtRouted_ReadCounter(&stats->connections);
+    total.disconnections += rtRouted_ReadCounter(&stats->disconnections);
+  }
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  rtMessage_Create(&m);
+  rtMessage_SetDouble(m, "uptime", (now.tv_sec - start_time.tv_sec) + (now.tv_nsec - start_time.tv_nsec) / 1e9);
+  rtMessage_SetDouble(m, "connections", (double) (total.connections - total.disconnections));
+  rtMessage_SetDouble(m, "accepted", (double) total.connections);
+  rtMessage_SetDouble(m, "no_route", (double) total.no_route);
+  rtTrafficStats_Write(&total.traffic, m);
+
+  // messages other shards have handed over but the shard hasn't sent yet
+  for (i = 0; i < num_shards; ++i)
+  {
+    uint32_t queued = 0;
+    for (k = 0; k < (size_t) num_shards; ++k)
+    {
+      rtRing* ring = &shards[i].inbound[k];
+      queued += __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE) - __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+    }
+
+    rtMessage_Create(&item);
+    rtMessage_SetInt32(item, "index", i);
+    rtMessage_SetInt32(item, "queued", (int32_t) queued);
+    rtMessage_AddMessage(m, "shards", item);
+    rtMessage_Release(item);
+  }
+
+  rtVector_Create(&seen);
+  for (j = 0, n = rtVector_Size(table->routes); j < n; ++j)
+  {
+    rtConnectedClient* clnt;
+    rtRouteEntry* route = (rtRouteEntry *) rtVector_At(table->routes, j);
+    if (!route->subscription)
+      continue;
+
+    clnt = route->subscription->client;
+    rtMessage_Create(&item);
+    rtMessage_SetString(item, "expression", route->expression);
+    rtMessage_SetString(item, "client", clnt->ident);
+    rtMessage_SetDouble(item, "messages", (double) rtRouted_ReadCounter(&route->messages));
+    rtMessage_SetDouble(item, "bytes", (double) rtRouted_ReadCounter(&route->bytes));
+    rtMessage_AddMessage(m, "routes", item);
+    rtMessage_Release(item);
+
+    for (k = 0; k < rtVector_Size(seen) && rtVector_At(seen, k) != clnt; ++k)
+      ;
+    if (k == rtVector_Size(seen))
+      rtVector_PushBack(seen, clnt);
+  }
+
+  for (j = 0, n = rtVector_Size(seen); j < n; ++j)
+  {
+    rtConnectedClient* clnt = (rtConnectedClient *) rtVector_At(seen, j);
+    rtMessage_Create(&item);
+    rtMessage_SetString(item, "client", clnt->ident);
+    rtTrafficStats_Write(&clnt->stats, item);
+    // only io_uring shards queue, elsewhere a slow reader blocks the router instead
+    rtMessage_SetDouble(item, "queued_bytes", (double) __atomic_load_n(&clnt->send_queued_bytes, __ATOMIC_RELAXED));
+    rtMessage_AddMessage(m, "clients", item);
+    rtMessage_Release(item);
+  }
+  rtVector_Destroy(seen, NULL);
+
+  return m;
+}
+
+// Only ever called from one thread, the main loop or the first shard.
+static void
+rtRouted_PublishStats()
+{
+  static struct timespec last_publish;
+  static rtConnectedClient router;
+
+  size_t i;
+  size_t n;
+  uint8_t* p;
+  uint32_t length;
+  rtMessage m;
+  rtRouteSet* set;
+  rtMessageHeaderView hdr;
+  struct timespec now;
+
+  if (stats_interval <= 0)
+    return;
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  if (last_publish.tv_sec != 0 && now.tv_sec - last_publish.tv_sec < stats_interval)
+    return;
+  last_publish = now;
+
+  m = rtRouted_GetStatsSnapshot();
+  rtMessage_ToByteArray(m, &p, &length);
+  rtMessage_Release(m);
+
+  rtMessageHeaderView_Init(&hdr);
+  hdr.topic = RTMSG_STATS_TOPIC;
+  hdr.topic_length = strlen(hdr.topic);
+  hdr.payload_length = length;
+
+  // the router itself is the sender, it never has a shared payload
+  set = rtRouted_GetRouteSet(hdr.topic, hdr.topic_length, rtTopic_Hash(hdr.topic, hdr.topic_length));
+  for (i = 0, n = rtVector_Size(set->routes); i < n; ++i)
+  {
+    rtRouteEntry* route = (rtRouteEntry *) rtVector_At(set->routes, i);
+    if (route->message_handler == rtRouted_ForwardMessage)
+      rtRouted_ForwardMessage(&router, &hdr, p, length, route->subscription);
+  }
+  free(p);
+}
+
+static void
+rtRouter_DispatchMessageFromClient(rtConnectedClient* clnt)
+{
+  size_t i;
+  size_t n;
+  int match_found = 0;
+  rtRouteSet* set;
+  uint8_t const* payload;
+  uint32_t payload_length;
+  rtConnectedClient* bad_client = NULL;
+  rtRouterStats* stats = rtRouted_GetStats();
+
+  payload = clnt->read_buffer + clnt->header.header_length;
+  payload_length = clnt->header.payload_length;
+
+  if (clnt->header.flags & rtMessageFlags_Trace)
+    clnt->header.timestamps[rtMessageTimestamp_RouterReceive] = rtMessageTimestamp_Now();
+
+  rtRouted_Count(&clnt->stats.messages_in, 1);
+  rtRouted_Count(&clnt->stats.bytes_in, clnt->header.header_length + payload_length);
+  rtRouted_Count(&stats->traffic.messages_in, 1);
+  rtRouted_Count(&stats->traffic.bytes_in, clnt->header.header_length + payload_length);
+
+  // handlers see the slab's contents, the publisher's reference is ours until
+  // every subscriber has taken one
+  if (clnt->header.flags & rtMessageFlags_SharedPayload)
+  {
+    // a client may only hand over its own slabs
+    if (!rtShmSlab_IsOwnedBy((char const *) payload, payload_length, clnt->peer_pid))
+    {
+      rtLog_Warn("client [%s] sent a shared payload it doesn't own", clnt->ident);
+      clnt->current_slab = NULL;
+      return;
+    }
+
+    if (rtShmSlab_Open(&clnt->current_slab, (char const *) payload, payload_length) != RT_OK)
+    {
+      // nobody else holds a reference, don't leave the segment behind
+      rtLog_Warn("client [%s] sent unusable shared payload", clnt->ident);
+      rtShmSlab_Unlink((char const *) payload, payload_length);
+      clnt->current_slab = NULL;
+      return;
+    }
+    clnt->header.flags &= ~rtMessageFlags_SharedPayload;
+    payload = rtShmSlab_GetData(clnt->current_slab);
+    payload_length = rtShmSlab_GetLength(clnt->current_slab);
+    clnt->header.payload_length = payload_length;
+  }
+
+  // an aliased topic already knows which routes match it, anything else goes
+  // through the topic cache
+  if (clnt->current_alias)
+  {
+    set = clnt->current_alias;
+    rtRouteSet_Update(set);
+  }
+  else
+  {
+    set = rtRouted_GetRouteSet(clnt->header.topic, clnt->header.topic_length,
+      rtTopic_Hash(clnt->header.topic, clnt->header.topic_length));
+  }
+
+  // handlers may add routes, that only bumps the generation and leaves this set alone
+  for (i = 0, n = rtVector_Size(set->routes); i < n; ++i)
+  {
+    rtError err = RT_OK;
+    rtRouteEntry* route = (rtRouteEntry *) rtVector_At(set->routes, i);
+
+    match_found = 1;
+    rtRouted_Count(&route->messages, 1);
+    rtRouted_Count(&route->bytes, payload_length);
+    err = route->message_handler(clnt, &clnt->header, payload, payload_length, route->subscription);
+
+    // don't modify the routing table while walking it
+    if (err == rtErrorFromErrno(EBADF) && route->subscription)
+      bad_client = route->subscription->client;
+  }
+
+  if (bad_client)
+    rtRouted_ClearClientRoutes(bad_client);
+  if (!match_found)
+    rtRouted_Count(&stats->no_route, 1);
+  int is_request = rtMessageHeaderView_IsRequest(&clnt->header);
+  if (!match_found && is_request)
+  {
+    rtLog_Error("no client found for match:%.*s", (int) clnt->header.topic_length, clnt->header.topic);
+    //No route Found , Returning an Error Message to caller
+    rtRouted_SendNoRoute(clnt);
+  }
+
+  if (clnt->current_slab)
+  {
+    rtShmSlab_Release(clnt->current_slab);
+    rtShmSlab_Close(clnt->current_slab);
+    clnt->current_slab = NULL;
+  }
+}
+
+static rtError
+rtConnectedClient_GrowReadBuffer(rtConnectedClient* clnt, uint32_t capacity)
+{
+  uint8_t* read_buffer = (uint8_t *) realloc(clnt->read_buffer, capacity);
+  if (!read_buffer)
+    return rtErrorFromErrno(ENOMEM);
+  clnt->read_buffer = read_buffer;
+  clnt->read_buffer_capacity = capacity;
+  return RT_OK;
+}
+
+// large messages are rare, don't hold on to their buffers
+static void
+rtConnectedClient_ShrinkReadBuffer(rtConnectedClient* clnt)
+{
+  uint8_t* read_buffer = (uint8_t *) realloc(clnt->read_buffer, RTMSG_CLIENT_READ_BUFFER_SIZE);
+  if (read_buffer)
+  {
+    clnt->read_buffer = read_buffer;
+    clnt->read_buffer_capacity = RTMSG_CLIENT_READ_BUFFER_SIZE;
+  }
+}
+
+static rtError
+rtConnectedClient_OnBytesRead(rtConnectedClient* clnt, ssize_t bytes_read)
+{
+  clnt->bytes_read += bytes_read;
+
+  switch (clnt->state)
+  {
+    case rtConnectionState_ReadHeaderPreamble:
+    {
+      // read version/length of header
+      if (clnt->bytes_read == clnt->bytes_to_read)
+      {
+        uint8_t const* itr = &clnt->read_buffer[2];
+        uint16_t header_length = 0;
+        rtEncoder_DecodeUInt16(&itr, &header_length);
+        if (header_length < RTMSG_HEADER_PREAMBLE_LENGTH || header_length > RTMSG_CLIENT_READ_BUFFER_SIZE)
+        {
+          rtLog_Warn("client [%s] sent invalid header length:%d", clnt->ident, (int) header_length);
+          return RT_ERROR_PROTOCOL_ERROR;
+        }
+        clnt->bytes_to_read += (header_length - 4);
+        clnt->state = rtConnectionState_ReadHeader;
+      }
+    }
+    break;
+
+    case rtConnectionState_ReadHeader:
+    {
+      if (clnt->bytes_read == clnt->bytes_to_read)
+      {
+        rtError err = rtMessageHeaderView_Decode(&clnt->header, clnt->read_buffer, clnt->bytes_read);
+        if (err == RT_OK && clnt->header.payload_length > RTMSG_MAX_PAYLOAD_LENGTH)
+          err = RT_ERROR_PROTOCOL_ERROR;
+        if (err == RT_OK && clnt->bytes_read + clnt->header.payload_length > clnt->read_buffer_capacity)
+        {
+          // topics point into the old buffer, decode again once it has moved
+          err = rtConnectedClient_GrowReadBuffer(clnt, clnt->bytes_read + clnt->header.payload_length);
+          if (err == RT_OK)
+            err = rtMessageHeaderView_Decode(&clnt->header, clnt->read_buffer, clnt->bytes_read);
+        }
+        if (err == RT_OK)
+          err = rtConnectedClient_ResolveTopicAlias(clnt);
+        if (err != RT_OK)
+        {
+          rtLog_Warn("client [%s] sent malformed header. %s", clnt->ident, rtStrError(err));
+          return err;
+        }
+
+        // a client that sends v2 can also read it
+        if (clnt->header.version > clnt->header_version)
+          clnt->header_version = clnt->header.version;
+
+        clnt->bytes_to_read += clnt->header.payload_length;
+        clnt->state = rtConnectionState_ReadPayload;
+      }
+    }
+    // an empty payload is already complete
+    if (clnt->state != rtConnectionState_ReadPayload)
+      break;
+    /* fall through */
+
+    case rtConnectionState_ReadPayload:
+    {
+      if (clnt->bytes_read == clnt->bytes_to_read)
+      {
+        rtRouter_DispatchMessageFromClient(clnt);
+        if (clnt->read_buffer_capacity > RTMSG_CLIENT_READ_BUFFER_SIZE)
+          rtConnectedClient_ShrinkReadBuffer(clnt);
+        clnt->bytes_to_read = 4;
+        clnt->bytes_read = 0;
+        clnt->state = rtConnectionState_ReadHeaderPreamble;
+        rtMessageHeaderView_Init(&clnt->header);
+      }
+    }
+    break;
+  }
+
+  return RT_OK;
+}
+
+// Drains everything queued on the ring. The socket carries nothing after setup, it
+// only reports the client going away, and that's only acted on once the ring is
+// empty so whatever the client wrote before closing still gets routed.
+static rtError
+rtConnectedClient_ReadShm(rtConnectedClient* clnt)
+{
+  char c;
+  rtError err;
+  ssize_t bytes_read;
+
+  rtShmChannel_ClearEvent(clnt->shm);
+
+  while (!clnt->recv_throttled && (bytes_read = rtShmChannel_Read(clnt->shm, &clnt->read_buffer[clnt->bytes_read],
+      clnt->bytes_to_read - clnt->bytes_read)) > 0)
+  {
+    err = rtConnectedClient_OnBytesRead(clnt, bytes_read);
+    if (err != RT_OK)
+      return err;
+  }
+
+  // held back, the rest stays on the ring until the shard resumes it
+  if (clnt->recv_throttled)
+    return RT_OK;
+
+  if (recv(clnt->fd, &c, 1, MSG_PEEK | MSG_DONTWAIT) == 0)
+  {
+    rtLog_Debug("read zero bytes, stream closed");
+    return RT_ERROR_STREAM_CLOSED;
+  }
+
+  return RT_OK;
+}
+
+static rtError 
+rtConnectedClient_Read(rtConnectedClient* clnt)
+{
+  ssize_t bytes_read;
+  int bytes_to_read = (clnt->bytes_to_read - clnt->bytes_read);
+
+  if (clnt->shm)
+    return rtConnectedClient_ReadShm(clnt);
+
+  bytes_read = recv(clnt->fd, &clnt->read_buffer[clnt->bytes_read], bytes_to_read, MSG_NOSIGNAL);
+  if (bytes_read == -1)
+  {
+    rtError e = rtErrorFromErrno(errno);
+    rtLog_Warn("read:%s", rtStrError(e));
+    return e;
+  }
+
+  if (bytes_read == 0)
+  {
+    rtLog_Debug("read zero bytes, stream closed");
+    return RT_ERROR_STREAM_CLOSED;
+  }
+
+  return rtConnectedClient_OnBytesRead(clnt, bytes_read);
+}
+
+static void
+rtRouted_PushFd(fd_set* fds, int fd, int* maxFd)
+{
+  if (fd != RTMSG_INVALID_FD)
+  {
+    FD_SET(fd, fds);
+    if (maxFd && fd > *maxFd)
+      *maxFd = fd;
+  }
+}
+
+// Always v1 so older clients can skip it. It's the first thing on every connection,
+// which is what lets publish-only clients find it without dispatching.
+static void
+rtConnectedClient_SendHello(rtConnectedClient* clnt)
+{
+  uint8_t* p;
+  uint32_t n;
+  rtMessage m;
+  rtMessageHeaderView hdr;
+
+  rtMessage_Create(&m);
+  rtMessage_SetInt32(m, "header_version", RTMSG_HEADER_MAX_VERSION);
+  rtMessage_ToByteArray(m, &p, &n);
+  rtMessage_Release(m);
+
+  rtMessageHeaderView_Init(&hdr);
+  hdr.version = RTMSG_HEADER_VERSION_1;
+  hdr.topic = "_RTROUTED.HELLO";
+  hdr.topic_length = strlen(hdr.topic);
+  hdr.payload_length = n;
+  rtMessageHeaderView_Encode(&hdr, clnt->send_buffer);
+
+  if (rtConnectedClient_Send(clnt, clnt->send_buffer, hdr.header_length, p, n) != RT_OK)
+    rtLog_Warn("failed to send hello to client [%s]", clnt->ident);
+  free(p);
+}
+
+static rtConnectedClient*
+rtRouted_RegisterNewClient(int fd, struct sockaddr_storage* remote_endpoint, int is_shm, rtRouterShard* shard)
+{
+  char remote_address[64];
+  uint16_t remote_port;
+  rtConnectedClient* new_client;
+
+  remote_address[0] = '\0';
+  remote_port = 0;
+  new_client = (rtConnectedClient *) malloc(sizeof(rtConnectedClient));
+  new_client->fd = -1;
+
+  rtConnectedClient_Init(new_client, fd, remote_endpoint);
+  new_client->shard = shard;
+  rtSocketStorage_ToString(&new_client->endpoint, remote_address, sizeof(remote_address), &remote_port);
+  snprintf(new_client->ident, RTMSG_ADDR_MAX, "%s:%d/%d", remote_address, remote_port, fd);
+  rtRouted_Count(&rtRouted_GetStats()->connections, 1);
+
+  if (is_shm && rtShmChannel_Create(&new_client->shm, fd, RTSHM_DEFAULT_RING_SIZE) != RT_OK)
+  {
+    rtLog_Warn("failed to set up shared memory for client [%s], closing connection", new_client->ident);
+    rtConnectedClient_Close(new_client);
+    rtConnectedClient_Free(new_client);
+    return NULL;
+  }
+
+  rtVector_PushBack(shard ? shard->clients : clients, new_client);
+  rtConnectedClient_SendHello(new_client);
+
+  rtLog_Info("new client:%s", new_client->ident);
+  return new_client;
+}
+
+#ifdef RTROUTED_WITH_IO_URING
+// low bits of user_data say what completed, the rest is the client
+typedef enum
+{
+  rtUringOp_Event = 0,
+  rtUringOp_Recv = 1,
+  rtUringOp_Send = 2,
+  rtUringOp_Poll = 3,
+  rtUringOp_Cancel = 4
+} rtUringOp;
+
+#define RTMSG_URING_OP_MASK 7
+
+static uint64_t
+rtRouterShard_UringData(void* p, rtUringOp op)
+{
+  return ((uint64_t) (uintptr_t) p) | op;
+}
+
+static void
+rtRouterShard_UringSetFd(struct io_uring_sqe* sqe, rtConnectedClient* clnt)
+{
+  if (clnt->file_slot != -1)
+  {
+    sqe->fd = clnt->file_slot;
+    sqe->flags |= IOSQE_FIXED_FILE;
+  }
+  else
+  {
+    sqe->fd = clnt->fd;
+  }
+}
+
+// runs when the kernel is done with a client, it's freed once nothing can still
+// complete against it
+static void
+rtRouterShard_UringOpDone(rtConnectedClient* clnt)
+{
+  if (--clnt->uring_ops == 0 && clnt->fd == -1)
+    rtRouted_Retire(clnt, rtConnectedClient_Free);
+}
+
+static rtError
+rtRouterShard_UringArmPoll(rtRouterShard* shard, rtConnectedClient* clnt, int fd, int fixed)
+{
+  struct io_uring_sqe* sqe = rtIoUring_GetSqe(&shard->uring);
+  if (!sqe)
+    return RT_FAIL;
+
+  sqe->opcode = IORING_OP_POLL_ADD;
+  if (fixed)
+    rtRouterShard_UringSetFd(sqe, clnt);
+  else
+    sqe->fd = fd;
+  sqe->poll32_events = POLLIN;
+  sqe->len = IORING_POLL_ADD_MULTI;
+  sqe->user_data = rtRouterShard_UringData(clnt, clnt ? rtUringOp_Poll : rtUringOp_Event);
+  if (clnt)
+    clnt->uring_ops++;
+  return RT_OK;
+}
+
+static rtError
+rtRouterShard_UringArmRecv(rtRouterShard* shard, rtConnectedClient* clnt)
+{
+  struct io_uring_sqe* sqe = rtIoUring_GetSqe(&shard->uring);
+  if (!sqe)
+    return RT_FAIL;
+
+  // keeps delivering into provided buffers until it fails or runs out of them
+  sqe->opcode = IORING_OP_RECV;
+  rtRouterShard_UringSetFd(sqe, clnt);
+  sqe->ioprio = IORING_RECV_MULTISHOT;
+  sqe->flags |= IOSQE_BUFFER_SELECT;
+  sqe->buf_group = RTIOURING_BUFFER_GROUP;
+  sqe->user_data = rtRouterShard_UringData(clnt, rtUringOp_Recv);
+  clnt->uring_ops++;
+  clnt->recv_armed = 1;
+  return RT_OK;
+}
+
+// ends the multishot recv of a client that's being held back
+static void
+rtRouterShard_UringCancelRecv(rtRouterShard* shard, rtConnectedClient* clnt)
+{
+  struct io_uring_sqe* sqe = rtIoUring_GetSqe(&shard->uring);
+  if (!sqe)
+    return;
+
+  sqe->opcode = IORING_OP_ASYNC_CANCEL;
+  sqe->addr = rtRouterShard_UringData(clnt, rtUringOp_Recv);
+  sqe->user_data = rtRouterShard_UringData(NULL, rtUringOp_Cancel);
+  clnt->recv_cancelled = 1;
+}
+
+static void
+rtRouterShard_UringRemoveClient(rtRouterShard* shard, rtConnectedClient* clnt)
+{
+  struct io_uring_sqe* sqe;
+
+  if (clnt->fd == -1)
+    return;
+
+  rtVector_SwapRemoveItem(shard->clients, clnt, NULL);
+  if (clnt->send_pending)
+  {
+    rtVector_RemoveItem(shard->flush, clnt, NULL);
+    clnt->send_pending = 0;
+  }
+
+  // stop the multishot requests, shutting down fails any send still running
+  sqe = rtIoUring_GetSqe(&shard->uring);
+  if (sqe)
+  {
+    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    sqe->addr = rtRouterShard_UringData(clnt, clnt->shm ? rtUringOp_Poll : rtUringOp_Recv);
+    sqe->cancel_flags = IORING_ASYNC_CANCEL_ALL;
+    sqe->user_data = rtRouterShard_UringData(NULL, rtUringOp_Cancel);
+  }
+  shutdown(clnt->fd, SHUT_RDWR);
+
+  if (clnt->file_slot != -1)
+  {
+    rtIoUring_SetFile(&shard->uring, clnt->file_slot, -1);
+    shard->free_slots[shard->num_free_slots++] = clnt->file_slot;
+    clnt->file_slot = -1;
+  }
+
+  rtConnectedClient_Close(clnt);
+  if (clnt->uring_ops == 0)
+    rtRouted_Retire(clnt, rtConnectedClient_Free);
+}
+
+static void
+rtRouterShard_UringAddClient(rtRouterShard* shard, rtConnectedClient* clnt)
+{
+  rtError err;
+
+  // without a free slot the client still works, just with a plain fd
+  if (shard->num_free_slots > 0)
+  {
+    int slot = shard->free_slots[shard->num_free_slots - 1];
+    if (rtIoUring_SetFile(&shard->uring, slot, clnt->fd) == RT_OK)
+    {
+      clnt->file_slot = slot;
+      shard->num_free_slots--;
+    }
+  }
+
+  if (clnt->shm)
+  {
+    err = rtRouterShard_UringArmPoll(shard, clnt, clnt->fd, 1);
+    if (err == RT_OK)
+      err = rtRouterShard_UringArmPoll(shard, clnt, rtShmChannel_GetFd(clnt->shm), 0);
+  }
+  else
+  {
+    err = rtRouterShard_UringArmRecv(shard, clnt);
+  }
+
+  if (err != RT_OK)
+  {
+    rtLog_Warn("failed to add client [%s] to shard %d", clnt->ident, shard->index);
+    rtRouterShard_UringRemoveClient(shard, clnt);
+  }
+}
+#endif
+
+static void
+rtRouterShard_RemoveClient(rtRouterShard* shard, rtConnectedClient* clnt)
+{
+#ifdef RTROUTED_WITH_IO_URING
+  if (shard->use_uring)
+  {
+    rtRouterShard_UringRemoveClient(shard, clnt);
+    return;
+  }
+#endif
+
+  epoll_ctl(shard->epoll_fd, EPOLL_CTL_DEL, clnt->fd, NULL);
+  if (clnt->shm)
+    epoll_ctl(shard->epoll_fd, EPOLL_CTL_DEL, rtShmChannel_GetFd(clnt->shm), NULL);
+  rtVector_SwapRemoveItem(shard->clients, clnt, NULL);
+  rtConnectedClient_Destroy(clnt);
+}
+
+static void
+rtRouterShard_AcceptClients(rtRouterShard* shard)
+{
+  rtShardNewClient* new_client;
+
+  while ((new_client = (rtShardNewClient *) rtRing_Pop(&shard->new_clients)) != NULL)
+  {
+    struct epoll_event ev;
+    rtConnectedClient* clnt = rtRouted_RegisterNewClient(new_client->fd, &new_client->endpoint,
+      new_client->is_shm, shard);
+
+    free(new_client);
+    if (!clnt)
+      continue;
+
+#ifdef RTROUTED_WITH_IO_URING
+    if (shard->use_uring)
+    {
+      rtRouterShard_UringAddClient(shard, clnt);
+      continue;
+    }
+#endif
+
+    ev.events = EPOLLIN;
+    ev.data.ptr = clnt;
+    if (epoll_ctl(shard->epoll_fd, EPOLL_CTL_ADD, clnt->fd, &ev) == -1 ||
+        (clnt->shm && epoll_ctl(shard->epoll_fd, EPOLL_CTL_ADD, rtShmChannel_GetFd(clnt->shm), &ev) == -1))
+    {
+      rtLog_Warn("failed to add client [%s] to shard %d. %s", clnt->ident, shard->index, strerror(errno));
+      rtRouterShard_RemoveClient(shard, clnt);
+    }
+  }
+}
+
+static void
+rtRouterShard_DrainInbound(rtRouterShard* shard)
+{
+  int i;
+  rtShardMessage* msg;
+
+  for (i = 0; i < num_shards; ++i)
+  {
+    while ((msg = (rtShardMessage *) rtRing_Pop(&shard->inbound[i])) != NULL)
+    {
+      rtError err = RT_FAIL;
+      uint8_t const* payload = msg->data + msg->header.topic_length + msg->header.reply_topic_length;
+
+      // the client may have gone away since the message was queued
+      if (msg->client->fd != -1)
+      {
+        err = rtConnectedClient_Forward(msg->client, &msg->header, msg->subscription_id,
+          payload, msg->payload_length);
+      }
+
+      // give back the reference taken for the subscriber
+      if (err != RT_OK && (msg->header.flags & rtMessageFlags_SharedPayload))
+      {
+        rtShmSlab slab;
+        if (rtShmSlab_Open(&slab, (char const *) payload, msg->payload_length) == RT_OK)
+        {
+          rtShmSlab_ReleaseHolder(slab, msg->client->peer_pid);
+          rtShmSlab_Close(slab);
+        }
+      }
+      free(msg);
+    }
+  }
+}
+
+static int
+rtRetiredItem_IsReclaimable(rtRetiredItem const* retired)
+{
+  int i;
+  for (i = 0; i < num_shards; ++i)
+  {
+    uint64_t seen = retired->seen[i];
+    if ((seen & 1) && __atomic_load_n(&shards[i].quiescent, __ATOMIC_SEQ_CST) == seen)
+      return 0;
+  }
+  return 1;
+}
+
+static int
+rtRetiredItem_IsDestroyed(void* item, void* closure)
+{
+  (void) closure;
+  return ((rtRetiredItem *) item)->item == NULL;
+}
+
+static void
+rtRouterShard_Reclaim(rtRouterShard* shard)
+{
+  size_t i;
+  size_t n;
+  size_t count;
+
+  // retired in order, stop at the first one still in use
+  for (count = 0, n = rtVector_Size(shard->retired); count < n; ++count)
+  {
+    if (!rtRetiredItem_IsReclaimable((rtRetiredItem *) rtVector_At(shard->retired, count)))
+      break;
+  }
+
+  if (count == 0)
+    return;
+
+  // other shards finished queueing messages to retired clients before going
+  // quiescent, send or drop those before the clients are freed
+  rtRouterShard_DrainInbound(shard);
+
+  for (i = 0; i < count; ++i)
+  {
+    rtRetiredItem* retired = (rtRetiredItem *) rtVector_At(shard->retired, i);
+    retired->destroy(retired->item);
+    retired->item = NULL;
+  }
+  rtVector_RemoveIf(shard->retired, rtRetiredItem_IsDestroyed, NULL, free);
+}
+
+// everything a shard does once per loop after handling I/O
+static void
+rtRouterShard_Service(rtRouterShard* shard)
+{
+  int i;
+
+  rtRouterShard_AcceptClients(shard);
+  rtRouterShard_DrainInbound(shard);
+  rtRouterShard_Reclaim(shard);
+
+  if (shard->index == 0)
+    rtRouted_PublishStats();
+
+  for (i = 0; i < num_shards; ++i)
+  {
+    if (shard->notify[i])
+    {
+      shard->notify[i] = 0;
+      rtRouterShard_Notify(&shards[i]);
+    }
+  }
+}
+
+#ifdef RTROUTED_WITH_IO_URING
+// copies a chunk from a provided buffer into the client's message buffer
+static rtError
+rtConnectedClient_Feed(rtConnectedClient* clnt, uint8_t const* data, uint32_t n)
 {
-  rtRouted_ClearClientRoutes(clnt);
+  rtError err;
 
-  if (clnt->fd != -1)
-    close(clnt->fd);
+  while (n > 0)
+  {
+    uint32_t count = clnt->bytes_to_read - clnt->bytes_read;
+    if (count > n)
+      count = n;
 
-  if (clnt->read_buffer)
-    free(clnt->read_buffer);
+    memcpy(&clnt->read_buffer[clnt->bytes_read], data, count);
+    err = rtConnectedClient_OnBytesRead(clnt, count);
+    if (err != RT_OK)
+      return err;
 
-  if (clnt->send_buffer)
-    free(clnt->send_buffer);
+    // dispatching can drop the client
+    if (clnt->fd == -1)
+      return RT_ERROR_STREAM_CLOSED;
 
-  free(clnt);
+    data += count;
+    n -= count;
+  }
+  return RT_OK;
 }
 
-static rtError
-rtRouted_ForwardMessage(rtConnectedClient* sender, rtMessageHeader* hdr, uint8_t const* buff, int n, rtSubscription* subscription)
+static void
+rtRouterShard_UringOnRecv(rtRouterShard* shard, rtConnectedClient* clnt, struct io_uring_cqe* cqe)
 {
-  ssize_t bytes_sent;
-
-  (void) sender;
-
-  rtMessageHeader new_header;
-  rtMessageHeader_Init(&new_header);
-  new_header.version = hdr->version;
-  new_header.header_length = hdr->header_length;
-  new_header.sequence_number = hdr->sequence_number;
-  new_header.control_data = subscription->id;
-  new_header.payload_length = hdr->payload_length;
-  new_header.topic_length = hdr->topic_length;
-  new_header.reply_topic_length = hdr->reply_topic_length;
-  new_header.flags = hdr->flags;
-  strcpy(new_header.topic, hdr->topic);
-  strcpy(new_header.reply_topic, hdr->reply_topic);
-  rtMessageHeader_Encode(&new_header, subscription->client->send_buffer);
+  rtError err = RT_OK;
+  int more = cqe->flags & IORING_CQE_F_MORE;
+  uint16_t bid = (uint16_t) (cqe->flags >> IORING_CQE_BUFFER_SHIFT);
 
-  // rtDebug_PrintBuffer("fwd header", subscription->client->send_buffer, new_header.length);
+  if (cqe->res > 0 && clnt->fd != -1)
+    err = rtConnectedClient_Feed(clnt, rtIoUring_GetBuffer(&shard->uring, bid), (uint32_t) cqe->res);
+  if (cqe->flags & IORING_CQE_F_BUFFER)
+    rtIoUring_RecycleBuffer(&shard->uring, bid);
 
-  bytes_sent = send(subscription->client->fd, subscription->client->send_buffer, new_header.header_length, MSG_NOSIGNAL);
-  if (bytes_sent == -1)
+  if (!more)
   {
-    if (errno == EBADF)
-    {
-      return rtErrorFromErrno(errno);
-    }
-    else
-    {
-      rtLog_Warn("error forwarding message to client. %d %s", errno, strerror(errno));
-    }
-    return RT_FAIL;
+    clnt->recv_armed = 0;
+    clnt->recv_cancelled = 0;
   }
 
-  bytes_sent = send(subscription->client->fd, buff, n, MSG_NOSIGNAL);
-  if (bytes_sent == -1)
+  if (clnt->fd != -1)
   {
-    if (errno == EBADF)
+    // out of buffers only ends the multishot, the ones just used are back. A client
+    // that's held back isn't read from again until rtRouterShard_UringResume.
+    if (cqe->res == 0 || (cqe->res < 0 && cqe->res != -ENOBUFS && cqe->res != -ECANCELED) || err != RT_OK)
     {
-      return rtErrorFromErrno(EBADF);
+      if (cqe->res < 0)
+        rtLog_Warn("read:%s", rtStrError(rtErrorFromErrno(-cqe->res)));
+      rtRouterShard_UringRemoveClient(shard, clnt);
     }
-    else
+    else if (more && clnt->recv_throttled && !clnt->recv_cancelled)
     {
-      rtLog_Warn("error forwarding message to client. %d %s", errno, strerror(errno));
+      rtRouterShard_UringCancelRecv(shard, clnt);
+    }
+    else if (!more && !clnt->recv_throttled && rtRouterShard_UringArmRecv(shard, clnt) != RT_OK)
+    {
+      rtRouterShard_UringRemoveClient(shard, clnt);
     }
-    return RT_FAIL;
   }
-  return RT_OK;
-}
-
-static rtError 
-rtRouted_PrintMessage(rtConnectedClient* sender, rtMessageHeader* hdr, uint8_t const* buff,
-  int n, rtSubscription* subscription)
-{
-  (void) hdr;
-  (void) sender;
-  (void) subscription;
 
-  printf("message debug\n");
-  printf("'%.*s'\n", n, (char *) buff);
-  return RT_OK;
+  if (!more)
+    rtRouterShard_UringOpDone(clnt);
 }
 
-static rtError
-rtRouted_OnMessage(rtConnectedClient* sender, rtMessageHeader* hdr, uint8_t const* buff,
-  int n, rtSubscription* not_unsed)
+static void
+rtRouterShard_UringOnSend(rtRouterShard* shard, rtConnectedClient* clnt, struct io_uring_cqe* cqe)
 {
-  (void) not_unsed;
+  uint32_t sent;
+
+  clnt->send_in_flight = 0;
 
-  if (strcmp(hdr->topic, "_RTROUTED.INBOX.SUBSCRIBE") == 0)
+  if (clnt->fd != -1 && cqe->res < 0)
   {
-    char const* expression = NULL;
-    int32_t route_id = 0;
+    rtLog_Warn("error forwarding message to client [%s]. %s", clnt->ident,
+      rtStrError(rtErrorFromErrno(-cqe->res)));
+    rtRouterShard_UringRemoveClient(shard, clnt);
+  }
+  else if (clnt->fd != -1)
+  {
+    sent = (uint32_t) cqe->res;
+    while (sent > 0 && clnt->send_head)
+    {
+      rtOutboundMessage* msg = clnt->send_head;
+      uint32_t remaining = msg->length - clnt->send_offset;
+      if (sent < remaining)
+      {
+        clnt->send_offset += sent;
+        break;
+      }
 
-    rtMessage m;
-    rtMessage_FromBytes(&m, buff, n);
-    rtMessage_GetString(m, "topic", &expression);
-    rtMessage_GetInt32(m, "route_id", &route_id);
+      sent -= remaining;
+      clnt->send_offset = 0;
+      __atomic_fetch_sub(&clnt->send_queued_bytes, msg->length, __ATOMIC_SEQ_CST);
+      clnt->send_head = msg->next;
+      if (!clnt->send_head)
+        clnt->send_tail = NULL;
+      free(msg);
+    }
 
-    rtSubscription* subscription = (rtSubscription *) malloc(sizeof(rtSubscription));
-    subscription->id = route_id;
-    subscription->client = sender;
-    rtRouted_AddRoute(rtRouted_ForwardMessage, expression, subscription);
+    if (clnt->send_head && !clnt->send_pending)
+    {
+      clnt->send_pending = 1;
+      rtVector_PushBack(shard->flush, clnt);
+    }
 
-    rtMessage_Release(m);
+    // resuming at half the limit keeps publishers from flapping on and off
+    if (__atomic_load_n(&clnt->send_queued_bytes, __ATOMIC_SEQ_CST) < RTMSG_URING_RESUME_QUEUED_BYTES &&
+        __atomic_load_n(&clnt->congested, __ATOMIC_SEQ_CST) &&
+        __atomic_exchange_n(&clnt->congested, 0, __ATOMIC_SEQ_CST))
+      rtRouted_ResumeSenders();
   }
-  else if (strcmp(hdr->topic, "_RTROUTED.INBOX.HELLO") == 0)
-  {
-    char const* inbox = NULL;
 
-    rtMessage m;
-    rtMessage_FromBytes(&m, buff, n);
-    rtMessage_GetString(m, "inbox", &inbox);
+  rtRouterShard_UringOpDone(clnt);
+}
 
-    rtSubscription* subscription = (rtSubscription *) malloc(sizeof(rtSubscription));
-    subscription->id = 0;
-    subscription->client = sender;
-    rtRouted_AddRoute(rtRouted_ForwardMessage, inbox, subscription);
+// Some subscriber caught up, read from the clients held back again. Any still
+// publishing to one that's over the limit are held back again after their next read.
+static void
+rtRouterShard_UringResume(rtRouterShard* shard)
+{
+  size_t i;
+  rtVector held;
 
-    rtMessage_Release(m);
+  // reading can remove clients, so pick them out first
+  rtVector_Create(&held);
+  for (i = 0; i < rtVector_Size(shard->clients); ++i)
+  {
+    rtConnectedClient* clnt = (rtConnectedClient *) rtVector_At(shard->clients, i);
+    if (clnt->recv_throttled)
+    {
+      clnt->recv_throttled = 0;
+      rtVector_PushBack(held, clnt);
+    }
   }
-  else
+
+  for (i = 0; i < rtVector_Size(held); ++i)
   {
-    rtLog_Info("no handler for message:%s", hdr->topic);
+    rtConnectedClient* clnt = (rtConnectedClient *) rtVector_At(held, i);
+    if (clnt->fd == -1)
+      continue;
+
+    if (clnt->shm)
+    {
+      if (rtConnectedClient_Read(clnt) != RT_OK)
+        rtRouterShard_UringRemoveClient(shard, clnt);
+    }
+    else if (!clnt->recv_armed && rtRouterShard_UringArmRecv(shard, clnt) != RT_OK)
+    {
+      rtRouterShard_UringRemoveClient(shard, clnt);
+    }
   }
-  return RT_OK;
+  rtVector_Destroy(held, NULL);
 }
 
 static int
-rtRouted_IsTopicMatch(char const* topic, char const* exp)
+rtConnectedClient_IsFlushed(void* item, void* closure)
 {
-  char const* t = topic;
-  char const* e = exp;
+  (void) closure;
+  return !((rtConnectedClient *) item)->send_pending;
+}
 
+// One sendmsg per client covering as much of its queue as fits. Only one is in
+// flight per client so the stream stays in order.
+static void
+rtRouterShard_UringFlush(rtRouterShard* shard)
+{
+  size_t i;
+  size_t n;
 
-  while (*t && *e)
+  for (i = 0, n = rtVector_Size(shard->flush); i < n; ++i)
   {
-    if (*e == '*')
+    int iovcnt;
+    uint32_t offset;
+    rtOutboundMessage* msg;
+    struct io_uring_sqe* sqe;
+    rtConnectedClient* clnt = (rtConnectedClient *) rtVector_At(shard->flush, i);
+
+    if (clnt->fd == -1 || clnt->send_in_flight || !clnt->send_head)
     {
-      while (*t && *t != '.')
-        t++;
-      e++;
+      clnt->send_pending = 0;
+      continue;
     }
 
-    if (*e == '>')
+    offset = clnt->send_offset;
+    for (iovcnt = 0, msg = clnt->send_head; msg && iovcnt < RTMSG_URING_MAX_IOV; msg = msg->next, ++iovcnt)
     {
-      while (*t)
-        t++;
-      e++;
+      clnt->send_iov[iovcnt].iov_base = msg->data + offset;
+      clnt->send_iov[iovcnt].iov_len = msg->length - offset;
+      offset = 0;
     }
 
-    if (!(*t || *e))
-      break;
+    memset(&clnt->send_msg, 0, sizeof(clnt->send_msg));
+    clnt->send_msg.msg_iov = clnt->send_iov;
+    clnt->send_msg.msg_iovlen = iovcnt;
 
-    if (*t != *e)
+    sqe = rtIoUring_GetSqe(&shard->uring);
+    if (!sqe)
       break;
 
-    t++;
-    e++;
+    clnt->send_pending = 0;
+    sqe->opcode = IORING_OP_SENDMSG;
+    rtRouterShard_UringSetFd(sqe, clnt);
+    sqe->addr = (uint64_t) (uintptr_t) &clnt->send_msg;
+    sqe->len = 1;
+    sqe->msg_flags = MSG_NOSIGNAL | MSG_WAITALL;
+    sqe->user_data = rtRouterShard_UringData(clnt, rtUringOp_Send);
+    clnt->send_in_flight = 1;
+    clnt->uring_ops++;
   }
 
-  // rtLogInfo("match[%d]: %s <> %s", !(*t || *e), topic, exp);
-  return !(*t || *e);
+  // anything skipped above gets picked up again next time around
+  rtVector_RemoveIf(shard->flush, rtConnectedClient_IsFlushed, NULL, NULL);
 }
 
 static void
-rtConnectedClient_Init(rtConnectedClient* clnt, int fd, struct sockaddr_storage* remote_endpoint)
+rtRouterShard_RunUring(rtRouterShard* shard)
 {
-  clnt->fd = fd;
-  clnt->state = rtConnectionState_ReadHeaderPreamble;
-  clnt->bytes_read = 0;
-  clnt->bytes_to_read = 4;
-  clnt->read_buffer = (uint8_t *) malloc(RTMSG_CLIENT_READ_BUFFER_SIZE);
-  clnt->send_buffer = (uint8_t *) malloc(RTMSG_CLIENT_READ_BUFFER_SIZE);
-  memcpy(&clnt->endpoint, remote_endpoint, sizeof(struct sockaddr_storage));
-  memset(clnt->read_buffer, 0, RTMSG_CLIENT_READ_BUFFER_SIZE);
-  memset(clnt->send_buffer, 0, RTMSG_CLIENT_READ_BUFFER_SIZE);
-  rtMessageHeader_Init(&clnt->header);
-}
+  int i;
+  struct io_uring_cqe* cqe;
 
-static void
-rtRouter_DispatchMessageFromClient(rtConnectedClient* clnt)
-{
-  size_t i;
-  size_t n;
-  int match_found = 0;
+  shard->free_slots = (int *) malloc(sizeof(int) * RTMSG_URING_MAX_FILES);
+  for (i = 0; i < RTMSG_URING_MAX_FILES; ++i)
+    shard->free_slots[i] = RTMSG_URING_MAX_FILES - 1 - i;
+  shard->num_free_slots = RTMSG_URING_MAX_FILES;
+  rtRouterShard_UringArmPoll(shard, NULL, shard->event_fd, 0);
 
-  for (i = 0, n = rtVector_Size(routes); i < n;)
+  while (1)
   {
-    rtError err = RT_OK;
-    rtRouteEntry* route = (rtRouteEntry *) rtVector_At(routes, i);
-    if (rtRouted_IsTopicMatch(clnt->header.topic, route->expression))
+    // quiescent (even) while blocked, nothing from the route table is held here
+    __atomic_add_fetch(&shard->quiescent, 1, __ATOMIC_SEQ_CST);
+    rtError err = rtIoUring_Submit(&shard->uring, 1, 1000);
+    __atomic_add_fetch(&shard->quiescent, 1, __ATOMIC_SEQ_CST);
+
+    if (err != RT_OK)
+      rtLog_Warn("io_uring_enter:%s", rtStrError(err));
+
+    while ((cqe = rtIoUring_PeekCqe(&shard->uring)) != NULL)
     {
-      match_found = 1;
-      err = route->message_handler(clnt, &clnt->header, clnt->read_buffer +
-          clnt->header.header_length, clnt->header.payload_length, route->subscription);
+      rtConnectedClient* clnt = (rtConnectedClient *) (uintptr_t) (cqe->user_data & ~(uint64_t) RTMSG_URING_OP_MASK);
 
-      if (err != RT_OK)
+      switch (cqe->user_data & RTMSG_URING_OP_MASK)
       {
-        if (err == rtErrorFromErrno(EBADF))
+        case rtUringOp_Event:
+        {
+          uint64_t count;
+          if (read(shard->event_fd, &count, sizeof(count)) == -1 && errno != EAGAIN)
+            rtLog_Warn("failed to read shard %d event. %s", shard->index, strerror(errno));
+          if (!(cqe->flags & IORING_CQE_F_MORE))
+            rtRouterShard_UringArmPoll(shard, NULL, shard->event_fd, 0);
+          if (__atomic_exchange_n(&shard->resume_senders, 0, __ATOMIC_SEQ_CST))
+            rtRouterShard_UringResume(shard);
+        }
+        break;
+
+        case rtUringOp_Recv:
+          rtRouterShard_UringOnRecv(shard, clnt, cqe);
+          break;
+
+        case rtUringOp_Send:
+          rtRouterShard_UringOnSend(shard, clnt, cqe);
+          break;
+
+        case rtUringOp_Poll:
         {
-          rtRouted_ClearClientRoutes(clnt);
-          n = rtVector_Size(routes);
+          // shared memory clients, the ring is read directly
+          if (clnt->fd != -1 && rtConnectedClient_Read(clnt) != RT_OK)
+            rtRouterShard_UringRemoveClient(shard, clnt);
+          if (!(cqe->flags & IORING_CQE_F_MORE))
+          {
+            if (clnt->fd != -1)
+              rtRouterShard_UringRemoveClient(shard, clnt);
+            rtRouterShard_UringOpDone(clnt);
+          }
         }
+        break;
+
+        default:
+          break;
       }
+
+      rtIoUring_CqeSeen(&shard->uring);
     }
 
-    if (err == RT_OK)
-      i++;
-  }
-  int is_request = rtMessageHeader_IsRequest(&clnt->header);
-  if (!match_found && is_request)
-  {
-    // TODO: If this is a request, then send message directly back 
-    // to caller
-    rtLog_Error("no client found for match:%s", clnt->header.topic);
-    //No route Found , Returning an Error Message to caller
-    rtConnection_SendErrorMessageToCaller(clnt->fd, &clnt->header);
+    rtRouterShard_Service(shard);
+    rtRouterShard_UringFlush(shard);
   }
 }
+#endif
 
-static rtError 
-rtConnectedClient_Read(rtConnectedClient* clnt)
+static void*
+rtRouterShard_Run(void* argp)
 {
-  ssize_t bytes_read;
-  int bytes_to_read = (clnt->bytes_to_read - clnt->bytes_read);
+  int i;
+  int n;
+  struct epoll_event events[RTMSG_SHARD_MAX_EVENTS];
+  rtRouterShard* shard = (rtRouterShard *) argp;
 
-  bytes_read = recv(clnt->fd, &clnt->read_buffer[clnt->bytes_read], bytes_to_read, MSG_NOSIGNAL);
-  if (bytes_read == -1)
+  current_shard = shard;
+  rtRouted_InitRouteCache();
+
+#ifdef RTROUTED_WITH_IO_URING
+  if (use_io_uring)
   {
-    rtError e = rtErrorFromErrno(errno);
-    rtLog_Warn("read:%s", rtStrError(e));
-    return e;
+    rtError err = rtIoUring_Init(&shard->uring, RTMSG_URING_ENTRIES, RTMSG_URING_MAX_FILES,
+      RTMSG_URING_NUM_BUFFERS, RTMSG_URING_BUFFER_SIZE);
+    if (err == RT_OK)
+    {
+      shard->use_uring = 1;
+      rtRouterShard_RunUring(shard);
+      return NULL;
+    }
+    rtLog_Warn("shard %d can't use io_uring, falling back to epoll. %s", shard->index, rtStrError(err));
   }
+#endif
 
-  if (bytes_read == 0)
+  while (1)
   {
-    rtLog_Debug("read zero bytes, stream closed");
-    return RT_ERROR_STREAM_CLOSED;
-  }
+    // quiescent (even) while blocked, nothing from the route table is held here
+    __atomic_add_fetch(&shard->quiescent, 1, __ATOMIC_SEQ_CST);
+    n = epoll_wait(shard->epoll_fd, events, RTMSG_SHARD_MAX_EVENTS, 1000);
+    __atomic_add_fetch(&shard->quiescent, 1, __ATOMIC_SEQ_CST);
 
-  clnt->bytes_read += bytes_read;
+    if (n == -1 && errno != EINTR)
+      rtLog_Warn("epoll_wait:%s", rtStrError(rtErrorFromErrno(errno)));
 
-  switch (clnt->state)
-  {
-    case rtConnectionState_ReadHeaderPreamble:
+    for (i = 0; i < n; ++i)
     {
-      // read version/length of header
-      if (clnt->bytes_read == clnt->bytes_to_read)
+      rtConnectedClient* clnt = (rtConnectedClient *) events[i].data.ptr;
+      if (!clnt)
       {
-        uint8_t const* itr = &clnt->read_buffer[2];
-        uint16_t header_length = 0;
-        rtEncoder_DecodeUInt16(&itr, &header_length);
-        clnt->bytes_to_read += (header_length - 4);
-        clnt->state = rtConnectionState_ReadHeader;
+        uint64_t count;
+        if (read(shard->event_fd, &count, sizeof(count)) == -1 && errno != EAGAIN)
+          rtLog_Warn("failed to read shard %d event. %s", shard->index, strerror(errno));
+        continue;
       }
-    }
-    break;
 
-    case rtConnectionState_ReadHeader:
-    {
-      if (clnt->bytes_read == clnt->bytes_to_read)
-      {
-        rtMessageHeader_Decode(&clnt->header, clnt->read_buffer);
-        clnt->bytes_to_read += clnt->header.payload_length;
-        clnt->state = rtConnectionState_ReadPayload;
-      }
-    }
-    break;
+      // shared memory clients have two fds, both may be in this batch
+      if (clnt->fd == -1)
+        continue;
 
-    case rtConnectionState_ReadPayload:
-    {
-      if (clnt->bytes_read == clnt->bytes_to_read)
-      {
-        rtRouter_DispatchMessageFromClient(clnt);
-        clnt->bytes_to_read = 4;
-        clnt->bytes_read = 0;
-        clnt->state = rtConnectionState_ReadHeaderPreamble;
-        rtMessageHeader_Init(&clnt->header);
-      }
+      if (rtConnectedClient_Read(clnt) != RT_OK)
+        rtRouterShard_RemoveClient(shard, clnt);
     }
-    break;
+
+    rtRouterShard_Service(shard);
   }
 
-  return RT_OK;
+  return NULL;
 }
 
 static void
-rtRouted_PushFd(fd_set* fds, int fd, int* maxFd)
+rtRouted_StartShards(int count)
 {
-  if (fd != RTMSG_INVALID_FD)
+  int i;
+  int j;
+  struct epoll_event ev;
+
+  shards = (rtRouterShard *) calloc(count, sizeof(rtRouterShard));
+  num_shards = count;
+
+  for (i = 0; i < count; ++i)
   {
-    FD_SET(fd, fds);
-    if (maxFd && fd > *maxFd)
-      *maxFd = fd;
+    rtRouterShard* shard = &shards[i];
+    shard->index = i;
+    shard->quiescent = 1;
+    shard->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    shard->event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (shard->epoll_fd == -1 || shard->event_fd == -1)
+    {
+      rtLog_Fatal("failed to create shard %d. %s", i, rtStrError(rtErrorFromErrno(errno)));
+      exit(1);
+    }
+
+    ev.events = EPOLLIN;
+    ev.data.ptr = NULL;
+    epoll_ctl(shard->epoll_fd, EPOLL_CTL_ADD, shard->event_fd, &ev);
+
+    rtVector_Create(&shard->clients);
+    rtVector_Create(&shard->retired);
+    rtVector_Create(&shard->flush);
+    rtRing_Init(&shard->new_clients, RTMSG_SHARD_RING_SIZE);
+    shard->inbound = (rtRing *) calloc(count, sizeof(rtRing));
+    for (j = 0; j < count; ++j)
+      rtRing_Init(&shard->inbound[j], RTMSG_SHARD_RING_SIZE);
+    shard->notify = (uint8_t *) calloc(count, sizeof(uint8_t));
+  }
+
+  for (i = 0; i < count; ++i)
+  {
+    if (pthread_create(&shards[i].thread, NULL, rtRouterShard_Run, &shards[i]) != 0)
+    {
+      rtLog_Fatal("failed to start shard %d", i);
+      exit(1);
+    }
   }
+
+  rtLog_Info("running with %d shards", count);
 }
 
+// round robin, the accepting thread is the only producer on each new_clients ring
 static void
-rtRouted_RegisterNewClient(int fd, struct sockaddr_storage* remote_endpoint)
+rtRouted_HandOffClient(int fd, struct sockaddr_storage* remote_endpoint, int is_shm)
 {
-  char remote_address[64];
-  uint16_t remote_port;
-  rtConnectedClient* new_client;
+  static int next_shard = 0;
+  rtRouterShard* shard = &shards[next_shard];
+  rtShardNewClient* new_client;
 
-  remote_address[0] = '\0';
-  remote_port = 0;
-  new_client = (rtConnectedClient *) malloc(sizeof(rtConnectedClient));
-  new_client->fd = -1;
+  next_shard = (next_shard + 1) % num_shards;
 
-  rtConnectedClient_Init(new_client, fd, remote_endpoint);
-  rtSocketStorage_ToString(&new_client->endpoint, remote_address, sizeof(remote_address), &remote_port);
-  snprintf(new_client->ident, RTMSG_ADDR_MAX, "%s:%d/%d", remote_address, remote_port, fd);
-  rtVector_PushBack(clients, new_client);
+  new_client = (rtShardNewClient *) malloc(sizeof(rtShardNewClient));
+  new_client->fd = fd;
+  new_client->is_shm = is_shm;
+  memcpy(&new_client->endpoint, remote_endpoint, sizeof(struct sockaddr_storage));
+  if (!rtRing_Push(&shard->new_clients, new_client))
+  {
+    rtLog_Warn("shard %d not accepting clients, closing connection", shard->index);
+    close(fd);
+    free(new_client);
+    return;
+  }
 
-  rtLog_Info("new client:%s", new_client->ident);
+  rtRouterShard_Notify(shard);
 }
 
+// Listeners are non-blocking so a burst of connections is taken in one wakeup.
+// Client sockets stay blocking, forwarding writes each message whole.
 static void
 rtRouted_AcceptClientConnection(rtListener* listener)
 {
@@ -456,17 +2481,26 @@ rtRouted_AcceptClientConnection(rtListener* listener)
   socklen_t                 socket_length;
   struct sockaddr_storage   remote_endpoint;
 
-  socket_length = sizeof(struct sockaddr_storage);
-  memset(&remote_endpoint, 0, sizeof(struct sockaddr_storage));
-
-  fd = accept(listener->fd, (struct sockaddr *)&remote_endpoint, &socket_length);
-  if (fd == -1)
+  while (1)
   {
-    rtLog_Warn("accept:%s", rtStrError(errno));
-    return;
-  }
+    socket_length = sizeof(struct sockaddr_storage);
+    memset(&remote_endpoint, 0, sizeof(struct sockaddr_storage));
+
+    fd = accept4(listener->fd, (struct sockaddr *)&remote_endpoint, &socket_length, SOCK_CLOEXEC);
+    if (fd == -1)
+    {
+      if (errno == EINTR || errno == ECONNABORTED)
+        continue;
+      if (errno != EAGAIN && errno != EWOULDBLOCK)
+        rtLog_Warn("accept:%s", rtStrError(errno));
+      return;
+    }
 
-  rtRouted_RegisterNewClient(fd, &remote_endpoint);
+    if (num_shards > 0)
+      rtRouted_HandOffClient(fd, &remote_endpoint, listener->is_shm);
+    else
+      rtRouted_RegisterNewClient(fd, &remote_endpoint, listener->is_shm, NULL);
+  }
 }
 
 static rtError 
@@ -479,13 +2513,17 @@ rtRouted_BindListener(char const* socket_name, int no_delay)
 
   listener = (rtListener *) malloc(sizeof(rtListener));
   listener->fd = -1;
+  listener->is_shm = (strncmp(socket_name, "shm://", 6) == 0);
   memset(&listener->local_endpoint, 0, sizeof(struct sockaddr_storage));
 
   err = rtSocketStorage_FromString(&listener->local_endpoint, socket_name);
   if (err != RT_OK)
+  {
+    free(listener);
     return err;
+  }
 
-  listener->fd = socket(listener->local_endpoint.ss_family, SOCK_STREAM, 0);
+  listener->fd = socket(listener->local_endpoint.ss_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
   if (listener->fd == -1)
   {
     rtLog_Fatal("socket:%s", rtStrError(errno));
@@ -502,16 +2540,23 @@ rtRouted_BindListener(char const* socket_name, int no_delay)
 
     ret = setsockopt(listener->fd, SOL_SOCKET, SO_REUSEADDR, (char *)&one, sizeof(one));
   }
+  else
+  {
+    // left behind by a previous run, the pid file lock says it isn't in use
+    struct sockaddr_un* un = (struct sockaddr_un *) &listener->local_endpoint;
+    if (unlink(un->sun_path) == -1 && errno != ENOENT)
+      rtLog_Warn("failed to remove %s. %s", un->sun_path, rtStrError(errno));
+  }
 
   ret = bind(listener->fd, (struct sockaddr *)&listener->local_endpoint, socket_length);
   if (ret == -1)
   {
     rtError err = rtErrorFromErrno(errno);
-    rtLog_Warn("failed to bind socket. %s", rtStrError(err));
+    rtLog_Warn("failed to bind socket %s. %s", socket_name, rtStrError(err));
     exit(1);
   }
 
-  ret = listen(listener->fd, 4);
+  ret = listen(listener->fd, RTMSG_LISTEN_BACKLOG);
   if (ret == -1)
   {
     rtLog_Warn("failed to set socket to listen mode. %s", rtStrError(errno));
@@ -528,18 +2573,26 @@ int main(int argc, char* argv[])
   int i;
   int run_in_foreground;
   int use_no_delay;
+  int num_threads;
   int ret;
-  char const* socket_name;
+  int num_sockets;
+  char const* socket_names[RTMSG_MAX_LISTENERS];
   rtRouteEntry* route;
 
   run_in_foreground = 0;
   use_no_delay = 0;
-  socket_name = "tcp://127.0.0.1:10001";
+  num_threads = 0;
+  num_sockets = 0;
 
   rtLog_SetLevel(RT_LOG_INFO);
+  clock_gettime(CLOCK_MONOTONIC, &start_time);
   rtVector_Create(&clients);
   rtVector_Create(&listeners);
-  rtVector_Create(&routes);
+  rtRouted_InitRouteCache();
+
+  route_table = (rtRouteTable *) malloc(sizeof(rtRouteTable));
+  route_table->generation = 1;
+  rtVector_Create(&route_table->routes);
 
   FILE* pid_file = fopen("/tmp/rtrouted.pid", "w");
   if (!pid_file)
@@ -556,15 +2609,22 @@ int main(int argc, char* argv[])
     exit(12);
   }
 
+  // slabs of processes that died before releasing them, nobody can use them now
+  {
+    int swept = rtShmSlab_Sweep();
+    if (swept > 0)
+      rtLog_Info("removed %d shared memory slabs left by exited processes", swept);
+  }
+
   rtLogSetLogHandler(NULL);
 
   // add internal route
   {
-    route = (rtRouteEntry *) malloc(sizeof(rtRouteEntry));
+    route = (rtRouteEntry *) calloc(1, sizeof(rtRouteEntry));
     route->subscription = NULL;
-    strcpy(route->expression, "_RTROUTED.>");
+    rtRouteEntry_SetExpression(route, "_RTROUTED.>");
     route->message_handler = rtRouted_OnMessage;
-    rtVector_PushBack(routes, route);
+    rtRouted_PushRoute(route);
   }
 
   while (1)
@@ -577,25 +2637,44 @@ int main(int argc, char* argv[])
       {"log-level",   required_argument,  0, 'l' },
       {"debug-route", no_argument,        0, 'r' },
       {"socket",      required_argument,  0, 's' },
+      {"threads",     required_argument,  0, 't' },
+      {"io-uring",    no_argument,        0, 'u' },
+      {"stats-interval", required_argument, 0, 'i' },
       { "help",       no_argument,        0, 'h' },
       {0, 0, 0, 0}
     };
 
-    c = getopt_long(argc, argv, "dfl:rhs:", long_options, &option_index);
+    c = getopt_long(argc, argv, "dfi:l:rhs:t:u", long_options, &option_index);
     if (c == -1)
       break;
 
     switch (c)
     {
       case 's':
-        socket_name = optarg;
+        if (num_sockets < RTMSG_MAX_LISTENERS)
+          socket_names[num_sockets++] = optarg;
+        else
+          rtLog_Warn("too many sockets, ignoring %s", optarg);
         break;
       case 'd':
-        use_no_delay = 0;
+        use_no_delay = 1;
         break;
       case 'f':
         run_in_foreground = 1;
         break;
+      case 't':
+        num_threads = atoi(optarg);
+        if (num_threads < 0)
+          num_threads = 0;
+        if (num_threads > RTMSG_MAX_SHARDS)
+          num_threads = RTMSG_MAX_SHARDS;
+        break;
+      case 'u':
+        use_io_uring = 1;
+        break;
+      case 'i':
+        stats_interval = atoi(optarg);
+        break;
       case 'l':
         rtLog_SetLevel(rtLogLevelFromString(optarg));
         break;
@@ -604,11 +2683,11 @@ int main(int argc, char* argv[])
         break;
       case 'r':
       {
-        route = (rtRouteEntry *) malloc(sizeof(rtRouteEntry));
+        route = (rtRouteEntry *) calloc(1, sizeof(rtRouteEntry));
         route->subscription = NULL;
         route->message_handler = &rtRouted_PrintMessage;
-        strcpy(route->expression, ">");
-        rtVector_PushBack(routes, route);
+        rtRouteEntry_SetExpression(route, ">");
+        rtRouted_PushRoute(route);
       }
       case '?':
         break;
@@ -631,7 +2710,31 @@ int main(int argc, char* argv[])
     rtLog_Info("running in foreground");
   }
 
-  rtRouted_BindListener(socket_name, use_no_delay);
+  if (num_sockets == 0)
+    socket_names[num_sockets++] = RTMSG_DEFAULT_SOCKET;
+
+  for (i = 0; i < num_sockets; ++i)
+  {
+    if (rtRouted_BindListener(socket_names[i], use_no_delay) != RT_OK)
+    {
+      rtLog_Fatal("invalid socket %s", socket_names[i]);
+      exit(1);
+    }
+  }
+
+  if (use_io_uring)
+  {
+    #ifdef RTROUTED_WITH_IO_URING
+    if (num_threads == 0)
+      num_threads = 1;
+    #else
+    rtLog_Warn("built without io_uring support, ignoring --io-uring");
+    #endif
+  }
+
+  // with shards this thread only accepts, clients stays empty
+  if (num_threads > 0)
+    rtRouted_StartShards(num_threads);
 
   while (1)
   {
@@ -644,7 +2747,7 @@ int main(int argc, char* argv[])
     max_fd= -1;
     FD_ZERO(&read_fds);
     FD_ZERO(&err_fds);
-    timeout.tv_sec = 10;
+    timeout.tv_sec = (stats_interval > 0 && stats_interval < 10) ? stats_interval : 10;
     timeout.tv_usec = 0;
 
     for (i = 0, n = rtVector_Size(listeners); i < n; ++i)
@@ -664,10 +2767,16 @@ int main(int argc, char* argv[])
       {
         rtRouted_PushFd(&read_fds, clnt->fd, &max_fd);
         rtRouted_PushFd(&err_fds, clnt->fd, &max_fd);
+        if (clnt->shm)
+          rtRouted_PushFd(&read_fds, rtShmChannel_GetFd(clnt->shm), &max_fd);
       }
     }
 
     ret = select(max_fd + 1, &read_fds, NULL, &err_fds, &timeout);
+
+    if (num_shards == 0)
+      rtRouted_PublishStats();
+
     if (ret == 0)
       continue;
 
@@ -687,12 +2796,13 @@ int main(int argc, char* argv[])
     for (i = 0, n = rtVector_Size(clients); i < n;)
     {
       rtConnectedClient* clnt = (rtConnectedClient *) rtVector_At(clients, i);
-      if (FD_ISSET(clnt->fd, &read_fds))
+      if (FD_ISSET(clnt->fd, &read_fds) || (clnt->shm && FD_ISSET(rtShmChannel_GetFd(clnt->shm), &read_fds)))
       {
         rtError err = rtConnectedClient_Read(clnt);
         if (err != RT_OK)
         {
-          rtVector_RemoveItem(clients, clnt, NULL);
+          // the last client is swapped into slot i and is visited next
+          rtVector_SwapRemoveAt(clients, i, NULL);
           rtConnectedClient_Destroy(clnt);
           n--;
           continue;